@@ -0,0 +1,698 @@
+/*
+ * Binary trace format.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include <sys/wait.h>
+
+#include "bintrace.h"
+#include "number_set.h"
+#include "printsiginfo.h"
+
+/*
+ * A binary trace is a sequence of length-prefixed records written
+ * in the native byte order.  Every output file starts with
+ * a BINTRACE_HEADER record; more header records may follow
+ * if the file is appended to.  Syscall numbers are indices in strace's
+ * own syscall tables, so a trace can be rendered only by strace built
+ * for the same architecture, which is checked using the header.
+ * Records of unknown types are skipped by the renderer.
+ *
+ * A syscall record is written on syscall exit.  It is followed by blobs
+ * of the tracee memory and the descriptor paths the decoders have read
+ * on entering and exiting the syscall.  The decoders run in binary output
+ * mode as well, but print nothing; when the trace is rendered,
+ * they run again and read the blobs instead of the tracee memory.
+ */
+
+#define BINTRACE_MAGIC		"STRACEBT"
+#define BINTRACE_VERSION	2
+
+enum bintrace_record_type {
+	BINTRACE_HEADER,
+	BINTRACE_SYSCALL,
+	BINTRACE_SIGNAL,
+	BINTRACE_EXIT,
+};
+
+/* Header flags.  */
+#define BINTRACE_PID_PREFIX	0x1
+
+/* Signal record flags.  */
+#define BINTRACE_SIGNAL_STOPPED	0x1
+
+struct bintrace_record {
+	uint32_t size;		/* Size of the whole record */
+	uint16_t type;		/* enum bintrace_record_type */
+	uint16_t flags;
+	int32_t pid;
+	uint32_t pers;
+	int64_t sec;		/* CLOCK_REALTIME */
+	int64_t nsec;
+};
+
+struct bintrace_header {
+	struct bintrace_record hdr;
+	char magic[8];
+	uint32_t version;
+	uint32_t personalities;
+	uint32_t nsyscalls[3];
+	uint32_t max_args;
+};
+
+struct bintrace_syscall {
+	struct bintrace_record hdr;
+	uint64_t scno;
+	uint64_t args[MAX_ARGS];
+	int64_t rval;
+	uint64_t error;
+	int64_t dur_sec;	/* Time spent in the syscall */
+	int64_t dur_nsec;
+	uint32_t injected;
+	uint32_t nblobs;	/* Number of blobs following the record */
+};
+
+struct bintrace_blob {
+	uint64_t addr;		/* Tracee address, or descriptor */
+	uint32_t len;		/* Size requested by the decoder */
+	uint32_t size;		/* Size of the data following the blob */
+	int32_t rc;		/* What the read has returned */
+	uint16_t kind;		/* enum bintrace_blob_kind */
+	uint16_t exiting;	/* Read on exiting the syscall */
+};
+
+/* Data of blobs is padded to keep blobs aligned.  */
+#define BINTRACE_BLOB_ALIGN	8
+
+struct bintrace_signal {
+	struct bintrace_record hdr;
+	int32_t sig;
+	uint32_t has_siginfo;
+	char siginfo[sizeof(siginfo_t)];
+};
+
+struct bintrace_exit {
+	struct bintrace_record hdr;
+	int32_t status;		/* wait status */
+	uint32_t pad;
+};
+
+union bintrace_any {
+	struct bintrace_record hdr;
+	struct bintrace_header header;
+	struct bintrace_syscall syscall;
+	struct bintrace_signal signal;
+	struct bintrace_exit exit;
+};
+
+bool binary_output;
+bool bintrace_recording;
+bool bintrace_replaying;
+
+/* Blobs read by the decoders while a syscall of a tcb is traced.  */
+struct bintrace_blobs {
+	char *data;
+	size_t size;
+	size_t len;
+	unsigned int count;
+};
+
+/* Where blobs are recorded to or replayed from.  */
+static struct bintrace_blobs *recorded_blobs;
+static const char *replayed_data;
+static size_t replayed_len;
+static bool blobs_exiting;
+
+static void
+init_record(struct bintrace_record *const rec, const struct tcb *const tcp,
+	    const unsigned int type, const size_t size)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	rec->size = size;
+	rec->type = type;
+	rec->pid = tcp ? tcp->pid : 0;
+	rec->pers = tcp ? tcp->currpers : 0;
+	rec->sec = ts.tv_sec;
+	rec->nsec = ts.tv_nsec;
+}
+
+static void
+write_record(struct tcb *const tcp, const struct bintrace_record *const rec)
+{
+	fwrite(rec, rec->size, 1, tcp->outf);
+	flush_tcp_output(tcp);
+}
+
+void
+bintrace_start(FILE *const fp, const bool pid_prefix)
+{
+	struct bintrace_header h = {
+		.magic = BINTRACE_MAGIC,
+		.version = BINTRACE_VERSION,
+		.personalities = SUPPORTED_PERSONALITIES,
+		.max_args = MAX_ARGS,
+	};
+
+	init_record(&h.hdr, NULL, BINTRACE_HEADER, sizeof(h));
+	if (pid_prefix)
+		h.hdr.flags |= BINTRACE_PID_PREFIX;
+	for (unsigned int i = 0; i < SUPPORTED_PERSONALITIES; ++i)
+		h.nsyscalls[i] = nsyscall_vec[i];
+
+	fwrite(&h, sizeof(h), 1, fp);
+}
+
+static size_t
+blob_size(const unsigned int size)
+{
+	return sizeof(struct bintrace_blob)
+	       + ROUNDUP((size_t) size, BINTRACE_BLOB_ALIGN);
+}
+
+/*
+ * Check that the blob at pos, including the padding of its data,
+ * fits into the len bytes of blobs.
+ */
+static bool
+blob_fits(const char *const data, const size_t len, const size_t pos)
+{
+	if (len - pos < sizeof(struct bintrace_blob))
+		return false;
+
+	const struct bintrace_blob *const blob = (const void *) (data + pos);
+
+	return blob->size <= len - pos - sizeof(*blob)
+	       && blob_size(blob->size) <= len - pos;
+}
+
+/*
+ * Find the blob read in the same way at the same address
+ * on entering or exiting the syscall.
+ */
+static const struct bintrace_blob *
+find_blob(const char *const data, const size_t len, const bool exiting,
+	  const unsigned int kind, const kernel_ulong_t addr,
+	  const unsigned int size)
+{
+	for (size_t pos = 0; blob_fits(data, len, pos);) {
+		const struct bintrace_blob *const blob =
+			(const void *) (data + pos);
+
+		if (blob->exiting == exiting && blob->kind == kind
+		    && blob->addr == addr && blob->len == size)
+			return blob;
+		pos += blob_size(blob->size);
+	}
+
+	return NULL;
+}
+
+/*
+ * Start recording the blobs the decoders read on entering
+ * or exiting the syscall of tcp.
+ */
+void
+bintrace_record_start(struct tcb *const tcp)
+{
+	struct tcb_cold *const cold = get_tcb_cold(tcp);
+
+	if (!cold->bintrace_blobs)
+		cold->bintrace_blobs = xcalloc(1, sizeof(*cold->bintrace_blobs));
+
+	recorded_blobs = cold->bintrace_blobs;
+	blobs_exiting = exiting(tcp);
+	if (!blobs_exiting) {
+		recorded_blobs->len = 0;
+		recorded_blobs->count = 0;
+	}
+	bintrace_recording = true;
+}
+
+void
+bintrace_record_stop(void)
+{
+	recorded_blobs = NULL;
+	bintrace_recording = false;
+}
+
+static void
+record_blob(const unsigned int kind, const kernel_ulong_t addr,
+	    const unsigned int len, const void *const data,
+	    const unsigned int size, const int rc)
+{
+	struct bintrace_blobs *const b = recorded_blobs;
+
+	/* The tracee is stopped, the same read returns the same data.  */
+	if (find_blob(b->data, b->len, blobs_exiting, kind, addr, len))
+		return;
+
+	const size_t need = b->len + blob_size(size);
+
+	while (b->size < need)
+		b->data = xgrowarray(b->data, &b->size, 1);
+
+	const struct bintrace_blob blob = {
+		.addr = addr,
+		.len = len,
+		.size = size,
+		.rc = rc,
+		.kind = kind,
+		.exiting = blobs_exiting,
+	};
+
+	memcpy(b->data + b->len, &blob, sizeof(blob));
+	if (size)
+		memcpy(b->data + b->len + sizeof(blob), data, size);
+	memset(b->data + b->len + sizeof(blob) + size, 0,
+	       need - b->len - sizeof(blob) - size);
+	b->len = need;
+	++b->count;
+}
+
+/*
+ * Record the result of umoven or umovestr:
+ * size bytes of laddr are valid if rc is not negative.
+ */
+void
+bintrace_record_umove(const unsigned int kind, const kernel_ulong_t addr,
+		      const unsigned int len, const void *const laddr,
+		      const unsigned int size, const int rc)
+{
+	record_blob(kind, addr, len, laddr, rc < 0 ? 0 : size, rc);
+}
+
+int
+bintrace_replay_umove(const unsigned int kind, const kernel_ulong_t addr,
+		      const unsigned int len, void *const laddr)
+{
+	const struct bintrace_blob *const blob =
+		find_blob(replayed_data, replayed_len, blobs_exiting,
+			  kind, addr, len);
+
+	/* The memory has not been read, or has been read in another way.  */
+	if (!blob || blob->size > len
+	    || (kind == BINTRACE_BLOB_UMOVEN && !blob->rc
+		&& blob->size != len)) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	memcpy(laddr, blob + 1, blob->size);
+	return blob->rc;
+}
+
+void
+bintrace_record_fdpath(const int fd, const char *const path, const int n)
+{
+	record_blob(BINTRACE_BLOB_FDPATH, fd, 0, path, n < 0 ? 0 : n, n);
+}
+
+int
+bintrace_replay_fdpath(const int fd, char *const buf,
+		       const unsigned int bufsize)
+{
+	const struct bintrace_blob *const blob =
+		find_blob(replayed_data, replayed_len, blobs_exiting,
+			  BINTRACE_BLOB_FDPATH, fd, 0);
+
+	if (!blob || blob->rc < 0)
+		return -1;
+
+	const unsigned int n = MIN(blob->size, bufsize - 1);
+
+	memcpy(buf, blob + 1, n);
+	buf[n] = '\0';
+	return n;
+}
+
+void
+bintrace_release(struct tcb *const tcp)
+{
+	if (!tcp->cold || !tcp->cold->bintrace_blobs)
+		return;
+
+	free(tcp->cold->bintrace_blobs->data);
+	free(tcp->cold->bintrace_blobs);
+	tcp->cold->bintrace_blobs = NULL;
+}
+
+void
+bintrace_syscall(struct tcb *const tcp, const struct timespec *const ts,
+		 const unsigned int flags)
+{
+	struct bintrace_blobs *const b =
+		tcp->cold ? tcp->cold->bintrace_blobs : NULL;
+	struct bintrace_syscall sc = {
+		.scno = tcp->scno,
+		.rval = tcp->u_rval,
+		.error = tcp->u_error,
+		.injected = !!syscall_tampered(tcp),
+		.nblobs = b ? b->count : 0,
+	};
+
+	init_record(&sc.hdr, tcp, BINTRACE_SYSCALL,
+		    sizeof(sc) + (b ? b->len : 0));
+	sc.hdr.flags = flags;
+	for (unsigned int i = 0; i < MAX_ARGS; ++i)
+		sc.args[i] = tcp->u_arg[i];
+
+	if (ts && !(flags & BINTRACE_SYSCALL_UNFINISHED)) {
+		struct timespec dur;
+
+		ts_sub(&dur, ts, &tcp->etime);
+		sc.dur_sec = dur.tv_sec;
+		sc.dur_nsec = dur.tv_nsec;
+	}
+
+	fwrite(&sc, sizeof(sc), 1, tcp->outf);
+	if (b && b->len) {
+		fwrite(b->data, b->len, 1, tcp->outf);
+		b->len = 0;
+		b->count = 0;
+	}
+	flush_tcp_output(tcp);
+}
+
+void
+bintrace_signal(struct tcb *const tcp, const unsigned int sig,
+		const siginfo_t *const si)
+{
+	struct bintrace_signal s = { .sig = sig };
+
+	init_record(&s.hdr, tcp, BINTRACE_SIGNAL, sizeof(s));
+	if (si) {
+		memcpy(s.siginfo, si, sizeof(*si));
+		s.has_siginfo = 1;
+	} else {
+		s.hdr.flags = BINTRACE_SIGNAL_STOPPED;
+	}
+
+	write_record(tcp, &s.hdr);
+}
+
+void
+bintrace_exit(struct tcb *const tcp, const int status)
+{
+	struct bintrace_exit e = { .status = status };
+
+	init_record(&e.hdr, tcp, BINTRACE_EXIT, sizeof(e));
+
+	write_record(tcp, &e.hdr);
+}
+
+/* Renderer.  */
+
+static const char *render_path;
+static bool render_pid_prefix;
+
+static void
+check_header(const struct bintrace_header *const h)
+{
+	if (h->hdr.size < sizeof(*h)
+	    || memcmp(h->magic, BINTRACE_MAGIC, sizeof(h->magic)))
+		error_msg_and_die("%s: not a binary trace", render_path);
+	if (h->version != BINTRACE_VERSION)
+		error_msg_and_die("%s: unsupported binary trace version %u",
+				  render_path, h->version);
+	if (h->personalities != SUPPORTED_PERSONALITIES
+	    || h->max_args != MAX_ARGS)
+		error_msg_and_die("%s: binary trace was recorded "
+				  "for a different architecture", render_path);
+	for (unsigned int i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
+		if (h->nsyscalls[i] != nsyscall_vec[i])
+			error_msg_and_die("%s: binary trace was recorded "
+					  "by a different version of strace",
+					  render_path);
+	}
+
+	render_pid_prefix = h->hdr.flags & BINTRACE_PID_PREFIX;
+}
+
+/* Check that the blobs of a syscall record do not overrun it.  */
+static void
+check_blobs(const char *const data, const size_t len)
+{
+	for (size_t pos = 0; pos < len;) {
+		const struct bintrace_blob *const blob =
+			(const void *) (data + pos);
+
+		if (!blob_fits(data, len, pos))
+			error_msg_and_die("%s: corrupt record", render_path);
+		pos += blob_size(blob->size);
+	}
+}
+
+static void
+render_leader(struct tcb *const tcp, const struct bintrace_record *const rec,
+	      const struct timespec *const ts)
+{
+	tcp->pid = rec->pid;
+	tcp->currpers = rec->pers;
+	printleader_replay(tcp, ts, render_pid_prefix);
+}
+
+/* Reset the state the decoders keep in tcp.  */
+static void
+reset_tcb(struct tcb *const tcp)
+{
+	free_tcb_priv_data(tcp);
+	tcp->flags = 0;
+	tcp->auxstr = NULL;
+	tcp->sys_func_rval = 0;
+	tcp->u_rval = 0;
+	tcp->u_error = 0;
+}
+
+/*
+ * Print a syscall the way strace prints it while tracing: the decoders
+ * run on entering and on exiting the syscall, reading the recorded blobs
+ * instead of the tracee memory.  The arguments of syscalls that are not
+ * known to this strace are printed as numbers.
+ */
+static void
+render_syscall(struct tcb *const tcp, const struct bintrace_syscall *const sc,
+	       const char *const blobs, const size_t blobs_len)
+{
+	const struct timespec dur = {
+		.tv_sec = sc->dur_sec,
+		.tv_nsec = sc->dur_nsec
+	};
+	struct timespec ts = {
+		.tv_sec = sc->hdr.sec,
+		.tv_nsec = sc->hdr.nsec
+	};
+	const kernel_ulong_t scno = sc->scno;
+	const unsigned int flags = sc->hdr.flags;
+
+	/* The record is written on syscall exit, print the entry time.  */
+	ts_sub(&ts, &ts, &dur);
+
+	if (sc->hdr.pers >= SUPPORTED_PERSONALITIES)
+		return;
+	set_personality(sc->hdr.pers);
+
+	/* Socket and ipc subcalls are recorded by their own numbers.  */
+	const bool known = scno_in_range(scno) && sysent[scno].sys_func;
+	if (known && !(qual_flags(scno) & QUAL_TRACE))
+		return;
+	if (not_failing_only && sc->error
+	    && !(flags & (BINTRACE_SYSCALL_UNFINISHED
+			  | BINTRACE_SYSCALL_UNAVAILABLE)))
+		return;
+
+	reset_tcb(tcp);
+	tcp->pid = sc->hdr.pid;
+	tcp->currpers = sc->hdr.pers;
+	tcp->scno = scno;
+	tcp->s_ent = known ? &sysent[scno] : NULL;
+	tcp->qual_flg = known ? qual_flags(scno) : QUAL_RAW | DEFAULT_QUAL_FLAGS;
+	for (unsigned int i = 0; i < MAX_ARGS; ++i)
+		tcp->u_arg[i] = sc->args[i];
+	if (sc->injected)
+		tcp->flags |= TCB_TAMPERED;
+
+	replayed_data = blobs;
+	replayed_len = blobs_len;
+	blobs_exiting = false;
+
+	if (tracing_paths && known && !pathtrace_match(tcp))
+		return;
+
+	render_leader(tcp, &sc->hdr, &ts);
+
+	int res;
+	if (known) {
+		tprintf("%s(", sysent[scno].sys_name);
+		res = raw(tcp) ? printargs(tcp) : sysent[scno].sys_func(tcp);
+	} else {
+		tprintf("syscall_%#" PRI_klx "(", shuffle_scno(scno));
+		res = printargs(tcp);
+	}
+
+	if (flags & (BINTRACE_SYSCALL_UNFINISHED
+		     | BINTRACE_SYSCALL_UNAVAILABLE)) {
+		if ((flags & BINTRACE_SYSCALL_UNFINISHED)
+		    && !(res & RVAL_DECODED))
+			tprints(" <unfinished ...>");
+		tprints(") ");
+		tabto();
+		tprints(flags & BINTRACE_SYSCALL_UNAVAILABLE
+			? "= ? <unavailable>\n" : "= ?\n");
+		line_ended();
+		return;
+	}
+
+	tcp->flags |= TCB_INSYSCALL;
+	tcp->sys_func_rval = res;
+	tcp->u_rval = sc->rval;
+	tcp->u_error = sc->error;
+	blobs_exiting = true;
+
+	int sys_res = 0;
+	if (!raw(tcp))
+		sys_res = (res & RVAL_DECODED) ? res : sysent[scno].sys_func(tcp);
+
+	/* The duration is printed by -T as the time since tcp->etime.  */
+	struct timespec end = dur;
+	tcp->etime = (struct timespec) { 0 };
+	print_syscall_exit(tcp, sys_res, &end);
+}
+
+static void
+render_signal(struct tcb *const tcp, const struct bintrace_signal *const s)
+{
+	const struct timespec ts = {
+		.tv_sec = s->hdr.sec,
+		.tv_nsec = s->hdr.nsec
+	};
+
+	if (!is_number_in_set(s->sig, signal_set))
+		return;
+
+	render_leader(tcp, &s->hdr, &ts);
+	if (s->hdr.flags & BINTRACE_SIGNAL_STOPPED) {
+		tprintf("--- stopped by %s ---\n", sprintsigname(s->sig));
+	} else if (s->has_siginfo) {
+		siginfo_t si;
+
+		memcpy(&si, s->siginfo, sizeof(si));
+		tprintf("--- %s ", sprintsigname(s->sig));
+		printsiginfo(&si);
+		tprints(" ---\n");
+	} else {
+		tprintf("--- %s ---\n", sprintsigname(s->sig));
+	}
+	line_ended();
+}
+
+static void
+render_exit(struct tcb *const tcp, const struct bintrace_exit *const e)
+{
+	const struct timespec ts = {
+		.tv_sec = e->hdr.sec,
+		.tv_nsec = e->hdr.nsec
+	};
+	const int status = e->status;
+
+	if (WIFSIGNALED(status)) {
+		if (!is_number_in_set(WTERMSIG(status), signal_set))
+			return;
+		render_leader(tcp, &e->hdr, &ts);
+		tprintf("+++ killed by %s %s+++\n",
+			sprintsigname(WTERMSIG(status)),
+			WCOREDUMP(status) ? "(core dumped) " : "");
+	} else {
+		if (qflag >= 2)
+			return;
+		render_leader(tcp, &e->hdr, &ts);
+		tprintf("+++ exited with %d +++\n", WEXITSTATUS(status));
+	}
+	line_ended();
+}
+
+/*
+ * Read records from the binary trace PATH and print them to OUT
+ * the way strace prints the trace while tracing.
+ */
+int
+bintrace_render(const char *const path, FILE *const out)
+{
+	FILE *const fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp)
+		perror_msg_and_die("Can't fopen '%s'", path);
+	render_path = path;
+
+	struct tcb *const tcp = xcalloc(1, sizeof(*tcp));
+	tcp->outf = out;
+	bintrace_replaying = true;
+
+	struct bintrace_record hdr;
+	union bintrace_any *rec = NULL;
+	size_t rec_size = 0;
+	bool seen_header = false;
+
+	for (;;) {
+		size_t n = fread(&hdr, 1, sizeof(hdr), fp);
+		if (n == 0 && !ferror(fp))
+			break;
+		if (!seen_header
+		    && (n != sizeof(hdr)
+			|| hdr.type != BINTRACE_HEADER
+			|| hdr.size < sizeof(rec->header)))
+			error_msg_and_die("%s: not a binary trace", path);
+		if (n != sizeof(hdr) || hdr.size < sizeof(hdr))
+			error_msg_and_die("%s: truncated record", path);
+
+		/* Fields missing from a short record of a known type are 0.  */
+		while (rec_size < MAX(hdr.size, sizeof(*rec)))
+			rec = xgrowarray(rec, &rec_size, 1);
+		memset(rec, 0, sizeof(*rec));
+		rec->hdr = hdr;
+
+		const size_t size = hdr.size - sizeof(hdr);
+		if (fread((char *) rec + sizeof(hdr), 1, size, fp) != size)
+			error_msg_and_die("%s: truncated record", path);
+
+		switch (hdr.type) {
+		case BINTRACE_HEADER:
+			check_header(&rec->header);
+			seen_header = true;
+			break;
+		case BINTRACE_SYSCALL: {
+			const char *const blobs =
+				(const char *) rec + sizeof(rec->syscall);
+			const size_t blobs_len =
+				hdr.size > sizeof(rec->syscall)
+				? hdr.size - sizeof(rec->syscall) : 0;
+
+			check_blobs(blobs, blobs_len);
+			render_syscall(tcp, &rec->syscall, blobs, blobs_len);
+			break;
+		}
+		case BINTRACE_SIGNAL:
+			render_signal(tcp, &rec->signal);
+			break;
+		case BINTRACE_EXIT:
+			render_exit(tcp, &rec->exit);
+			break;
+		}
+	}
+
+	bintrace_replaying = false;
+	free(rec);
+	reset_tcb(tcp);
+	if (fp != stdin)
+		fclose(fp);
+	free(tcp);
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_BINTRACE_H
+# define STRACE_BINTRACE_H
+
+# include <signal.h>
+# include "defs.h"
+
+/* Set by --format=binary: write binary records instead of text.  */
+extern bool binary_output;
+
+/* The syscall exit has not been seen, e.g. the tracee has been killed.  */
+# define BINTRACE_SYSCALL_UNFINISHED	0x1
+/* An error has occurred while fetching syscall arguments or result.  */
+# define BINTRACE_SYSCALL_UNAVAILABLE	0x2
+
+/*
+ * Set while the decoders run without printing anything in binary output
+ * mode: the tracee memory and the descriptor paths they read are recorded.
+ */
+extern bool bintrace_recording;
+/*
+ * Set while a binary trace is rendered: the tracee memory and
+ * the descriptor paths are read from the records.
+ */
+extern bool bintrace_replaying;
+
+/* How a blob of recorded data has been read.  */
+enum bintrace_blob_kind {
+	BINTRACE_BLOB_UMOVEN,
+	BINTRACE_BLOB_UMOVESTR,
+	BINTRACE_BLOB_FDPATH,
+};
+
+extern void bintrace_start(FILE *, bool pid_prefix);
+extern void bintrace_record_start(struct tcb *);
+extern void bintrace_record_stop(void);
+extern void bintrace_record_umove(unsigned int kind, kernel_ulong_t addr,
+				  unsigned int len, const void *laddr,
+				  unsigned int size, int rc);
+extern int bintrace_replay_umove(unsigned int kind, kernel_ulong_t addr,
+				 unsigned int len, void *laddr);
+extern void bintrace_record_fdpath(int fd, const char *path, int n);
+extern int bintrace_replay_fdpath(int fd, char *buf, unsigned int bufsize);
+extern void bintrace_release(struct tcb *);
+extern void bintrace_syscall(struct tcb *, const struct timespec *, unsigned int flags);
+extern void bintrace_signal(struct tcb *, unsigned int sig, const siginfo_t *);
+extern void bintrace_exit(struct tcb *, int status);
+
+extern int bintrace_render(const char *path, FILE *out);
+
+#endif /* !STRACE_BINTRACE_H */
@@ -13,10 +13,14 @@
 #include "defs.h"
 #include <sched.h>
 #include <asm/unistd.h>
+#include "syscall.h"
 
 #ifndef CSIGNAL
 # define CSIGNAL 0x000000ff
 #endif
+#ifndef CLONE_PIDFD
+# define CLONE_PIDFD 0x00001000
+#endif
 
 #include "xlat/clone_flags.h"
 #include "xlat/setns_types.h"
@@ -75,6 +79,33 @@ print_tls_arg(struct tcb *const tcp, const kernel_ulong_t addr)
 	}
 }
 
+/* The first version of struct clone_args, see linux/sched.h.  */
+struct strace_clone_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+};
+
+kernel_ulong_t
+get_clone_flags(struct tcb *tcp)
+{
+	if (tcp_sysent(tcp)->sen == SEN_clone3) {
+		uint64_t flags;
+
+		if (tcp->u_arg[1] < sizeof(struct strace_clone_args)
+		    || umove(tcp, tcp->u_arg[0], &flags))
+			return 0;
+		return flags;
+	}
+
+	return tcp->u_arg[ARG_FLAGS];
+}
+
 SYS_FUNC(clone)
 {
 	if (exiting(tcp)) {
@@ -126,6 +157,48 @@ SYS_FUNC(clone)
 	return 0;
 }
 
+SYS_FUNC(clone3)
+{
+	const kernel_ulong_t addr = tcp->u_arg[0];
+	const kernel_ulong_t size = tcp->u_arg[1];
+	struct strace_clone_args args;
+
+	if (size < sizeof(args))
+		printaddr(addr);
+	else if (!umove_or_printaddr(tcp, addr, &args)) {
+		tprints("{flags=");
+		printflags64(clone_flags, args.flags, "CLONE_???");
+		if (args.flags & CLONE_PIDFD) {
+			tprints(", pidfd=");
+			printaddr64(args.pidfd);
+		}
+		if (args.flags & (CLONE_CHILD_SETTID|CLONE_CHILD_CLEARTID)) {
+			tprints(", child_tid=");
+			printaddr64(args.child_tid);
+		}
+		if (args.flags & CLONE_PARENT_SETTID) {
+			tprints(", parent_tid=");
+			printaddr64(args.parent_tid);
+		}
+		tprints(", exit_signal=");
+		if (args.exit_signal <= INT_MAX)
+			printsignal(args.exit_signal);
+		else
+			tprintf("%#" PRIx64, args.exit_signal);
+		tprints(", stack=");
+		printaddr64(args.stack);
+		tprintf(", stack_size=%#" PRIx64, args.stack_size);
+		if (args.flags & CLONE_SETTLS) {
+			tprints(", tls=");
+			printaddr64(args.tls);
+		}
+		tprints("}");
+	}
+	tprintf(", %" PRI_klu, size);
+
+	return RVAL_DECODED;
+}
+
 SYS_FUNC(setns)
 {
 	printfd(tcp, tcp->u_arg[0]);
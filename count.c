@@ -15,12 +15,36 @@
  */
 
 #include "defs.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "ptrace.h"
+#include "scno.h"
+#include "xstring.h"
+
+/*
+ * Histogram of syscall times in nanoseconds.  Every power of two range
+ * is split into LAT_SUB buckets, so the value of a bucket is known with
+ * the precision of 1 / LAT_SUB.
+ */
+#define LAT_SUB_BITS	3
+#define LAT_SUB		(1U << LAT_SUB_BITS)
+#define LAT_BUCKETS	((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct latency_hist {
+	uint64_t min, max;
+	uint64_t p99;	/* cached for sorting */
+	unsigned int buckets[LAT_BUCKETS];
+};
 
 /* Per-syscall stats structure */
 struct call_counts {
 	/* time may be total latency or system time */
 	struct timespec time;
 	unsigned int calls, errors;
+	/* allocated for the syscalls that have been seen */
+	struct latency_hist *hist;
 };
 
 static struct call_counts *countv[SUPPORTED_PERSONALITIES];
@@ -28,6 +52,283 @@ static struct call_counts *countv[SUPPORTED_PERSONALITIES];
 
 static struct timespec overhead;
 
+/* How overhead has been chosen.  */
+static enum {
+	OVERHEAD_NONE,
+	OVERHEAD_OPTION,	/* -O overhead */
+	OVERHEAD_AUTO,		/* -O auto, not calibrated yet */
+	OVERHEAD_CALIBRATED,
+} overhead_source;
+
+/* Whether the overhead is printed with the summary.  */
+static bool print_overhead;
+
+/* Whether latency percentiles and histograms are reported.  */
+static bool count_latency;
+
+/*
+ * Counts of a group of tracees selected by --summary-by.  Groups make
+ * only a few syscalls each, so the counts of the syscalls the group
+ * has made are kept in a small open addressing hash table.
+ */
+struct group_call_counts {
+	unsigned int pers;
+	unsigned int scno;
+	struct call_counts cc;
+};
+
+struct count_group {
+	struct count_group *next;
+	int id;				/* tid or tgid */
+	char comm[16];			/* command name */
+	unsigned int size;		/* a power of 2 */
+	unsigned int used;
+	struct group_call_counts *tab;
+	/* totals, filled when the summary is printed */
+	struct timespec time;
+	unsigned int calls, errors;
+	const struct group_call_counts *top;
+};
+
+static enum {
+	GROUP_BY_NONE,
+	GROUP_BY_TID,
+	GROUP_BY_TGID,
+	GROUP_BY_COMM,
+} group_by;
+
+static const char *const group_by_names[] = {
+	[GROUP_BY_TID] = "tid",
+	[GROUP_BY_TGID] = "tgid",
+	[GROUP_BY_COMM] = "comm",
+};
+
+/*
+ * Interval summaries of --summary-interval: the counts as of the last
+ * one are kept to print the difference.
+ */
+static unsigned int summary_interval;
+static bool summary_json;
+static timer_t summary_timer;
+static bool summary_timer_is_armed;
+static volatile sig_atomic_t summary_timer_fired;
+static struct timespec summary_next_ts;
+static struct timespec summary_last_ts;
+static unsigned int summary_seq;
+static struct call_counts *prev_countv[SUPPORTED_PERSONALITIES];
+
+#define GROUP_HASH_SIZE	256
+static struct count_group *group_hash[GROUP_HASH_SIZE];
+static unsigned int num_groups;
+static unsigned int group_top = 10;
+
+static inline unsigned int
+highest_bit(uint64_t val)
+{
+#if GNUC_PREREQ(3, 4)
+	return 63 - __builtin_clzll(val);
+#else
+	unsigned int n = 0;
+
+	for (; val >>= 1; )
+		++n;
+
+	return n;
+#endif
+}
+
+static unsigned int
+lat_bucket(const uint64_t ns)
+{
+	if (ns < LAT_SUB)
+		return ns;
+
+	const unsigned int shift = highest_bit(ns) - LAT_SUB_BITS;
+
+	return (shift + 1) * LAT_SUB + (unsigned int) (ns >> shift) - LAT_SUB;
+}
+
+/* The lowest value of bucket i.  */
+static uint64_t
+lat_bucket_low(const unsigned int i)
+{
+	if (i < LAT_SUB)
+		return i;
+
+	const unsigned int shift = i / LAT_SUB - 1;
+
+	return (uint64_t) (i % LAT_SUB + LAT_SUB) << shift;
+}
+
+/* The highest value of bucket i.  */
+static uint64_t
+lat_bucket_high(const unsigned int i)
+{
+	return i + 1 < LAT_BUCKETS ? lat_bucket_low(i + 1) - 1 : UINT64_MAX;
+}
+
+static void
+lat_add(struct latency_hist *const h, const struct timespec *const ts)
+{
+	const uint64_t ns = ts->tv_sec < 0 ? 0
+		: (uint64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+
+	if (ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	++h->buckets[lat_bucket(ns)];
+}
+
+/*
+ * Return the value below which pct percent of calls fall,
+ * with the precision of the histogram.
+ */
+static uint64_t
+lat_percentile(const struct latency_hist *const h, const unsigned int calls,
+	       const unsigned int pct)
+{
+	const uint64_t target = ((uint64_t) calls * pct + 99) / 100;
+	uint64_t sum = 0;
+
+	for (unsigned int i = 0; i < LAT_BUCKETS; ++i) {
+		sum += h->buckets[i];
+		if (sum && sum >= target)
+			return MAX(h->min, MIN(h->max, lat_bucket_high(i)));
+	}
+
+	return h->max;
+}
+
+static void
+read_comm(const int pid, char *const comm, const size_t size)
+{
+	char path[sizeof("/proc/%u/comm") + sizeof(int) * 3];
+
+	xsprintf(path, "/proc/%u/comm", pid);
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	const ssize_t n = fd < 0 ? -1 : read(fd, comm, size - 1);
+
+	if (fd >= 0)
+		close(fd);
+	if (n <= 0) {
+		strcpy(comm, "?");
+		return;
+	}
+	comm[n] = '\0';
+	comm[strcspn(comm, "\n")] = '\0';
+}
+
+static unsigned int
+hash_comm(const char *str)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *str; ++str)
+		h = (h ^ (unsigned char) *str) * 16777619U;
+
+	return h;
+}
+
+/* Return the group of tcp, creating it if necessary.  */
+static struct count_group *
+get_count_group(struct tcb *const tcp)
+{
+	if (tcp->cold && tcp->cold->count_group)
+		return tcp->cold->count_group;
+
+	int id = tcp->pid;
+	char comm[sizeof(((struct count_group *) NULL)->comm)] = "";
+	unsigned int threads;
+
+	switch (group_by) {
+	case GROUP_BY_TGID:
+		if (!read_thread_group(tcp->pid, &id, &threads))
+			id = tcp->pid;
+		break;
+	case GROUP_BY_COMM:
+		read_comm(tcp->pid, comm, sizeof(comm));
+		id = 0;
+		break;
+	default:
+		break;
+	}
+
+	const unsigned int h = (group_by == GROUP_BY_COMM
+				? hash_comm(comm) : (unsigned int) id)
+			       % GROUP_HASH_SIZE;
+	struct count_group *g;
+
+	for (g = group_hash[h]; g; g = g->next) {
+		if (g->id == id && !strcmp(g->comm, comm))
+			break;
+	}
+
+	if (!g) {
+		g = xcalloc(1, sizeof(*g));
+		g->id = id;
+		strcpy(g->comm, comm);
+		g->next = group_hash[h];
+		group_hash[h] = g;
+		++num_groups;
+	}
+
+	get_tcb_cold(tcp)->count_group = g;
+
+	return g;
+}
+
+static unsigned int
+group_call_hash(const struct count_group *const g,
+		const unsigned int pers, const unsigned int scno)
+{
+	return (scno * 2654435761U + pers) & (g->size - 1);
+}
+
+/* Return the counts of syscall scno of personality pers in group g.  */
+static struct call_counts *
+get_group_call_counts(struct count_group *const g,
+		      const unsigned int pers, const unsigned int scno)
+{
+	if (g->size) {
+		for (unsigned int i = group_call_hash(g, pers, scno);
+		     g->tab[i].cc.calls; i = (i + 1) & (g->size - 1)) {
+			if (g->tab[i].scno == scno
+			    && g->tab[i].pers == pers)
+				return &g->tab[i].cc;
+		}
+	}
+
+	if ((g->used + 1) * 2 > g->size) {
+		struct group_call_counts *const old = g->tab;
+		const unsigned int old_size = g->size;
+
+		g->size = old_size ? old_size * 2 : 16;
+		g->tab = xcalloc(g->size, sizeof(*g->tab));
+		for (unsigned int j = 0; j < old_size; ++j) {
+			if (!old[j].cc.calls)
+				continue;
+			unsigned int i = group_call_hash(g, old[j].pers,
+							 old[j].scno);
+			while (g->tab[i].cc.calls)
+				i = (i + 1) & (g->size - 1);
+			g->tab[i] = old[j];
+		}
+		free(old);
+	}
+
+	unsigned int i = group_call_hash(g, pers, scno);
+
+	while (g->tab[i].cc.calls)
+		i = (i + 1) & (g->size - 1);
+	g->tab[i].pers = pers;
+	g->tab[i].scno = scno;
+	++g->used;
+
+	return &g->tab[i].cc;
+}
+
 void
 count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 {
@@ -37,6 +338,7 @@ count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 	if (!counts)
 		counts = xcalloc(nsyscalls, sizeof(*counts));
 	struct call_counts *cc = &counts[tcp->scno];
+	struct timespec wts;
 
 	cc->calls++;
 	if (syserror(tcp))
@@ -44,13 +346,31 @@ count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 
 	if (count_wallclock) {
 		/* wall clock time spent while in syscall */
-		struct timespec wts;
 		ts_sub(&wts, syscall_exiting_ts, &tcp->etime);
-
-		ts_add(&cc->time, &cc->time, &wts);
 	} else {
 		/* system CPU time spent while in syscall */
-		ts_add(&cc->time, &cc->time, &tcp->dtime);
+		wts = tcp->dtime;
+	}
+	ts_add(&cc->time, &cc->time, &wts);
+
+	if (group_by != GROUP_BY_NONE) {
+		struct call_counts *const gc =
+			get_group_call_counts(get_count_group(tcp),
+					      current_personality, tcp->scno);
+
+		gc->calls++;
+		if (syserror(tcp))
+			gc->errors++;
+		ts_add(&gc->time, &gc->time, &wts);
+	}
+
+	if (count_latency) {
+		if (!cc->hist) {
+			cc->hist = xcalloc(1, sizeof(*cc->hist));
+			cc->hist->min = UINT64_MAX;
+		}
+		ts_sub(&wts, &wts, &overhead);
+		lat_add(cc->hist, &wts);
 	}
 }
 
@@ -78,6 +398,17 @@ count_cmp(void *a, void *b)
 	return (m < n) ? 1 : (m > n) ? -1 : 0;
 }
 
+static int
+p99_cmp(void *a, void *b)
+{
+	const struct latency_hist *ha = counts[*((int *) a)].hist;
+	const struct latency_hist *hb = counts[*((int *) b)].hist;
+	uint64_t m = ha ? ha->p99 : 0;
+	uint64_t n = hb ? hb->p99 : 0;
+
+	return (m < n) ? 1 : (m > n) ? -1 : 0;
+}
+
 static int (*sortfun)();
 
 void
@@ -85,6 +416,10 @@ set_sortby(const char *sortby)
 {
 	if (strcmp(sortby, "time") == 0)
 		sortfun = time_cmp;
+	else if (strcmp(sortby, "p99") == 0) {
+		sortfun = p99_cmp;
+		count_latency = true;
+	}
 	else if (strcmp(sortby, "calls") == 0)
 		sortfun = count_cmp;
 	else if (strcmp(sortby, "name") == 0)
@@ -100,6 +435,252 @@ void set_overhead(int n)
 {
 	overhead.tv_sec = n / 1000000;
 	overhead.tv_nsec = n % 1000000 * 1000;
+	overhead_source = OVERHEAD_OPTION;
+}
+
+void
+set_overhead_auto(void)
+{
+	overhead.tv_sec = overhead.tv_nsec = 0;
+	overhead_source = OVERHEAD_AUTO;
+}
+
+void
+set_print_overhead(void)
+{
+	print_overhead = true;
+}
+
+/* Warm-up and measured getppid calls of every calibration round.  */
+#define CALIBRATION_WARMUP	64
+#define CALIBRATION_CALLS	1024
+/* Calibration rounds, the median of them is used.  */
+#define CALIBRATION_ROUNDS	5
+
+/*
+ * Get the time spent by strace itself in the clock the summary uses:
+ * wall clock time with -w, system CPU time otherwise.
+ */
+static void
+get_calibration_time(struct timespec *const ts)
+{
+	if (count_wallclock) {
+		clock_gettime(CLOCK_MONOTONIC, ts);
+	} else {
+		struct rusage ru;
+
+		getrusage(RUSAGE_SELF, &ru);
+		ts->tv_sec = ru.ru_stime.tv_sec;
+		ts->tv_nsec = ru.ru_stime.tv_usec * 1000;
+	}
+}
+
+/* Measure the time of an untraced getppid call.  */
+static void
+measure_untraced(struct timespec *const ts)
+{
+	struct timespec ts_start, ts_end;
+
+	get_calibration_time(&ts_start);
+	for (unsigned int i = 0; i < CALIBRATION_CALLS; ++i)
+		syscall(__NR_getppid);
+	get_calibration_time(&ts_end);
+	ts_sub(ts, &ts_end, &ts_start);
+	ts_div(ts, ts, CALIBRATION_CALLS);
+}
+
+/*
+ * Measure the time of a getppid call of the traced child pid the way
+ * count_syscall does.  Stops alternate between entering and exiting
+ * getppid.
+ *
+ * Returns false if the child has not stopped as expected.
+ */
+static bool
+measure_traced(const int pid, struct timespec *const ts)
+{
+	struct timespec etime = { 0 }, stime = { 0 }, total = { 0 };
+	unsigned int calls = 0;
+	int status;
+
+	for (unsigned int stop = 0;
+	     stop < 2 * (CALIBRATION_WARMUP + CALIBRATION_CALLS); ++stop) {
+		struct rusage ru;
+
+		if (ptrace(PTRACE_SYSCALL, pid, 0L, 0L) < 0
+		    || wait4(pid, &status, __WALL, &ru) != pid
+		    || !WIFSTOPPED(status)
+		    || WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+			debug_func_msg("calibration stopped at stop #%u",
+				       stop);
+			return false;
+		}
+
+		struct timespec now;
+		const struct timespec ru_stime = {
+			.tv_sec = ru.ru_stime.tv_sec,
+			.tv_nsec = ru.ru_stime.tv_usec * 1000
+		};
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (stop % 2 && stop >= 2 * CALIBRATION_WARMUP) {
+			/* exiting */
+			if (count_wallclock)
+				ts_sub(&now, &now, &etime);
+			else
+				ts_sub(&now, &ru_stime, &stime);
+			ts_add(&total, &total, &now);
+			++calls;
+		}
+		stime = ru_stime;
+
+		clock_gettime(CLOCK_MONOTONIC, &etime);
+	}
+
+	ts_div(ts, &total, calls);
+	return true;
+}
+
+static int
+ts_qsort_cmp(const void *a, const void *b)
+{
+	return ts_cmp(a, b);
+}
+
+/*
+ * Measure how much tracing adds to the time of a syscall by running
+ * getppid in a loop in a child that is traced the same way tracees are,
+ * and subtract the time of the same calls made without tracing.
+ * This is done only if requested by -O auto.
+ */
+void
+calibrate_overhead(void)
+{
+#ifdef HAVE_FORK
+	if (overhead_source != OVERHEAD_AUTO)
+		return;
+
+	int pid = fork();
+	if (pid < 0) {
+		perror_func_msg("fork");
+		return;
+	}
+
+	if (pid == 0) {
+		/* get the pid before PTRACE_TRACEME */
+		pid = getpid();
+		if (ptrace(PTRACE_TRACEME, 0L, 0L, 0L) < 0)
+			_exit(1);
+		kill(pid, SIGSTOP);
+		for (;;)
+			syscall(__NR_getppid);
+	}
+
+	struct timespec rounds[CALIBRATION_ROUNDS];
+	unsigned int n = 0;
+	int status;
+
+	if (waitpid(pid, &status, __WALL) == pid && WIFSTOPPED(status)
+	    && ptrace(PTRACE_SETOPTIONS, pid, 0L, PTRACE_O_TRACESYSGOOD) == 0) {
+		for (; n < CALIBRATION_ROUNDS; ++n) {
+			struct timespec untraced, traced;
+
+			measure_untraced(&untraced);
+			if (!measure_traced(pid, &traced))
+				break;
+			ts_sub(&rounds[n], &traced, &untraced);
+		}
+	}
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, __WALL);
+
+	if (n != CALIBRATION_ROUNDS)
+		return;
+
+	qsort(rounds, n, sizeof(rounds[0]), ts_qsort_cmp);
+	overhead = rounds[n / 2];
+	if (overhead.tv_sec < 0 || overhead.tv_nsec < 0)
+		overhead.tv_sec = overhead.tv_nsec = 0;
+	overhead_source = OVERHEAD_CALIBRATED;
+
+	debug_msg("calibrated overhead: %ld.%09ld seconds per syscall",
+		  (long) overhead.tv_sec, (long) overhead.tv_nsec);
+#endif /* HAVE_FORK */
+}
+
+void
+set_count_latency(void)
+{
+	count_latency = true;
+}
+
+void
+set_summary_interval(unsigned int seconds)
+{
+	summary_interval = seconds;
+}
+
+void
+set_summary_format(const char *format)
+{
+	if (strcmp(format, "table") == 0)
+		summary_json = false;
+	else if (strcmp(format, "json") == 0)
+		summary_json = true;
+	else
+		error_msg_and_help("invalid --summary-format argument: '%s'",
+				   format);
+}
+
+void
+set_count_group(const char *by)
+{
+	if (strcmp(by, "tid") == 0)
+		group_by = GROUP_BY_TID;
+	else if (strcmp(by, "tgid") == 0)
+		group_by = GROUP_BY_TGID;
+	else if (strcmp(by, "comm") == 0)
+		group_by = GROUP_BY_COMM;
+	else
+		error_msg_and_help("invalid --summary-by argument: '%s'", by);
+}
+
+void
+set_count_group_top(unsigned int n)
+{
+	group_top = n;
+}
+
+/* Print the latency histogram of a syscall, one line per power of two.  */
+static void
+print_latency_hist(FILE *outf, const char *name,
+		   const struct latency_hist *const h)
+{
+	static const char bar[] = "****************************************";
+	const unsigned int first = lat_bucket(h->min) / LAT_SUB;
+	const unsigned int last = lat_bucket(h->max) / LAT_SUB;
+	unsigned int rows[LAT_BUCKETS / LAT_SUB] = { 0 };
+	unsigned int peak = 0;
+
+	for (unsigned int i = first * LAT_SUB; i < (last + 1) * LAT_SUB; ++i)
+		rows[i / LAT_SUB] += h->buckets[i];
+	for (unsigned int i = first; i <= last; ++i)
+		peak = MAX(peak, rows[i]);
+
+	fprintf(outf, "\n%s latency histogram:\n%24s %11s\n",
+		name, "usecs", "calls");
+	for (unsigned int i = first; i <= last; ++i) {
+		const double low = lat_bucket_low(i * LAT_SUB) / 1000.0;
+		const double high = i + 1 < LAT_BUCKETS / LAT_SUB
+			? lat_bucket_low((i + 1) * LAT_SUB) / 1000.0 : low * 2;
+		const int width = peak ? (sizeof(bar) - 1) * rows[i] / peak : 0;
+
+		fprintf(outf, "%11.3f - %-10.3f %11u |%-*.*s|\n",
+			low, high, rows[i],
+			(int) sizeof(bar) - 1, width, bar);
+	}
 }
 
 static void
@@ -109,6 +690,12 @@ call_summary_pers(FILE *outf)
 	static const char header[]  = "%6.6s %11.11s %11.11s %9.9s %9.9s %s\n";
 	static const char data[]    = "%6.2f %11.6f %11lu %9u %9.u %s\n";
 	static const char summary[] = "%6.6s %11.6f %11.11s %9u %9.u %s\n";
+	static const char lat_header[] = "%6.6s %11.11s %11.11s %9.9s %9.9s"
+		" %9.9s %9.9s %9.9s %9.9s %9.9s %s\n";
+	static const char lat_data[] = "%6.2f %11.6f %11lu %9.3f %9.3f"
+		" %9.3f %9.3f %9.3f %9u %9.u %s\n";
+	static const char lat_summary[] = "%6.6s %11.6f %11.11s %9.3f %9.3f"
+		" %9.3f %9.3f %9.3f %9u %9.u %s\n";
 
 	unsigned int i;
 	unsigned int call_cum, error_cum;
@@ -116,11 +703,25 @@ call_summary_pers(FILE *outf)
 	double  float_tv_cum;
 	double  percent;
 	unsigned int *sorted_count;
+	struct latency_hist *hist_cum = NULL;
 
-	fprintf(outf, header,
-		"% time", "seconds", "usecs/call",
-		"calls", "errors", "syscall");
-	fprintf(outf, header, dashes, dashes, dashes, dashes, dashes, dashes);
+	if (count_latency) {
+		hist_cum = xcalloc(1, sizeof(*hist_cum));
+		hist_cum->min = UINT64_MAX;
+		fprintf(outf, lat_header,
+			"% time", "seconds", "usecs/call",
+			"min", "p50", "p90", "p99", "max",
+			"calls", "errors", "syscall");
+		fprintf(outf, lat_header, dashes, dashes, dashes,
+			dashes, dashes, dashes, dashes, dashes,
+			dashes, dashes, dashes);
+	} else {
+		fprintf(outf, header,
+			"% time", "seconds", "usecs/call",
+			"calls", "errors", "syscall");
+		fprintf(outf, header, dashes, dashes, dashes, dashes, dashes,
+			dashes);
+	}
 
 	sorted_count = xcalloc(sizeof(sorted_count[0]), nsyscalls);
 	call_cum = error_cum = tv_cum.tv_sec = tv_cum.tv_nsec = 0;
@@ -135,6 +736,15 @@ call_summary_pers(FILE *outf)
 		call_cum += counts[i].calls;
 		error_cum += counts[i].errors;
 		ts_add(&tv_cum, &tv_cum, &counts[i].time);
+
+		struct latency_hist *const h = counts[i].hist;
+		if (h && hist_cum) {
+			h->p99 = lat_percentile(h, counts[i].calls, 99);
+			hist_cum->min = MIN(hist_cum->min, h->min);
+			hist_cum->max = MAX(hist_cum->max, h->max);
+			for (unsigned int j = 0; j < LAT_BUCKETS; ++j)
+				hist_cum->buckets[j] += h->buckets[j];
+		}
 	}
 	float_tv_cum = ts_float(&tv_cum);
 	if (counts) {
@@ -153,18 +763,383 @@ call_summary_pers(FILE *outf)
 			if (percent != 0.0)
 				   percent /= float_tv_cum;
 			/* else: float_tv_cum can be 0.0 too and we get 0/0 = NAN */
+			if (cc->hist && hist_cum) {
+				const struct latency_hist *h = cc->hist;
+
+				fprintf(outf, lat_data,
+					percent, float_syscall_time,
+					(long) (1000000 * dtv.tv_sec
+						+ dtv.tv_nsec / 1000),
+					h->min / 1000.0,
+					lat_percentile(h, cc->calls, 50)
+						/ 1000.0,
+					lat_percentile(h, cc->calls, 90)
+						/ 1000.0,
+					h->p99 / 1000.0,
+					h->max / 1000.0,
+					cc->calls, cc->errors,
+					sysent[idx].sys_name);
+				continue;
+			}
 			fprintf(outf, data,
 				percent, float_syscall_time,
 				(long) (1000000 * dtv.tv_sec + dtv.tv_nsec / 1000),
 				cc->calls, cc->errors, sysent[idx].sys_name);
 		}
 	}
+
+	if (hist_cum) {
+		if (!call_cum)
+			hist_cum->min = 0;
+		fprintf(outf, lat_header, dashes, dashes, dashes,
+			dashes, dashes, dashes, dashes, dashes,
+			dashes, dashes, dashes);
+		fprintf(outf, lat_summary,
+			"100.00", float_tv_cum, "",
+			hist_cum->min / 1000.0,
+			lat_percentile(hist_cum, call_cum, 50) / 1000.0,
+			lat_percentile(hist_cum, call_cum, 90) / 1000.0,
+			lat_percentile(hist_cum, call_cum, 99) / 1000.0,
+			hist_cum->max / 1000.0,
+			call_cum, error_cum, "total");
+
+		for (i = 0; counts && i < nsyscalls; i++) {
+			const unsigned int idx = sorted_count[i];
+
+			if (counts[idx].calls && counts[idx].hist)
+				print_latency_hist(outf, sysent[idx].sys_name,
+						   counts[idx].hist);
+		}
+		free(hist_cum);
+	} else {
+		fprintf(outf, header, dashes, dashes, dashes, dashes, dashes,
+			dashes);
+		fprintf(outf, summary,
+			"100.00", float_tv_cum, "",
+			call_cum, error_cum, "total");
+	}
+
 	free(sorted_count);
+}
+
+void
+arm_summary_timer(void)
+{
+	if (!summary_interval)
+		return;
+
+	const struct itimerspec its = {
+		.it_value = { .tv_sec = summary_interval },
+		.it_interval = { .tv_sec = summary_interval },
+	};
+
+	if (timer_create(CLOCK_MONOTONIC, NULL, &summary_timer))
+		perror_msg_and_die("timer_create");
+	if (timer_settime(summary_timer, 0, &its, NULL))
+		perror_msg_and_die("timer_settime");
+
+	clock_gettime(CLOCK_MONOTONIC, &summary_last_ts);
+	summary_next_ts = summary_last_ts;
+	summary_next_ts.tv_sec += summary_interval;
+	summary_timer_is_armed = true;
+}
+
+bool
+is_summary_timer_armed(void)
+{
+	return summary_timer_is_armed;
+}
+
+/*
+ * Called from the SIGALRM handler, which is shared with the delay
+ * timer, so interval_summary checks the time itself.
+ */
+void
+summary_timer_expired(void)
+{
+	if (summary_timer_is_armed)
+		summary_timer_fired = 1;
+}
+
+/*
+ * Return the counts of the current personality made since the last
+ * interval summary and remember the current ones.
+ */
+static struct call_counts *
+make_delta_counts(void)
+{
+	if (!prev_countv[current_personality])
+		prev_countv[current_personality] =
+			xcalloc(nsyscalls, sizeof(*counts));
+
+	struct call_counts *const prev = prev_countv[current_personality];
+	struct call_counts *const delta = xcalloc(nsyscalls, sizeof(*delta));
+
+	for (unsigned int i = 0; i < nsyscalls; ++i) {
+		const struct call_counts *const cur = &counts[i];
+		struct call_counts *const p = &prev[i];
+		struct call_counts *const d = &delta[i];
+
+		if (cur->calls == p->calls)
+			continue;
+
+		d->calls = cur->calls - p->calls;
+		d->errors = cur->errors - p->errors;
+		ts_sub(&d->time, &cur->time, &p->time);
+
+		if (cur->hist) {
+			if (!p->hist)
+				p->hist = xcalloc(1, sizeof(*p->hist));
+			d->hist = xcalloc(1, sizeof(*d->hist));
+			d->hist->min = UINT64_MAX;
+
+			/* The extremes are known with the precision of buckets.  */
+			for (unsigned int j = 0; j < LAT_BUCKETS; ++j) {
+				const unsigned int n =
+					cur->hist->buckets[j] - p->hist->buckets[j];
+
+				if (!n)
+					continue;
+				d->hist->buckets[j] = n;
+				d->hist->min = MIN(d->hist->min,
+						   MAX(cur->hist->min,
+						       lat_bucket_low(j)));
+				d->hist->max = MAX(d->hist->max,
+						   MIN(cur->hist->max,
+						       lat_bucket_high(j)));
+			}
+			*p->hist = *cur->hist;
+		}
+
+		p->calls = cur->calls;
+		p->errors = cur->errors;
+		p->time = cur->time;
+	}
+
+	return delta;
+}
+
+static void
+free_counts(struct call_counts *const cv)
+{
+	for (unsigned int i = 0; i < nsyscalls; ++i)
+		free(cv[i].hist);
+	free(cv);
+}
+
+/* Print the counts of the current personality as a JSON object.  */
+static void
+print_json_counts(FILE *outf, const struct call_counts *const cv,
+		  const double elapsed)
+{
+	const char *sep = "";
+	struct timespec tv_cum = { 0 }, dtv;
+	unsigned int call_cum = 0, error_cum = 0;
+
+	fputs("\"syscalls\":[", outf);
+	for (unsigned int i = 0; i < nsyscalls; ++i) {
+		const struct call_counts *const cc = &cv[i];
+
+		if (!cc->calls)
+			continue;
+
+		ts_mul(&dtv, &overhead, cc->calls);
+		ts_sub(&dtv, &cc->time, &dtv);
+		if (dtv.tv_sec < 0 || dtv.tv_nsec < 0)
+			dtv.tv_sec = dtv.tv_nsec = 0;
+		ts_add(&tv_cum, &tv_cum, &dtv);
+		call_cum += cc->calls;
+		error_cum += cc->errors;
+
+		fprintf(outf, "%s{\"name\":\"%s\",\"calls\":%u,\"errors\":%u"
+			",\"seconds\":%.6f,\"rate\":%.3f",
+			sep, sysent[i].sys_name, cc->calls, cc->errors,
+			ts_float(&dtv), elapsed ? cc->calls / elapsed : 0.0);
+		if (cc->hist)
+			fprintf(outf, ",\"min_us\":%.3f,\"p50_us\":%.3f"
+				",\"p90_us\":%.3f,\"p99_us\":%.3f"
+				",\"max_us\":%.3f",
+				cc->hist->min / 1000.0,
+				lat_percentile(cc->hist, cc->calls, 50) / 1000.0,
+				lat_percentile(cc->hist, cc->calls, 90) / 1000.0,
+				lat_percentile(cc->hist, cc->calls, 99) / 1000.0,
+				cc->hist->max / 1000.0);
+		fputc('}', outf);
+		sep = ",";
+	}
+	fprintf(outf, "],\"total\":{\"calls\":%u,\"errors\":%u"
+		",\"seconds\":%.6f}", call_cum, error_cum, ts_float(&tv_cum));
+}
+
+void
+interval_summary(FILE *outf)
+{
+	if (!summary_timer_fired)
+		return;
+	summary_timer_fired = 0;
+
+	struct timespec ts_now, ts_elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_now);
+	if (ts_cmp(&ts_now, &summary_next_ts) < 0)
+		return;
+
+	ts_sub(&ts_elapsed, &ts_now, &summary_last_ts);
+	summary_last_ts = ts_now;
+	while (ts_cmp(&summary_next_ts, &ts_now) <= 0)
+		summary_next_ts.tv_sec += summary_interval;
+	++summary_seq;
+
+	const double elapsed = ts_float(&ts_elapsed);
+	const unsigned int old_pers = current_personality;
+	struct timespec ts_real;
+
+	clock_gettime(CLOCK_REALTIME, &ts_real);
+	if (summary_json)
+		fprintf(outf, "{\"interval\":%u,\"timestamp\":%lld.%06ld"
+			",\"elapsed\":%.6f,\"personalities\":[",
+			summary_seq, (long long) ts_real.tv_sec,
+			(long) ts_real.tv_nsec / 1000, elapsed);
+	else
+		fprintf(outf, "Interval %u, last %.3f seconds:\n",
+			summary_seq, elapsed);
+
+	const char *sep = "";
+
+	for (unsigned int i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
+		if (!countv[i])
+			continue;
+
+		if (current_personality != i)
+			set_personality(i);
+
+		struct call_counts *const delta = make_delta_counts();
+
+		if (summary_json) {
+			fprintf(outf, "%s{\"personality\":\"%s\",",
+				sep, personality_names[i]);
+			print_json_counts(outf, delta, elapsed);
+			fputc('}', outf);
+			sep = ",";
+		} else {
+			struct call_counts *const cur = countv[i];
+
+			if (i)
+				fprintf(outf,
+					"System call usage summary for %s mode:\n",
+					personality_names[i]);
+			countv[i] = delta;
+			call_summary_pers(outf);
+			countv[i] = cur;
+		}
+
+		free_counts(delta);
+	}
+
+	if (summary_json)
+		fputs("]}\n", outf);
+
+	if (old_pers != current_personality)
+		set_personality(old_pers);
+
+	fflush(outf);
+}
+
+static int
+group_cmp(const void *a, const void *b)
+{
+	const struct count_group *ga = *(const struct count_group **) a;
+	const struct count_group *gb = *(const struct count_group **) b;
+
+	const int rc = sortfun == count_cmp ? 0 : ts_cmp(&ga->time, &gb->time);
+
+	if (rc)
+		return -rc;
+	return (ga->calls < gb->calls) ? 1 : (ga->calls > gb->calls) ? -1 : 0;
+}
+
+/* Print the busiest groups of tracees, see --summary-by.  */
+static void
+group_summary(FILE *outf)
+{
+	static const char dashes[]  = "----------------";
+	static const char header[]  = "%6.6s %11.11s %9.9s %9.9s %-16.16s %s\n";
+	static const char data[]    = "%6.2f %11.6f %9u %9.u %-16s %s\n";
+	static const char summary[] = "%6.6s %11.6f %9u %9.u %s\n";
+
+	struct count_group **const sorted =
+		xcalloc(num_groups, sizeof(*sorted));
+	struct timespec tv_cum = { 0 }, dtv;
+	unsigned int call_cum = 0, error_cum = 0, n = 0;
+
+	for (unsigned int h = 0; h < GROUP_HASH_SIZE; ++h) {
+		for (struct count_group *g = group_hash[h]; g; g = g->next) {
+			g->time.tv_sec = g->time.tv_nsec = 0;
+			g->calls = g->errors = 0;
+			g->top = NULL;
+
+			for (unsigned int i = 0; i < g->size; ++i) {
+				struct group_call_counts *const c =
+					&g->tab[i];
+
+				if (!c->cc.calls)
+					continue;
+				ts_mul(&dtv, &overhead, c->cc.calls);
+				ts_sub(&dtv, &c->cc.time, &dtv);
+				if (dtv.tv_sec < 0 || dtv.tv_nsec < 0)
+					dtv.tv_sec = dtv.tv_nsec = 0;
+				ts_add(&g->time, &g->time, &dtv);
+				g->calls += c->cc.calls;
+				g->errors += c->cc.errors;
+				if (!g->top
+				    || ts_cmp(&c->cc.time, &g->top->cc.time) > 0)
+					g->top = c;
+			}
+
+			ts_add(&tv_cum, &tv_cum, &g->time);
+			call_cum += g->calls;
+			error_cum += g->errors;
+			sorted[n++] = g;
+		}
+	}
+
+	qsort(sorted, n, sizeof(*sorted), group_cmp);
+
+	const double float_tv_cum = ts_float(&tv_cum);
+	const char *const by = group_by_names[group_by];
+
+	if (n > group_top)
+		fprintf(outf, "System call usage by %s, top %u of %u:\n",
+			by, group_top, n);
+	else
+		fprintf(outf, "System call usage by %s:\n", by);
+	fprintf(outf, header, "% time", "seconds", "calls", "errors",
+		by, "top syscall");
+	fprintf(outf, header, dashes, dashes, dashes, dashes, dashes, dashes);
+
+	for (unsigned int i = 0; i < n && i < group_top; ++i) {
+		const struct count_group *const g = sorted[i];
+		const double float_time = ts_float(&g->time);
+		double percent = 100.0 * float_time;
+		char id[sizeof(int) * 3];
+		const char *name = "";
+
+		if (percent != 0.0)
+			percent /= float_tv_cum;
+		if (g->top)
+			name = sysent_vec[g->top->pers][g->top->scno].sys_name;
+		xsprintf(id, "%d", g->id);
+
+		fprintf(outf, data, percent, float_time, g->calls, g->errors,
+			group_by == GROUP_BY_COMM ? g->comm : id,
+			name ? name : "");
+	}
 
 	fprintf(outf, header, dashes, dashes, dashes, dashes, dashes, dashes);
-	fprintf(outf, summary,
-		"100.00", float_tv_cum, "",
-		call_cum, error_cum, "total");
+	fprintf(outf, summary, "100.00", float_tv_cum, call_cum, error_cum,
+		"total");
+
+	free(sorted);
 }
 
 void
@@ -187,4 +1162,14 @@ call_summary(FILE *outf)
 
 	if (old_pers != current_personality)
 		set_personality(old_pers);
+
+	if (group_by != GROUP_BY_NONE && num_groups)
+		group_summary(outf);
+
+	if (print_overhead)
+		fprintf(outf, "Tracing overhead: %.3f usecs per syscall"
+			" (%s)\n", ts_float(&overhead) * 1e6,
+			overhead_source == OVERHEAD_CALIBRATED ? "calibrated"
+			: overhead_source == OVERHEAD_OPTION ? "set by -O"
+			: "not calibrated");
 }
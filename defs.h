@@ -211,14 +211,15 @@ struct tcb {
 				     * scno.  Use tcp_sysent() macro for access.
 				     */
 	const struct_sysent *s_prev_ent; /* for "resuming interrupted SYSCALL" msg */
-	struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
+	struct tcb_cold *cold;	/* Allocated on the first use, see get_tcb_cold */
 	struct timespec stime;	/* System time usage as of last process wait */
 	struct timespec dtime;	/* Delta for system time usage */
 	struct timespec etime;	/* Syscall entry time */
-	struct timespec delay_expiration_time; /* When does the delay end */
 
 	struct mmap_cache_t *mmap_cache;
 
+	struct fdtab *fdtab;	/* Shadow descriptor table, see fdtab.c */
+
 	/*
 	 * Data that is stored during process wait traversal.
 	 * We use indices as the actual data is stored in an array
@@ -238,6 +239,23 @@ struct tcb {
 	void *unwind_ctx;
 	struct unwind_queue_t *unwind_queue;
 # endif
+
+	struct tcb *pid_hash_next; /* Next tcb in the pid index or free list */
+};
+
+/*
+ * State of a tcb that most tracees never need: their syscalls are not
+ * tampered with, their memory is read using process_vm_readv, and
+ * neither -c grouping nor binary output is used, so it is kept out
+ * of struct tcb.
+ */
+struct tcb_cold {
+	struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
+	struct timespec delay_expiration_time; /* When does the delay end */
+	unsigned int umove_method; /* How tracee memory is read, see ucopy.c */
+	int mem_fd;		/* /proc/PID/mem descriptor for umove_method */
+	struct count_group *count_group; /* Group of -c counts, see count.c */
+	struct bintrace_blobs *bintrace_blobs; /* See bintrace.c */
 };
 
 /* TCB flags */
@@ -423,6 +441,9 @@ extern struct path_set {
 	const char **paths_selected;
 	size_t num_selected;
 	size_t size;
+	const char **hash;		/* hash table of the selected paths */
+	size_t hash_size;
+	struct path_trie *trie;		/* selected directory trees */
 } global_path_set;
 # define tracing_paths (global_path_set.num_selected != 0)
 extern unsigned xflag;
@@ -430,8 +451,13 @@ extern unsigned followfork;
 # ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 extern bool stack_trace_enabled;
+/* if this is true walk the frame pointer chains for the stack traces */
+extern bool stack_trace_frame_pointers;
+/* if this is true aggregate the stack traces instead of printing them */
+extern bool stack_profile_enabled;
 # else
 #  define stack_trace_enabled 0
+#  define stack_profile_enabled 0
 # endif
 extern unsigned ptrace_setoptions;
 extern unsigned max_strlen;
@@ -440,12 +466,27 @@ extern unsigned os_release;
 # define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
 
 extern int read_int_from_file(struct tcb *, const char *, int *);
+extern bool read_thread_group(int pid, int *tgid, unsigned int *threads);
 
 extern void set_sortby(const char *);
 extern void set_overhead(int);
+extern void set_overhead_auto(void);
+extern void set_print_overhead(void);
+extern void calibrate_overhead(void);
+extern void set_count_latency(void);
+extern void set_count_group(const char *);
+extern void set_count_group_top(unsigned int);
+extern void set_summary_interval(unsigned int);
+extern void set_summary_format(const char *);
+extern void arm_summary_timer(void);
+extern bool is_summary_timer_armed(void);
+extern void summary_timer_expired(void);
+extern void interval_summary(FILE *);
 
 extern bool get_instruction_pointer(struct tcb *, kernel_ulong_t *);
 extern bool get_stack_pointer(struct tcb *, kernel_ulong_t *);
+/* Fetch the frame pointer register, if the architecture has one.  */
+extern bool get_frame_pointer(struct tcb *, kernel_ulong_t *);
 extern void print_instruction_pointer(struct tcb *);
 
 extern void print_syscall_resume(struct tcb *tcp);
@@ -456,6 +497,7 @@ extern void syscall_entering_finish(struct tcb *, int);
 
 extern int syscall_exiting_decode(struct tcb *, struct timespec *);
 extern int syscall_exiting_trace(struct tcb *, struct timespec *, int);
+extern void print_syscall_exit(struct tcb *, int, struct timespec *);
 extern void syscall_exiting_finish(struct tcb *);
 
 extern void count_syscall(struct tcb *, const struct timespec *);
@@ -502,6 +544,8 @@ extern void *get_tcb_priv_data(const struct tcb *);
 extern int set_tcb_priv_data(struct tcb *, void *priv_data,
 			     void (*free_priv_data)(void *));
 extern void free_tcb_priv_data(struct tcb *);
+/* Return the cold part of the tcb, allocating it if necessary.  */
+extern struct tcb_cold *get_tcb_cold(struct tcb *);
 
 static inline unsigned long get_tcb_priv_ulong(const struct tcb *tcp)
 {
@@ -518,6 +562,44 @@ static inline int set_tcb_priv_ulong(struct tcb *tcp, unsigned long val)
  */
 extern int
 umoven(struct tcb *, kernel_ulong_t addr, unsigned int len, void *laddr);
+
+/* A request to copy `len' bytes at tracee address `addr' to `laddr'.  */
+struct umove_req {
+	kernel_ulong_t addr;
+	unsigned int len;
+	void *laddr;
+	int rc;		/* Set by umoven_batch to the umoven return value */
+};
+
+/**
+ * Perform umoven for every request using as few syscalls as possible.
+ *
+ * @return 0 if all requests succeeded, -1 otherwise.
+ */
+extern int
+umoven_batch(struct tcb *, struct umove_req *, unsigned int n);
+/**
+ * Copy up to `n' pages of tracee memory at page aligned address `addr',
+ * stopping at the first page that cannot be read.
+ *
+ * @return the number of pages copied.
+ */
+extern unsigned int
+umove_pages(struct tcb *, kernel_ulong_t addr, unsigned int n, void *laddr);
+/*
+ * Read tracee memory described by the requests into the cache used
+ * by umoven and umovestr, `laddr' of the requests is not used.
+ */
+extern void
+umove_prefetch(struct tcb *, const struct umove_req *, unsigned int n);
+/* Forget tracee memory cached by umoven and umovestr.  */
+extern void invalidate_umove_cache(void);
+extern void print_umove_cache_stats(void);
+/*
+ * Forget the method of reading memory chosen for the tracee,
+ * e.g. after execve, and close its /proc/PID/mem descriptor.
+ */
+extern void reset_umove_method(struct tcb *);
 # define umove(pid, addr, objp)	\
 	umoven((pid), (addr), sizeof(*(objp)), (void *) (objp))
 
@@ -619,10 +701,13 @@ pathtrace_match(struct tcb *tcp)
 }
 
 extern int getfdpath(struct tcb *, int, char *, unsigned);
+extern kernel_ulong_t get_clone_flags(struct tcb *);
 extern unsigned long getfdinode(struct tcb *, int);
 extern enum sock_proto getfdproto(struct tcb *, int);
 
 extern const char *xlookup(const struct xlat *, const uint64_t);
+/* Tell xlookup that the contents of the table may change.  */
+extern void mark_xlat_dynamic(const struct xlat *);
 extern const char *xlat_search(const struct xlat *, const size_t, const uint64_t);
 extern const char *xlat_idx(const struct xlat *xlat, size_t nmemb, uint64_t val);
 
@@ -802,6 +887,13 @@ extern int printflags_ex(uint64_t flags, const char *dflt,
 	ATTRIBUTE_SENTINEL;
 extern const char *sprintflags_ex(const char *prefix, const struct xlat *,
 				  uint64_t flags, enum xlat_style);
+/*
+ * The same as sprintflags_ex, but prints into the given buffer
+ * and returns either buf or NULL.
+ */
+extern const char *sprintflags_buf(char *buf, size_t size, const char *prefix,
+				   const struct xlat *, uint64_t flags,
+				   enum xlat_style);
 
 static inline const char *
 sprintflags(const char *prefix, const struct xlat *xlat, uint64_t flags)
@@ -908,6 +1000,8 @@ extern void print_ax25_addr(const void /* ax25_address */ *addr);
 extern void print_x25_addr(const void /* struct x25_address */ *addr);
 extern const char *get_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
 extern bool print_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
+extern void invalidate_sockaddr_by_inode(unsigned long inode);
+extern void print_sockaddr_stats(void);
 extern void print_dirfd(struct tcb *, int);
 
 extern int
@@ -1031,6 +1125,11 @@ extern void unwind_tcb_init(struct tcb *);
 extern void unwind_tcb_fin(struct tcb *);
 extern void unwind_tcb_print(struct tcb *);
 extern void unwind_tcb_capture(struct tcb *);
+extern void unwind_print_deferred(void);
+extern void unwind_tcb_profile(struct tcb *, const struct timespec *);
+extern void set_stack_profile(const char *);
+extern void print_stack_profile(FILE *);
+extern void print_unwind_stats(void);
 # endif
 
 # ifdef HAVE_LINUX_KVM_H
@@ -1155,7 +1254,16 @@ extern void print_user_desc(struct tcb *, kernel_ulong_t addr,
  */
 extern struct tcb *printing_tcp;
 extern void printleader(struct tcb *);
+/* Print the leader of a line replayed from a binary trace.  */
+extern void printleader_replay(struct tcb *, const struct timespec *, bool pid_prefix);
 extern void line_ended(void);
+/* Direct the output of tprintf and friends to the given tcb.  */
+extern void set_current_tcp(const struct tcb *);
+/*
+ * Flush the output of the given tcb, or defer the flush until the tracer
+ * is about to wait for the next event if the output goes to regular files.
+ */
+extern void flush_tcp_output(struct tcb *);
 extern void tabto(void);
 extern void tprintf(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
 extern void tprints(const char *str);
@@ -83,7 +83,7 @@ void
 arm_delay_timer(const struct tcb *const tcp)
 {
 	const struct itimerspec its = {
-		.it_value = tcp->delay_expiration_time
+		.it_value = tcp->cold->delay_expiration_time
 	};
 
 	if (timer_settime(delay_timer, TIMER_ABSTIME, &its, NULL))
@@ -92,8 +92,8 @@ arm_delay_timer(const struct tcb *const tcp)
 	delay_timer_is_armed = true;
 
 	debug_func_msg("timer set to %lld.%09ld for pid %d",
-		       (long long) tcp->delay_expiration_time.tv_sec,
-		       (long) tcp->delay_expiration_time.tv_nsec,
+		       (long long) tcp->cold->delay_expiration_time.tv_sec,
+		       (long) tcp->cold->delay_expiration_time.tv_nsec,
 		       tcp->pid);
 }
 
@@ -115,7 +115,7 @@ delay_tcb(struct tcb *tcp, uint16_t delay_idx, bool isenter)
 
 	struct timespec ts_now;
 	clock_gettime(CLOCK_MONOTONIC, &ts_now);
-	ts_add(&tcp->delay_expiration_time, &ts_now, ts_diff);
+	ts_add(&tcp->cold->delay_expiration_time, &ts_now, ts_diff);
 
 	if (is_delay_timer_created()) {
 		struct itimerspec its;
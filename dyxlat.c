@@ -27,6 +27,7 @@ dyxlat_alloc(const size_t nmemb)
 	dyxlat->allocated = nmemb;
 	dyxlat->xlat = xgrowarray(NULL, &dyxlat->allocated, sizeof(struct xlat));
 	MARK_END(dyxlat->xlat[0]);
+	mark_xlat_dynamic(dyxlat->xlat);
 
 	return dyxlat;
 }
@@ -70,9 +71,11 @@ dyxlat_add_pair(struct dyxlat *const dyxlat, const uint64_t val,
 		}
 	}
 
-	if (dyxlat->used >= dyxlat->allocated)
+	if (dyxlat->used >= dyxlat->allocated) {
 		dyxlat->xlat = xgrowarray(dyxlat->xlat, &dyxlat->allocated,
 					  sizeof(struct xlat));
+		mark_xlat_dynamic(dyxlat->xlat);
+	}
 
 	dyxlat->xlat[dyxlat->used - 1].val = val;
 	dyxlat->xlat[dyxlat->used - 1].str = xstrndup(str, len);
@@ -50,9 +50,9 @@ verror_msg(int err_no, const char *fmt, va_list p)
 		else
 			putc('\n', stderr);
 	}
-	/* We don't switch stderr to buffered, thus fprintf(stderr)
-	 * always flushes its output and this is not necessary: */
-	/* fflush(stderr); */
+	/* stderr may have been switched to buffered by --output-flush,
+	 * write the message out right away anyway. */
+	fflush(stderr);
 }
 
 void
@@ -0,0 +1,462 @@
+/*
+ * Shadow tables of file descriptors of traced processes.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <sched.h>
+#include "bintrace.h"
+#include "fdtab.h"
+#include "syscall.h"
+#include "xstring.h"
+
+#define XLAT_MACROS_ONLY
+#include "xlat/close_range_flags.h"
+#undef XLAT_MACROS_ONLY
+
+/*
+ * All threads of a process share the descriptor table, so the paths
+ * of the descriptors are cached per thread group.  A descriptor number
+ * cannot be reused without being closed first, so it is enough to see
+ * close, close_range, dup2, dup3, and execve of every thread to keep
+ * the table exact.  A syscall unknown to strace may close descriptors
+ * too, so the table is dropped on every one.
+ */
+struct fdtab {
+	struct fdtab *next;
+	int tgid;
+	unsigned int refcnt;
+	size_t size;
+	struct fd_info *fds;
+};
+
+/* Descriptors above this are not cached.  */
+#define FDTAB_MAX_FD	(1 << 20)
+
+/* Tables of all thread groups.  */
+static struct fdtab *fdtabs;
+
+/* The table of the tcbs whose descriptors cannot be cached.  */
+static struct fdtab fdtab_none;
+
+/*
+ * Set when descriptor tables are shared in a way the traced processes
+ * do not show, e.g. by processes created with CLONE_FILES.
+ */
+static bool fdtab_disabled;
+
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+} fdtab_stats;
+
+/*
+ * The paths of descriptors of a rendered binary trace are read
+ * from the trace, see bintrace.c.
+ */
+static bool
+fdtab_enabled(void)
+{
+	return (show_fd_path || tracing_paths) && !fdtab_disabled
+	       && !bintrace_replaying;
+}
+
+/*
+ * Read the thread group id and the number of threads of pid
+ * from /proc/PID/status.
+ */
+bool
+read_thread_group(const int pid, int *const tgid, unsigned int *const threads)
+{
+	char path[sizeof("/proc/%u/status") + sizeof(int) * 3];
+	char buf[4096];
+
+	xsprintf(path, "/proc/%u/status", pid);
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	const ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+	buf[n] = '\0';
+
+	const char *p = strstr(buf, "\nTgid:");
+	if (!p || sscanf(p, "\nTgid:%d", tgid) != 1)
+		return false;
+
+	p = strstr(p, "\nThreads:");
+	if (!p || sscanf(p, "\nThreads:%u", threads) != 1)
+		*threads = 0;
+
+	return true;
+}
+
+static struct fdtab *
+get_fdtab(struct tcb *const tcp)
+{
+	if (tcp->fdtab)
+		return tcp->fdtab == &fdtab_none ? NULL : tcp->fdtab;
+
+	int tgid;
+	unsigned int threads;
+
+	/*
+	 * Without -f, the other threads of the process are not traced
+	 * and their syscalls are not seen.
+	 */
+	if (!read_thread_group(tcp->pid, &tgid, &threads)
+	    || (!followfork && threads != 1)) {
+		tcp->fdtab = &fdtab_none;
+		return NULL;
+	}
+
+	struct fdtab *t;
+
+	for (t = fdtabs; t; t = t->next) {
+		if (t->tgid == tgid)
+			break;
+	}
+
+	if (!t) {
+		t = xcalloc(1, sizeof(*t));
+		t->tgid = tgid;
+		t->next = fdtabs;
+		fdtabs = t;
+		debug_msg("new descriptor table for tgid %d", tgid);
+	}
+
+	++t->refcnt;
+	tcp->fdtab = t;
+
+	return t;
+}
+
+static void
+clear_fd_info(struct fd_info *const info)
+{
+	free(info->path);
+	memset(info, 0, sizeof(*info));
+}
+
+static void
+clear_fdtab(struct fdtab *const t)
+{
+	for (size_t i = 0; i < t->size; ++i)
+		clear_fd_info(&t->fds[i]);
+}
+
+struct fd_info *
+get_fd_info(struct tcb *const tcp, const int fd)
+{
+	if (fd < 0 || fd >= FDTAB_MAX_FD || !fdtab_enabled())
+		return NULL;
+
+	struct fdtab *const t = get_fdtab(tcp);
+
+	if (!t)
+		return NULL;
+
+	if ((size_t) fd >= t->size) {
+		const size_t size = MAX((size_t) fd + 1, t->size * 2);
+
+		t->fds = xreallocarray(t->fds, size, sizeof(*t->fds));
+		memset(t->fds + t->size, 0,
+		       (size - t->size) * sizeof(*t->fds));
+		t->size = size;
+	}
+
+	return &t->fds[fd];
+}
+
+void
+invalidate_fd_info(struct tcb *const tcp, const int fd)
+{
+	if (fd < 0 || !fdtab_enabled())
+		return;
+
+	struct fdtab *const t = get_fdtab(tcp);
+
+	if (t && (size_t) fd < t->size)
+		clear_fd_info(&t->fds[fd]);
+}
+
+/*
+ * A duplicate refers to the same open file as the original descriptor,
+ * so what is known about the original one holds for the duplicate.
+ * This is called for descriptors printed as the return value only,
+ * and the fcntl decoder returns RVAL_FD for F_DUPFD and F_DUPFD_CLOEXEC
+ * commands only.
+ */
+static int
+get_dup_source(struct tcb *const tcp)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_dup:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_fcntl:
+	case SEN_fcntl64:
+		return tcp->u_arg[0];
+	}
+
+	return -1;
+}
+
+void
+init_fd_info(struct tcb *const tcp, const int fd)
+{
+	invalidate_fd_info(tcp, fd);
+
+	const int oldfd = get_dup_source(tcp);
+
+	if (oldfd < 0 || oldfd == fd)
+		return;
+
+	/* The table may grow, so the new entry is looked up first.  */
+	struct fd_info *const info = get_fd_info(tcp, fd);
+
+	if (!info || (size_t) oldfd >= tcp->fdtab->size)
+		return;
+
+	const struct fd_info *const old = &tcp->fdtab->fds[oldfd];
+
+	if (!old->path)
+		return;
+
+	*info = *old;
+	info->path = xstrdup(old->path);
+}
+
+void
+invalidate_fdtab(struct tcb *const tcp)
+{
+	if (!fdtab_enabled())
+		return;
+
+	struct fdtab *const t = get_fdtab(tcp);
+
+	if (t)
+		clear_fdtab(t);
+}
+
+void
+release_fdtab(struct tcb *const tcp)
+{
+	struct fdtab *const t = tcp->fdtab;
+
+	tcp->fdtab = NULL;
+
+	if (!t || t == &fdtab_none || --t->refcnt)
+		return;
+
+	for (struct fdtab **p = &fdtabs; *p; p = &(*p)->next) {
+		if (*p == t) {
+			*p = t->next;
+			break;
+		}
+	}
+
+	clear_fdtab(t);
+	free(t->fds);
+	free(t);
+}
+
+/*
+ * Forget the details of the socket referred to by descriptor fd,
+ * if its path is known.
+ */
+static void
+invalidate_fd_socket(struct tcb *const tcp, const int fd)
+{
+	if (show_fd_path <= 1 || fd < 0)
+		return;
+
+	struct fdtab *const t = get_fdtab(tcp);
+
+	if (!t || (size_t) fd >= t->size || !t->fds[fd].path)
+		return;
+
+	const char *const path = t->fds[fd].path;
+	const char *const str = STR_STRIP_PREFIX(path, "socket:[");
+
+	if (str != path)
+		invalidate_sockaddr_by_inode(strtoul(str, NULL, 10));
+}
+
+/* Forget what is known about all descriptors of all processes.  */
+static void
+invalidate_all_fdtabs(void)
+{
+	for (struct fdtab *t = fdtabs; t; t = t->next)
+		clear_fdtab(t);
+}
+
+static void
+disable_fdtab(const char *const reason)
+{
+	if (fdtab_disabled)
+		return;
+
+	debug_msg("descriptor tables are disabled: %s", reason);
+	fdtab_disabled = true;
+
+	invalidate_all_fdtabs();
+}
+
+/* Forget descriptors from first to last, both included.  */
+static void
+invalidate_fd_range(struct tcb *const tcp, const unsigned int first,
+		    const unsigned int last)
+{
+	struct fdtab *const t = get_fdtab(tcp);
+
+	if (!t)
+		return;
+
+	for (size_t fd = first; fd <= last && fd < t->size; ++fd)
+		clear_fd_info(&t->fds[fd]);
+}
+
+void
+fdtab_syscall(struct tcb *const tcp)
+{
+	if (!fdtab_enabled())
+		return;
+
+	if (tcp_sysent(tcp)->sys_flags & UNKNOWN_SYSCALL) {
+		invalidate_fdtab(tcp);
+		return;
+	}
+
+	switch (tcp_sysent(tcp)->sen) {
+	/*
+	 * The descriptor is closed while the syscall is in progress,
+	 * so forget it both on entering and exiting.  The details of
+	 * the socket are kept until the close call has been printed.
+	 */
+	case SEN_close:
+		if (exiting(tcp))
+			invalidate_fd_socket(tcp, tcp->u_arg[0]);
+		invalidate_fd_info(tcp, tcp->u_arg[0]);
+		break;
+
+	case SEN_shutdown:
+		if (exiting(tcp))
+			invalidate_fd_socket(tcp, tcp->u_arg[0]);
+		break;
+
+	case SEN_dup2:
+	case SEN_dup3:
+		invalidate_fd_info(tcp, tcp->u_arg[1]);
+		break;
+
+	case SEN_close_range:
+		if (entering(tcp) && (tcp->u_arg[2] & CLOSE_RANGE_UNSHARE))
+			disable_fdtab("descriptor table is unshared");
+		else if (!(tcp->u_arg[2] & CLOSE_RANGE_CLOEXEC))
+			invalidate_fd_range(tcp, tcp->u_arg[0], tcp->u_arg[1]);
+		break;
+
+	case SEN_clone:
+	case SEN_clone3:
+		if (entering(tcp)) {
+			const kernel_ulong_t flags = get_clone_flags(tcp);
+
+			if (!(flags & CLONE_FILES) != !(flags & CLONE_THREAD))
+				disable_fdtab("descriptor table is shared"
+					      " between processes");
+			else if ((flags & CLONE_FILES) && !followfork)
+				disable_fdtab("threads are not followed");
+		}
+		break;
+
+	case SEN_unshare:
+		if (entering(tcp)) {
+			if (tcp->u_arg[0] & CLONE_FILES)
+				disable_fdtab("descriptor table is unshared");
+		} else if (tcp->u_arg[0] & CLONE_NEWNS) {
+			invalidate_fdtab(tcp);
+		}
+		break;
+
+	/*
+	 * These may change the paths of the files opened
+	 * by any process, not just the calling one.
+	 */
+	case SEN_chroot:
+	case SEN_mount:
+	case SEN_pivotroot:
+	case SEN_rename:
+	case SEN_renameat:
+	case SEN_renameat2:
+	case SEN_rmdir:
+	case SEN_setns:
+	case SEN_umount:
+	case SEN_umount2:
+	case SEN_unlink:
+	case SEN_unlinkat:
+		if (exiting(tcp))
+			invalidate_all_fdtabs();
+		break;
+	}
+}
+
+bool
+fdtab_needs_syscall(const struct_sysent *const s)
+{
+	if (!fdtab_enabled())
+		return false;
+
+	if (s->sys_flags & UNKNOWN_SYSCALL)
+		return true;
+
+	switch (s->sen) {
+	case SEN_chroot:
+	case SEN_clone:
+	case SEN_clone3:
+	case SEN_close:
+	case SEN_close_range:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_mount:
+	case SEN_pivotroot:
+	case SEN_rename:
+	case SEN_renameat:
+	case SEN_renameat2:
+	case SEN_rmdir:
+	case SEN_setns:
+	case SEN_shutdown:
+	case SEN_umount:
+	case SEN_umount2:
+	case SEN_unlink:
+	case SEN_unlinkat:
+	case SEN_unshare:
+		return true;
+	}
+
+	return false;
+}
+
+void
+count_fd_info(const bool hit)
+{
+	if (hit)
+		++fdtab_stats.hits;
+	else
+		++fdtab_stats.misses;
+}
+
+void
+print_fdtab_stats(void)
+{
+	debug_msg("descriptor tables: %lu hits, %lu /proc lookups",
+		  fdtab_stats.hits, fdtab_stats.misses);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_FDTAB_H
+# define STRACE_FDTAB_H
+
+/*
+ * What is known about a file descriptor of a traced process.
+ * The fields are filled on demand from /proc/PID/fd, or copied from
+ * the original descriptor by dup, and are valid until the descriptor
+ * is closed.
+ */
+struct fd_info {
+	char *path;		/* /proc/PID/fd/FD link, NULL if unknown */
+	int path_len;
+	bool dev_checked;	/* dev_mode and dev_rdev are valid */
+	bool proto_checked;	/* proto is valid */
+	bool match_checked;	/* match is valid */
+	bool match;		/* path is selected by -P */
+	unsigned int dev_mode;	/* S_IFBLK, S_IFCHR, or 0 for other files */
+	unsigned long long dev_rdev;
+	enum sock_proto proto;
+};
+
+/*
+ * Return the cached information about descriptor fd of tcp,
+ * NULL if it cannot be cached.
+ */
+extern struct fd_info *get_fd_info(struct tcb *, int fd);
+
+/* Forget what is known about descriptor fd of tcp.  */
+extern void invalidate_fd_info(struct tcb *, int fd);
+
+/*
+ * Forget what is known about descriptor fd returned by the current syscall
+ * of tcp, or copy it from the original descriptor if fd is its duplicate.
+ */
+extern void init_fd_info(struct tcb *, int fd);
+
+/* Forget what is known about all descriptors of tcp.  */
+extern void invalidate_fdtab(struct tcb *);
+
+/* Detach tcp from its descriptor table.  */
+extern void release_fdtab(struct tcb *);
+
+/* Update the descriptor table on entering or exiting a syscall.  */
+extern void fdtab_syscall(struct tcb *);
+
+/* Whether the descriptor table has to see syscall s.  */
+extern bool fdtab_needs_syscall(const struct_sysent *s);
+
+extern void count_fd_info(bool hit);
+extern void print_fdtab_stats(void);
+
+#endif /* !STRACE_FDTAB_H */
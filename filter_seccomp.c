@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include "ptrace.h"
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#ifdef HAVE_LINUX_SECCOMP_H
+# include <linux/seccomp.h>
+#endif
+
+#include "fdtab.h"
+#include "filter_seccomp.h"
+#include "mmap_notify.h"
+#include "syscall.h"
+
+#ifndef PR_SET_NO_NEW_PRIVS
+# define PR_SET_NO_NEW_PRIVS 38
+#endif
+#ifndef SECCOMP_MODE_FILTER
+# define SECCOMP_MODE_FILTER 2
+#endif
+#ifndef SECCOMP_RET_TRACE
+# define SECCOMP_RET_TRACE 0x7ff00000U
+#endif
+#ifndef SECCOMP_RET_ALLOW
+# define SECCOMP_RET_ALLOW 0x7fff0000U
+#endif
+#ifndef BPF_MAXINSNS
+# define BPF_MAXINSNS 4096
+#endif
+
+/* Offsets of struct seccomp_data fields, they are part of the ABI.  */
+#define SECCOMP_DATA_NR_OFFSET		0
+#define SECCOMP_DATA_ARCH_OFFSET	4
+
+/* Set by --seccomp-bpf, cleared by check_seccomp_filter if unusable.  */
+bool seccomp_filtering;
+/* Whether PTRACE_EVENT_SECCOMP stop precedes the syscall-entry-stop.  */
+bool seccomp_before_sysentry;
+
+/*
+ * The audit architecture of every supported personality, and the bit
+ * that distinguishes personalities sharing the same audit architecture
+ * (e.g. x32 and x86_64).  Architectures that do not define
+ * PERSONALITY*_AUDIT_ARCH in their arch_defs_.h cannot use the filter.
+ */
+#if defined PERSONALITY0_AUDIT_ARCH \
+ && (SUPPORTED_PERSONALITIES < 2 || defined PERSONALITY1_AUDIT_ARCH) \
+ && (SUPPORTED_PERSONALITIES < 3 || defined PERSONALITY2_AUDIT_ARCH)
+# define HAVE_SECCOMP_AUDIT_ARCH 1
+
+struct audit_arch_t {
+	unsigned int arch;
+	unsigned int flag;
+};
+
+static const struct audit_arch_t audit_arch_vec[SUPPORTED_PERSONALITIES] = {
+	PERSONALITY0_AUDIT_ARCH,
+# if SUPPORTED_PERSONALITIES > 1
+	PERSONALITY1_AUDIT_ARCH,
+# endif
+# if SUPPORTED_PERSONALITIES > 2
+	PERSONALITY2_AUDIT_ARCH,
+# endif
+};
+#endif /* PERSONALITY0_AUDIT_ARCH */
+
+static struct sock_filter *filter;
+static size_t filter_size;
+static size_t filter_len;
+
+static size_t
+add_insn(const uint16_t code, const uint8_t jt, const uint8_t jf,
+	 const uint32_t k)
+{
+	if (filter_len >= filter_size)
+		filter = xgrowarray(filter, &filter_size, sizeof(*filter));
+
+	filter[filter_len] = (struct sock_filter) BPF_JUMP(code, k, jt, jf);
+	return filter_len++;
+}
+
+static void
+add_stmt(const uint16_t code, const uint32_t k)
+{
+	add_insn(code, 0, 0, k);
+}
+
+#ifdef HAVE_SECCOMP_AUDIT_ARCH
+/*
+ * Syscalls that have to be stopped at regardless of the trace set:
+ * exec* syscalls are needed to make the log visible and to handle
+ * PTRACE_EVENT_EXEC properly, multiplexers are decoded into subcalls
+ * only after the stop, memory mapping changes have to be seen
+ * by the mmap cache, and descriptor changes by the descriptor tables.
+ */
+static bool
+is_always_stopped(const struct_sysent *const s)
+{
+	switch (s->sen) {
+	case SEN_execv:
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_ipc:
+	case SEN_socketcall:
+	case SEN_syscall:
+		return true;
+	}
+
+	return mmap_notify_needs_syscall(s) || fdtab_needs_syscall(s);
+}
+
+static bool
+is_allowed(const unsigned int scno)
+{
+	return scno_is_valid(scno)
+	       && !(qual_flags(scno) & QUAL_TRACE)
+	       && !is_always_stopped(&sysent[scno]);
+}
+
+static void
+add_allow_range(const kernel_ulong_t lo, const kernel_ulong_t hi)
+{
+	if (lo == hi) {
+		add_insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, lo);
+	} else {
+		add_insn(BPF_JMP | BPF_JGE | BPF_K, 0, 2, lo);
+		add_insn(BPF_JMP | BPF_JGT | BPF_K, 1, 0, hi);
+	}
+	add_stmt(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+}
+
+/*
+ * Generate a block of instructions that returns SECCOMP_RET_ALLOW
+ * for every allowed syscall of the given personality,
+ * SECCOMP_RET_TRACE for the rest of its syscalls,
+ * and falls through to the next block for syscalls
+ * of other personalities.
+ */
+static void
+add_personality_filter(const unsigned int pers)
+{
+	const struct audit_arch_t *const aa = &audit_arch_vec[pers];
+	size_t skip[3];
+	unsigned int nskip = 0;
+	unsigned int mask = 0;
+
+	for (unsigned int i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
+		if (i != pers && audit_arch_vec[i].arch == aa->arch)
+			mask |= audit_arch_vec[i].flag;
+	}
+
+	/* if (data->arch != aa->arch) goto next; */
+	add_stmt(BPF_LD | BPF_W | BPF_ABS, SECCOMP_DATA_ARCH_OFFSET);
+	add_insn(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, aa->arch);
+	skip[nskip++] = add_insn(BPF_JMP | BPF_JA, 0, 0, 0);
+
+	add_stmt(BPF_LD | BPF_W | BPF_ABS, SECCOMP_DATA_NR_OFFSET);
+	/* if (data->nr & mask) goto next; */
+	if (mask) {
+		add_insn(BPF_JMP | BPF_JSET | BPF_K, 0, 1, mask);
+		skip[nskip++] = add_insn(BPF_JMP | BPF_JA, 0, 0, 0);
+	}
+	/* if (!(data->nr & aa->flag)) goto next; */
+	if (aa->flag) {
+		add_insn(BPF_JMP | BPF_JSET | BPF_K, 1, 0, aa->flag);
+		skip[nskip++] = add_insn(BPF_JMP | BPF_JA, 0, 0, 0);
+	}
+
+	set_personality(pers);
+
+	kernel_ulong_t lo = 0, hi = 0;
+	bool in_range = false;
+
+	for (unsigned int i = 0; i < nsyscalls; ++i) {
+		if (!is_allowed(i))
+			continue;
+
+		/*
+		 * Raw numbers of syscalls of a personality with a flag,
+		 * e.g. x32, have the flag set.
+		 */
+		const kernel_ulong_t nr = shuffle_scno(i) | aa->flag;
+
+		if (in_range && nr == hi + 1) {
+			hi = nr;
+			continue;
+		}
+		if (in_range)
+			add_allow_range(lo, hi);
+		lo = hi = nr;
+		in_range = true;
+	}
+	if (in_range)
+		add_allow_range(lo, hi);
+
+	add_stmt(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+
+	for (unsigned int i = 0; i < nskip; ++i)
+		filter[skip[i]].k = filter_len - skip[i] - 1;
+}
+#endif /* HAVE_SECCOMP_AUDIT_ARCH */
+
+static bool
+init_seccomp_filter_program(void)
+{
+#ifdef HAVE_SECCOMP_AUDIT_ARCH
+	const unsigned int saved_pers = current_personality;
+
+	for (unsigned int pers = 0; pers < SUPPORTED_PERSONALITIES; ++pers)
+		add_personality_filter(pers);
+
+	set_personality(saved_pers);
+
+	/* Unknown architecture.  */
+	add_stmt(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+
+	if (filter_len > BPF_MAXINSNS) {
+		debug_msg("seccomp filter is too long: %zu instructions",
+			  filter_len);
+		return false;
+	}
+
+	debug_msg("seccomp filter: %zu instructions", filter_len);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Check in a short-lived child that the kernel lets us install
+ * a seccomp filter after PR_SET_NO_NEW_PRIVS.
+ */
+static bool
+check_seccomp_filter_properties(void)
+{
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror_msg("fork");
+		return false;
+	}
+
+	if (pid == 0) {
+		struct sock_filter allow =
+			BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+		struct sock_fprog prog = {
+			.len = 1,
+			.filter = &allow
+		};
+
+		if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0
+		    || prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
+			_exit(1);
+		_exit(0);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			perror_msg("waitpid");
+			return false;
+		}
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void
+check_seccomp_filter(void)
+{
+	if (!seccomp_filtering)
+		return;
+
+	if (os_release < KERNEL_VERSION(3, 5, 0)
+	    || !init_seccomp_filter_program()
+	    || !check_seccomp_filter_properties())
+		seccomp_filtering = false;
+
+	if (seccomp_filtering) {
+		seccomp_before_sysentry = os_release < KERNEL_VERSION(4, 8, 0);
+		debug_msg("seccomp filter enabled, PTRACE_EVENT_SECCOMP stop "
+			  "comes %s syscall-entry-stop",
+			  seccomp_before_sysentry ? "before" : "instead of");
+	} else {
+		error_msg("seccomp filter is requested but unavailable");
+		free(filter);
+		filter = NULL;
+		filter_len = filter_size = 0;
+	}
+}
+
+/* Called by the tracee right before execve.  */
+void
+init_seccomp_filter(void)
+{
+	struct sock_fprog prog = {
+		.len = filter_len,
+		.filter = filter
+	};
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+		perror_func_msg_and_die("prctl(PR_SET_NO_NEW_PRIVS)");
+
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
+		perror_func_msg_and_die("prctl(PR_SET_SECCOMP)");
+}
@@ -41,8 +41,57 @@ SYS_FUNC(write)
 struct print_iovec_config {
 	enum iov_decode decode_iov;
 	kernel_ulong_t data_size;
+	kernel_ulong_t addr;
+	kernel_ulong_t len;
+	kernel_ulong_t idx;
 };
 
+/* The number of iovec buffers read by prefetch_iov at once.  */
+#define PREFETCH_IOV_MAX	16
+
+/*
+ * Read the beginnings of the next PREFETCH_IOV_MAX buffers at once,
+ * so that print_iovec finds them in the tracee memory cache.
+ */
+static void
+prefetch_iov(struct tcb *const tcp, const struct print_iovec_config *const c)
+{
+	if (c->decode_iov == IOV_DECODE_ADDR)
+		return;
+
+	const unsigned int elem_size = current_wordsize * 2;
+	const kernel_ulong_t nmemb = MIN(c->len - c->idx, PREFETCH_IOV_MAX);
+	kernel_ulong_t data_size = c->data_size;
+	struct umove_req reqs[PREFETCH_IOV_MAX];
+	unsigned int nreqs = 0;
+
+	for (kernel_ulong_t i = 0; i < nmemb && data_size; ++i) {
+		kernel_ulong_t iov[2];
+
+		if (!tfetch_mem_ignore_syserror(tcp,
+						c->addr + (c->idx + i) * elem_size,
+						elem_size, iov))
+			break;
+		if (elem_size < sizeof(iov)) {
+			const unsigned int *const iov32 = (void *) iov;
+			iov[1] = iov32[1];
+			iov[0] = iov32[0];
+		}
+
+		kernel_ulong_t iov_len = MIN(iov[1], data_size);
+		if (data_size != (kernel_ulong_t) -1)
+			data_size -= iov_len;
+		if (c->decode_iov == IOV_DECODE_STR)
+			iov_len = MIN(iov_len, max_strlen + 1);
+
+		reqs[nreqs].addr = iov[0];
+		reqs[nreqs].len = MIN(iov_len, -1U);
+		++nreqs;
+	}
+
+	umove_prefetch(tcp, reqs, nreqs);
+}
+
 static bool
 print_iovec(struct tcb *tcp, void *elem_buf, size_t elem_size, void *data)
 {
@@ -50,6 +99,10 @@ print_iovec(struct tcb *tcp, void *elem_buf, size_t elem_size, void *data)
 	kernel_ulong_t iov_buf[2], len;
 	struct print_iovec_config *c = data;
 
+	if (c->idx % PREFETCH_IOV_MAX == 0)
+		prefetch_iov(tcp, c);
+	++c->idx;
+
 	if (elem_size < sizeof(iov_buf)) {
 		iov_buf[0] = ((unsigned int *) elem_buf)[0];
 		iov_buf[1] = ((unsigned int *) elem_buf)[1];
@@ -99,7 +152,8 @@ tprint_iov_upto(struct tcb *const tcp, const kernel_ulong_t len,
 {
 	kernel_ulong_t iov[2];
 	struct print_iovec_config config = {
-		.decode_iov = decode_iov, .data_size = data_size
+		.decode_iov = decode_iov, .data_size = data_size,
+		.addr = addr, .len = len
 	};
 
 	print_array(tcp, addr, len, iov, current_wordsize * 2,
@@ -407,6 +407,7 @@
 [397] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
 [398] = { 4,	0,		SEN(rseq),			"rseq"			},
 [399] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
+#include "syscallent-common.h"
 
 #ifdef __ARM_EABI__
 # define ARM_FIRST_SHUFFLED_SYSCALL 500
@@ -354,3 +354,4 @@
 [348] = { 6,	TD,		SEN(pwritev2),			"pwritev2"		},
 [349] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
 [350] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
+#include "syscallent-common.h"
@@ -10,6 +10,7 @@ static struct user_regs_struct i386_regs;
 #define ARCH_REGS_FOR_GETREGS i386_regs
 #define ARCH_PC_REG i386_regs.eip
 #define ARCH_SP_REG i386_regs.esp
+#define ARCH_FP_REG i386_regs.ebp
 
 #undef ARCH_MIGHT_USE_SET_REGS
 #define ARCH_MIGHT_USE_SET_REGS 0
@@ -393,6 +393,7 @@
 [384] = { 2,	TP,		SEN(arch_prctl),		"arch_prctl"		},
 [385] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 [386] = { 4,	0,		SEN(rseq),			"rseq"			},
+#include "syscallent-common.h"
 
 #define SYS_socket_subcall	500
 #include "subcall.h"
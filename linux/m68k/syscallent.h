@@ -386,6 +386,7 @@
 [377] = { 6,	TD,		SEN(preadv2),			"preadv2"		},
 [378] = { 6,	TD,		SEN(pwritev2),			"pwritev2"		},
 [379] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
+#include "syscallent-common.h"
 
 #define SYS_socket_subcall	500
 #include "subcall.h"
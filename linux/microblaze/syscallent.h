@@ -407,3 +407,4 @@
 [398] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
 [399] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 [400] = { 4,	0,		SEN(rseq),			"rseq"			},
+#include "syscallent-common.h"
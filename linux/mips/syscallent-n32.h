@@ -341,6 +341,9 @@
 [6331] = { 4,	0,		SEN(rseq),			"rseq"			},
 [6332] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 
+# define BASE_NR 6000
+# include "syscallent-common.h"
+
 # define SYS_socket_subcall      6500
 # include "subcall.h"
 
@@ -337,6 +337,9 @@
 [5327] = { 4,	0,		SEN(rseq),			"rseq"			},
 [5328] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 
+# define BASE_NR 5000
+# include "syscallent-common.h"
+
 # define SYS_socket_subcall      5500
 # include "subcall.h"
 
@@ -378,6 +378,9 @@
 [4367] = { 4,	0,		SEN(rseq),			"rseq"			},
 [4368] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 
+# define BASE_NR 4000
+# include "syscallent-common.h"
+
 # define SYS_socket_subcall      4500
 # include "subcall.h"
 
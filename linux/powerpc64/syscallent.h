@@ -391,6 +391,7 @@
 [386] = { 4,	TM|SI,		SEN(pkey_mprotect),		"pkey_mprotect"		},
 [387] = { 4,	0,		SEN(rseq),			"rseq"			},
 [388] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
+#include "syscallent-common.h"
 
 #define SYS_socket_subcall	500
 #include "subcall.h"
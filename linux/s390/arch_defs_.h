@@ -9,3 +9,4 @@
 #define HAVE_ARCH_OLD_MMAP_PGOFF 1
 #define HAVE_ARCH_UID16_SYSCALLS 1
 #define CAN_ARCH_BE_COMPAT_ON_64BIT_KERNEL 1
+#define PERSONALITY0_AUDIT_ARCH { AUDIT_ARCH_S390, 0 }
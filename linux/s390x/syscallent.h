@@ -377,6 +377,7 @@
 [381] = { 5,	TD,		SEN(kexec_file_load),		"kexec_file_load"	},
 [382] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 [383] = { 4,	0,		SEN(rseq),			"rseq"			},
+#include "syscallent-common.h"
 
 #define SYS_socket_subcall	500
 #include "subcall.h"
@@ -367,6 +367,7 @@
 [359] = { 6,	TD,		SEN(pwritev2),			"pwritev2"		},
 [360] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
 [361] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
+#include "syscallent-common.h"
 
 #define SYS_socket_subcall	500
 #include "subcall.h"
@@ -0,0 +1,18 @@
+/*
+ * Syscalls with the same numbers on all architectures
+ * added since Linux v5.3.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef BASE_NR
+# define BASE_NR 0
+#endif
+
+[BASE_NR + 435] = { 2,	TP,		SEN(clone3),			"clone3"		},
+[BASE_NR + 436] = { 3,	TD,		SEN(close_range),		"close_range"		},
+
+#undef BASE_NR
@@ -9,3 +9,5 @@
 #define HAVE_ARCH_OLD_SELECT 1
 #define HAVE_ARCH_UID16_SYSCALLS 1
 #define SUPPORTED_PERSONALITIES 2
+#define PERSONALITY0_AUDIT_ARCH { AUDIT_ARCH_X86_64, 0x40000000 /* __X32_SYSCALL_BIT */ }
+#define PERSONALITY1_AUDIT_ARCH { AUDIT_ARCH_I386,   0 }
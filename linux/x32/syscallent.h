@@ -340,6 +340,7 @@
 [332] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
 [333] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 [334] = { 4,	0,		SEN(rseq),			"rseq"			},
+#include "syscallent-common.h"
 /*
  * x32-specific system call numbers start at 512 to avoid cache impact
  * for native 64-bit operation.
@@ -340,3 +340,4 @@
 [332] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
 [333] = { 6,	0,		SEN(io_pgetevents),		"io_pgetevents"		},
 [334] = { 4,	0,		SEN(rseq),			"rseq"			},
+#include "syscallent-common.h"
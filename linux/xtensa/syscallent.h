@@ -347,3 +347,4 @@
 [349] = { 2,	0,		SEN(pkey_alloc),		"pkey_alloc"		},
 [350] = { 1,	0,		SEN(pkey_free),			"pkey_free"		},
 [351] = { 5,	TD|TF|TSTA,	SEN(statx),			"statx"			},
+#include "syscallent-common.h"
@@ -6,17 +6,304 @@
  */
 
 #include "defs.h"
-#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
-#include "largefile_wrappers.h"
 #include "mmap_cache.h"
 #include "mmap_notify.h"
+#include "syscall.h"
 #include "xstring.h"
 
-static unsigned int mmap_cache_generation;
+/* Caches of all thread groups.  */
+static struct mmap_cache_t *mmap_caches;
+
+static struct {
+	unsigned long updates;
+	unsigned long rebuilds;
+} mmap_cache_stats;
+
+static void
+clear_mmap_cache(struct mmap_cache_t *const cache)
+{
+	while (cache->size) {
+		unsigned int i = --cache->size;
+		free(cache->entry[i].binary_filename);
+		cache->entry[i].binary_filename = NULL;
+	}
+
+	free(cache->entry);
+	cache->entry = NULL;
+	cache->allocated = 0;
+	cache->valid = false;
+}
+
+/* Return the index of the first entry that ends above addr.  */
+static unsigned int
+find_entry(const struct mmap_cache_t *const cache, const unsigned long addr)
+{
+	unsigned int lower = 0;
+	unsigned int upper = cache->size;
+
+	while (lower < upper) {
+		const unsigned int mid = (lower + upper) / 2;
+
+		if (cache->entry[mid].end_addr > addr)
+			upper = mid;
+		else
+			lower = mid + 1;
+	}
+
+	return lower;
+}
+
+/* Make room for n entries at index i.  */
+static void
+insert_entries(struct mmap_cache_t *const cache, const unsigned int i,
+	       const unsigned int n)
+{
+	while (cache->size + n > cache->allocated)
+		cache->entry = xgrowarray(cache->entry, &cache->allocated,
+					  sizeof(*cache->entry));
+
+	memmove(cache->entry + i + n, cache->entry + i,
+		(cache->size - i) * sizeof(*cache->entry));
+	cache->size += n;
+}
+
+static void
+delete_entries(struct mmap_cache_t *const cache, const unsigned int i,
+	       const unsigned int n)
+{
+	for (unsigned int j = i; j < i + n; ++j)
+		free(cache->entry[j].binary_filename);
+
+	memmove(cache->entry + i, cache->entry + i + n,
+		(cache->size - i - n) * sizeof(*cache->entry));
+	cache->size -= n;
+}
+
+/* Split the entry that contains addr, so that an entry starts at addr.  */
+static void
+split_entry(struct mmap_cache_t *const cache, const unsigned long addr)
+{
+	const unsigned int i = find_entry(cache, addr);
+
+	if (i >= cache->size || cache->entry[i].start_addr >= addr)
+		return;
+
+	insert_entries(cache, i + 1, 1);
+
+	struct mmap_cache_entry_t *const entry = &cache->entry[i];
+	struct mmap_cache_entry_t *const next = &cache->entry[i + 1];
+
+	*next = *entry;
+	next->start_addr = addr;
+	next->mmap_offset += addr - entry->start_addr;
+	next->binary_filename = xstrdup(entry->binary_filename);
+	entry->end_addr = addr;
+}
+
+/* Return the index of the first entry of [start, end).  */
+static unsigned int
+split_range(struct mmap_cache_t *const cache,
+	    const unsigned long start, const unsigned long end)
+{
+	split_entry(cache, start);
+	split_entry(cache, end);
+
+	return find_entry(cache, start);
+}
 
 static void
-mmap_cache_invalidate(struct tcb *tcp, void *unused)
+unmap_range(struct mmap_cache_t *const cache,
+	    const unsigned long start, const unsigned long end)
+{
+	const unsigned int i = split_range(cache, start, end);
+	unsigned int j = i;
+
+	while (j < cache->size && cache->entry[j].start_addr < end)
+		++j;
+
+	delete_entries(cache, i, j - i);
+}
+
+static void
+protect_range(struct mmap_cache_t *const cache,
+	      const unsigned long start, const unsigned long end,
+	      const kernel_ulong_t prot)
+{
+	const unsigned char protections =
+		((prot & PROT_READ) ? MMAP_CACHE_PROT_READABLE : 0)
+		| ((prot & PROT_WRITE) ? MMAP_CACHE_PROT_WRITABLE : 0)
+		| ((prot & PROT_EXEC) ? MMAP_CACHE_PROT_EXECUTABLE : 0);
+
+	for (unsigned int i = split_range(cache, start, end);
+	     i < cache->size && cache->entry[i].start_addr < end; ++i) {
+		struct mmap_cache_entry_t *const entry = &cache->entry[i];
+
+		entry->protections = protections
+			| (entry->protections & MMAP_CACHE_PROT_SHARED);
+	}
+}
+
+/*
+ * Move the mapping of [old_addr, old_addr + old_size)
+ * to [new_addr, new_addr + new_size).
+ */
+static bool
+remap_range(struct mmap_cache_t *const cache,
+	    const unsigned long old_addr, const unsigned long old_size,
+	    const unsigned long new_addr, const unsigned long new_size)
+{
+	const unsigned long old_end = old_addr + old_size;
+	const unsigned int i = find_entry(cache, old_addr);
+
+	if (i >= cache->size || cache->entry[i].start_addr >= old_end) {
+		/* An anonymous mapping is not cached.  */
+		unmap_range(cache, new_addr, new_addr + new_size);
+		return true;
+	}
+
+	const struct mmap_cache_entry_t *const entry = &cache->entry[i];
+
+	/* Parts of several mappings cannot be moved together.  */
+	if (entry->start_addr > old_addr || entry->end_addr < old_end)
+		return false;
+
+	struct mmap_cache_entry_t moved = *entry;
+
+	moved.start_addr = new_addr;
+	moved.end_addr = new_addr + new_size;
+	moved.mmap_offset += old_addr - entry->start_addr;
+	moved.binary_filename = xstrdup(entry->binary_filename);
+
+	unmap_range(cache, old_addr, old_end);
+	unmap_range(cache, new_addr, moved.end_addr);
+
+	const unsigned int j = find_entry(cache, new_addr);
+
+	insert_entries(cache, j, 1);
+	cache->entry[j] = moved;
+
+	return true;
+}
+
+static bool
+set_brk(struct mmap_cache_t *const cache, const unsigned long end)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->size; ++i) {
+		if (!strcmp(cache->entry[i].binary_filename, "[heap]"))
+			break;
+	}
+
+	/* The heap is created on demand.  */
+	if (i >= cache->size)
+		return false;
+
+	struct mmap_cache_entry_t *const entry = &cache->entry[i];
+
+	if (end <= entry->start_addr) {
+		delete_entries(cache, i, 1);
+		return true;
+	}
+
+	if (i + 1 < cache->size && end > cache->entry[i + 1].start_addr)
+		return false;
+
+	entry->end_addr = end;
+	return true;
+}
+
+/*
+ * Apply the changes of memory mappings made by the current syscall
+ * of tcp to its cache.  Changes that cannot be described without
+ * reading /proc/PID/maps, e.g. mappings of files, are not applied.
+ */
+static bool
+update_mmap_cache(struct tcb *const tcp, struct mmap_cache_t *const cache)
+{
+	if (syscall_tampered(tcp))
+		return false;
+
+	const unsigned long page_mask = get_pagesize() - 1;
+	const unsigned long addr = tcp->u_arg[0];
+	const unsigned long len = (tcp->u_arg[1] + page_mask) & ~page_mask;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_mmap:
+	case SEN_mmap_pgoff:
+	case SEN_mmap_4koff: {
+		const kernel_ulong_t flags = tcp->u_arg[3];
+
+		if (syserror(tcp))
+			return !(flags & MAP_FIXED);
+
+		/*
+		 * Only private anonymous mappings are not named
+		 * in /proc/PID/maps.
+		 */
+		if (!(flags & MAP_ANONYMOUS) || (flags & MAP_SHARED))
+			return false;
+#ifdef MAP_HUGETLB
+		if (flags & MAP_HUGETLB)
+			return false;
+#endif
+		const unsigned long start = tcp->u_rval;
+
+		if (start + len < start)
+			return false;
+		unmap_range(cache, start, start + len);
+		return true;
+	}
+
+	case SEN_munmap:
+		if (syserror(tcp))
+			return true;
+		if (addr + len < addr)
+			return false;
+		unmap_range(cache, addr, addr + len);
+		return true;
+
+	case SEN_mprotect:
+	case SEN_pkey_mprotect:
+		/* A failed mprotect may have changed a part of the range.  */
+		if (syserror(tcp)
+		    || (tcp->u_arg[2] & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+		    || addr + len < addr)
+			return false;
+		protect_range(cache, addr, addr + len, tcp->u_arg[2]);
+		return true;
+
+	case SEN_mremap: {
+		const unsigned long new_len =
+			(tcp->u_arg[2] + page_mask) & ~page_mask;
+
+		if (syserror(tcp))
+			return true;
+		/* Old size 0 creates another mapping of a shared mapping.  */
+		if (!len || (tcp->u_arg[3] & ~(MREMAP_MAYMOVE | MREMAP_FIXED))
+		    || addr + len < addr
+		    || (unsigned long) tcp->u_rval + new_len
+		       < (unsigned long) tcp->u_rval)
+			return false;
+		return remap_range(cache, addr, len, tcp->u_rval, new_len);
+	}
+
+	case SEN_brk:
+		/* brk(0) just returns the current break.  */
+		if (!addr)
+			return true;
+		return set_brk(cache, ((unsigned long) tcp->u_rval + page_mask)
+				      & ~page_mask);
+	}
+
+	return false;
+}
+
+static void
+mmap_cache_invalidate(struct tcb *tcp, bool decoded, void *unused)
 {
 #if SUPPORTED_PERSONALITIES > 1
 	if (tcp->currpers != DEFAULT_PERSONALITY) {
@@ -24,11 +311,24 @@ mmap_cache_invalidate(struct tcb *tcp, void *unused)
 		return;
 	}
 #endif
-	mmap_cache_generation++;
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0);
+	/*
+	 * Only the cache of the address space of tcp is invalidated,
+	 * unless address spaces are shared between thread groups.
+	 */
+	if (mmap_notify_vm_shared()) {
+		for (struct mmap_cache_t *c = mmap_caches; c; c = c->next)
+			c->valid = false;
+	} else if (tcp->mmap_cache && tcp->mmap_cache->valid) {
+		if (decoded && update_mmap_cache(tcp, tcp->mmap_cache))
+			++mmap_cache_stats.updates;
+		else
+			tcp->mmap_cache->valid = false;
+	}
+
+	debug_func_msg("tgid=%d, tcp=%p, cache=%p, valid=%d",
+		       tcp->mmap_cache ? tcp->mmap_cache->tgid : 0, tcp,
+		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0,
+		       tcp->mmap_cache ? tcp->mmap_cache->valid : 0);
 }
 
 void
@@ -42,82 +342,218 @@ mmap_cache_enable(void)
 	}
 }
 
-/* deleting the cache */
+/* detaching tcp from the cache, deleting the cache with its last user */
 static void
-delete_mmap_cache(struct tcb *tcp, const char *caller)
+release_mmap_cache(struct tcb *tcp, const char *caller)
 {
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0, caller);
+	struct mmap_cache_t *const cache = tcp->mmap_cache;
 
-	if (!tcp->mmap_cache)
+	debug_func_msg("tgid=%d, refcnt=%u, tcp=%p, cache=%p, caller=%s",
+		       cache ? cache->tgid : 0, cache ? cache->refcnt : 0,
+		       tcp, cache ? cache->entry : 0, caller);
+
+	if (!cache)
 		return;
 
-	while (tcp->mmap_cache->size) {
-		unsigned int i = --tcp->mmap_cache->size;
-		free(tcp->mmap_cache->entry[i].binary_filename);
-		tcp->mmap_cache->entry[i].binary_filename = NULL;
+	tcp->mmap_cache = NULL;
+
+	if (--cache->refcnt)
+		return;
+
+	for (struct mmap_cache_t **p = &mmap_caches; *p; p = &(*p)->next) {
+		if (*p == cache) {
+			*p = cache->next;
+			break;
+		}
 	}
 
-	free(tcp->mmap_cache->entry);
-	tcp->mmap_cache->entry = NULL;
+	clear_mmap_cache(cache);
+	free(cache);
+}
 
-	free(tcp->mmap_cache);
-	tcp->mmap_cache = NULL;
+static struct mmap_cache_t *
+get_mmap_cache(struct tcb *tcp)
+{
+	if (tcp->mmap_cache)
+		return tcp->mmap_cache;
+
+	int tgid;
+	unsigned int threads;
+
+	if (!read_thread_group(tcp->pid, &tgid, &threads))
+		return NULL;
+
+	struct mmap_cache_t *cache;
+
+	for (cache = mmap_caches; cache; cache = cache->next) {
+		if (cache->tgid == tgid)
+			break;
+	}
+
+	if (!cache) {
+		cache = xcalloc(1, sizeof(*cache));
+		cache->free_fn = release_mmap_cache;
+		cache->tgid = tgid;
+		cache->next = mmap_caches;
+		mmap_caches = cache;
+	}
+
+	++cache->refcnt;
+	tcp->mmap_cache = cache;
+
+	return cache;
+}
+
+/*
+ * Read the whole file with as few read calls as possible,
+ * the kernel fills as much of the buffer as it can at once.
+ */
+static char *
+read_maps(const char *const filename, size_t *const len)
+{
+	const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror_msg("open: %s", filename);
+		return NULL;
+	}
+
+	static size_t buf_size = 64 * 1024;
+	char *buf = xmalloc(buf_size);
+	size_t pos = 0;
+
+	for (;;) {
+		if (pos == buf_size)
+			buf = xgrowarray(buf, &buf_size, 1);
+
+		const ssize_t n = read(fd, buf + pos, buf_size - pos);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg("read: %s", filename);
+			free(buf);
+			buf = NULL;
+			break;
+		}
+		if (!n)
+			break;
+		pos += n;
+	}
+
+	close(fd);
+	*len = pos;
+	return buf;
+}
+
+static bool
+parse_hex(const char **const pp, const char *const end,
+	  unsigned long *const val)
+{
+	const char *p = *pp;
+	unsigned long v = 0;
+
+	for (; p < end; ++p) {
+		unsigned int digit;
+
+		if (*p >= '0' && *p <= '9')
+			digit = *p - '0';
+		else if (*p >= 'a' && *p <= 'f')
+			digit = *p - 'a' + 10;
+		else
+			break;
+		v = (v << 4) | digit;
+	}
+
+	if (p == *pp)
+		return false;
+
+	*pp = p;
+	*val = v;
+	return true;
+}
+
+static bool
+skip_char(const char **const pp, const char *const end, const char c)
+{
+	if (*pp >= end || **pp != c)
+		return false;
+
+	++*pp;
+	return true;
 }
 
 /*
  * caching of /proc/ID/maps for each process to speed up stack tracing
  *
  * The cache must be refreshed after syscalls that affect memory mappings,
- * e.g. mmap, mprotect, munmap, execve.
+ * e.g. mmap, mprotect, munmap, execve.  Changes made by munmap, mprotect,
+ * mremap, brk, and mmap of anonymous memory are applied to the cache
+ * directly, see update_mmap_cache.
  */
 extern enum mmap_cache_rebuild_result
 mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 {
-	if (tcp->mmap_cache
-	    && tcp->mmap_cache->generation != mmap_cache_generation)
-		delete_mmap_cache(tcp, caller);
+	struct mmap_cache_t *const cache = get_mmap_cache(tcp);
 
-	if (tcp->mmap_cache)
+	if (!cache)
+		return MMAP_CACHE_REBUILD_NOCACHE;
+
+	if (cache->valid)
 		return MMAP_CACHE_REBUILD_READY;
 
+	clear_mmap_cache(cache);
+
 	char filename[sizeof("/proc/4294967296/maps")];
 	xsprintf(filename, "/proc/%u/maps", tcp->pid);
 
-	FILE *fp = fopen_stream(filename, "r");
-	if (!fp) {
-		perror_msg("fopen: %s", filename);
+	size_t len;
+	char *const buf = read_maps(filename, &len);
+	if (!buf)
 		return MMAP_CACHE_REBUILD_NOCACHE;
-	}
 
-	struct mmap_cache_t cache = {
-		.free_fn = delete_mmap_cache,
-		.generation = mmap_cache_generation
-	};
+	++mmap_cache_stats.rebuilds;
+
+	const char *const buf_end = buf + len;
 
-	/* start with a small dynamically-allocated array and then expand it */
-	size_t allocated = 0;
-	char buffer[PATH_MAX + 80];
+	for (const char *p = buf, *eol; p < buf_end; p = eol + 1) {
+		eol = memchr(p, '\n', buf_end - p);
+		if (!eol)
+			eol = buf_end;
 
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
 		unsigned long start_addr, end_addr, mmap_offset;
-		char read_bit;
-		char write_bit;
-		char exec_bit;
-		char shared_bit;
 		unsigned long major, minor;
-		char binary_path[sizeof(buffer)];
-
-		if (sscanf(buffer, "%lx-%lx %c%c%c%c %lx %lx:%lx %*d %[^\n]",
-			   &start_addr, &end_addr,
-			   &read_bit, &write_bit, &exec_bit, &shared_bit,
-			   &mmap_offset,
-			   &major, &minor,
-			   binary_path) != 10)
+
+		/* see struct mmap_cache_entry_t for an example */
+		if (!parse_hex(&p, eol, &start_addr) || !skip_char(&p, eol, '-')
+		    || !parse_hex(&p, eol, &end_addr) || !skip_char(&p, eol, ' ')
+		    || eol - p < 5 || p[4] != ' ')
 			continue;
 
+		const char read_bit = p[0];
+		const char write_bit = p[1];
+		const char exec_bit = p[2];
+		const char shared_bit = p[3];
+		p += 5;
+
+		if (!parse_hex(&p, eol, &mmap_offset) || !skip_char(&p, eol, ' ')
+		    || !parse_hex(&p, eol, &major) || !skip_char(&p, eol, ':')
+		    || !parse_hex(&p, eol, &minor) || !skip_char(&p, eol, ' '))
+			continue;
+
+		unsigned long inode = 0;
+
+		for (; p < eol && *p >= '0' && *p <= '9'; ++p)
+			inode = inode * 10 + (*p - '0');
+		while (p < eol && *p == ' ')
+			++p;
+
+		/* skip anonymous mappings */
+		if (p == eol)
+			continue;
+
+		const char *const binary_path = p;
+		const int path_len = eol - p;
+
 		/* skip mappings that have unknown protection */
 		if (!(read_bit == '-' || read_bit == 'r'))
 			continue;
@@ -138,8 +574,8 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		 * sanity check to make sure that we're storing
 		 * non-overlapping regions in ascending order
 		 */
-		if (cache.size > 0) {
-			entry = &cache.entry[cache.size - 1];
+		if (cache->size > 0) {
+			entry = &cache->entry[cache->size - 1];
 			if (entry->start_addr == start_addr &&
 			    entry->end_addr == end_addr) {
 				/* duplicate entry, e.g. [vsyscall] */
@@ -148,20 +584,22 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 			if (start_addr <= entry->start_addr ||
 			    start_addr < entry->end_addr) {
 				debug_msg("%s: overlapping memory region: "
-					  "\"%s\" [%08lx-%08lx] overlaps with "
+					  "\"%.*s\" [%08lx-%08lx] overlaps with "
 					  "\"%s\" [%08lx-%08lx]",
-					  filename, binary_path, start_addr,
-					  end_addr, entry->binary_filename,
+					  filename, path_len, binary_path,
+					  start_addr, end_addr,
+					  entry->binary_filename,
 					  entry->start_addr, entry->end_addr);
 				continue;
 			}
 		}
 
-		if (cache.size >= allocated)
-			cache.entry = xgrowarray(cache.entry, &allocated,
-						 sizeof(*cache.entry));
+		if (cache->size >= cache->allocated)
+			cache->entry = xgrowarray(cache->entry,
+						  &cache->allocated,
+						  sizeof(*cache->entry));
 
-		entry = &cache.entry[cache.size];
+		entry = &cache->entry[cache->size];
 		entry->start_addr = start_addr;
 		entry->end_addr = end_addr;
 		entry->mmap_offset = mmap_offset;
@@ -174,20 +612,19 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 			);
 		entry->major = major;
 		entry->minor = minor;
-		entry->binary_filename = xstrdup(binary_path);
-		cache.size++;
+		entry->inode = inode;
+		entry->binary_filename = xstrndup(binary_path, path_len);
+		cache->size++;
 	}
-	fclose(fp);
+	free(buf);
 
-	if (!cache.size)
+	if (!cache->size)
 		return MMAP_CACHE_REBUILD_NOCACHE;
 
-	tcp->mmap_cache = xmalloc(sizeof(*tcp->mmap_cache));
-	memcpy(tcp->mmap_cache, &cache, sizeof(cache));
+	cache->valid = true;
 
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache->generation, mmap_cache_generation,
-		       tcp, tcp->mmap_cache->entry, caller);
+	debug_func_msg("tgid=%d, tcp=%p, cache=%p, caller=%s",
+		       cache->tgid, tcp, cache->entry, caller);
 
 	return MMAP_CACHE_REBUILD_RENEWED;
 }
@@ -195,7 +632,7 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 struct mmap_cache_entry_t *
 mmap_cache_search(struct tcb *tcp, unsigned long ip)
 {
-	if (!tcp->mmap_cache)
+	if (!tcp->mmap_cache || !tcp->mmap_cache->valid)
 		return NULL;
 
 	int lower = 0;
@@ -216,6 +653,13 @@ mmap_cache_search(struct tcb *tcp, unsigned long ip)
 	return NULL;
 }
 
+void
+print_mmap_cache_stats(void)
+{
+	debug_msg("mmap caches: %lu updates, %lu /proc reads",
+		  mmap_cache_stats.updates, mmap_cache_stats.rebuilds);
+}
+
 struct mmap_cache_entry_t *
 mmap_cache_search_custom(struct tcb *tcp, mmap_cache_search_fn fn, void *data)
 {
@@ -10,13 +10,20 @@
 /*
  * Keep a sorted array of cache entries,
  * so that we can binary search through it.
+ *
+ * All threads of a process share the address space, so the cache
+ * is kept per thread group and is referenced by the tcbs of its threads.
  */
 
 struct mmap_cache_t {
+	struct mmap_cache_t *next;
 	struct mmap_cache_entry_t *entry;
 	void (*free_fn)(struct tcb *, const char *caller);
 	unsigned int size;
-	unsigned int generation;
+	size_t allocated;
+	unsigned int refcnt;
+	int tgid;
+	bool valid;
 };
 
 struct mmap_cache_entry_t {
@@ -30,6 +37,7 @@ struct mmap_cache_entry_t {
 	 * protections is MMAP_CACHE_PROT_READABLE|MMAP_CACHE_PROT_EXECUTABLE
 	 * major       is 0xfc
 	 * minor       is 0x00
+	 * inode       is 1180246
 	 * binary_filename is "/lib/libc-2.11.1.so"
 	 */
 	unsigned long start_addr;
@@ -37,6 +45,7 @@ struct mmap_cache_entry_t {
 	unsigned long mmap_offset;
 	unsigned char protections;
 	unsigned long major, minor;
+	unsigned long inode;
 	char *binary_filename;
 };
 
@@ -67,4 +76,7 @@ mmap_cache_search(struct tcb *, unsigned long ip);
 extern struct mmap_cache_entry_t *
 mmap_cache_search_custom(struct tcb *, mmap_cache_search_fn, void *);
 
+extern void
+print_mmap_cache_stats(void);
+
 #endif /* !STRACE_MMAP_CACHE_H */
@@ -5,6 +5,8 @@
  */
 
 #include "mmap_notify.h"
+#include <sched.h>
+#include "syscall.h"
 
 struct mmap_notify_client {
 	mmap_notify_fn fn;
@@ -14,6 +16,13 @@ struct mmap_notify_client {
 
 static struct mmap_notify_client *clients;
 
+/*
+ * Set when an address space is shared between processes,
+ * so that the memory mappings of a process can be changed
+ * by syscalls of another thread group.
+ */
+static bool vm_shared;
+
 void
 mmap_notify_register_client(mmap_notify_fn fn, void *data)
 {
@@ -25,10 +34,73 @@ mmap_notify_register_client(mmap_notify_fn fn, void *data)
 }
 
 void
-mmap_notify_report(struct tcb *tcp)
+mmap_notify_report(struct tcb *tcp, bool decoded)
 {
 	struct mmap_notify_client *client;
 
 	for (client = clients; client; client = client->next)
-		client->fn(tcp, client->data);
+		client->fn(tcp, decoded, client->data);
+}
+
+bool
+mmap_notify_enabled(void)
+{
+	return clients != NULL;
+}
+
+bool
+mmap_notify_vm_shared(void)
+{
+	return vm_shared;
+}
+
+void
+mmap_notify_syscall(struct tcb *tcp, bool has_result)
+{
+	const struct_sysent *const s = tcp_sysent(tcp);
+
+	if (s->sys_flags & MEMORY_MAPPING_CHANGE) {
+		mmap_notify_report(tcp, has_result);
+		return;
+	}
+
+	switch (s->sen) {
+	case SEN_vfork:
+		/*
+		 * The parent resumes after the child has called execve
+		 * or exited, the mappings it has changed in the meantime
+		 * are those of the parent.
+		 */
+		mmap_notify_report(tcp, false);
+		break;
+
+	case SEN_clone:
+	case SEN_clone3: {
+		const kernel_ulong_t flags = get_clone_flags(tcp);
+
+		if (!(flags & CLONE_VM) || (flags & CLONE_THREAD))
+			break;
+		if (!(flags & CLONE_VFORK) && !vm_shared) {
+			debug_msg("address space is shared between processes");
+			vm_shared = true;
+		}
+		mmap_notify_report(tcp, false);
+		break;
+	}
+	}
+}
+
+bool
+mmap_notify_needs_syscall(const struct_sysent *const s)
+{
+	if (!mmap_notify_enabled())
+		return false;
+
+	switch (s->sen) {
+	case SEN_clone:
+	case SEN_vfork:
+		return true;
+	}
+
+	return s->sys_flags & MEMORY_MAPPING_CHANGE;
 }
@@ -9,12 +9,38 @@
 
 # include "defs.h"
 
-typedef void (*mmap_notify_fn)(struct tcb *, void *);
+/*
+ * decoded is true when the change is described by the arguments
+ * and the return value of the current syscall of tcp.
+ */
+typedef void (*mmap_notify_fn)(struct tcb *, bool decoded, void *);
 
 extern void
 mmap_notify_register_client(mmap_notify_fn, void *);
 
 extern void
-mmap_notify_report (struct tcb *);
+mmap_notify_report(struct tcb *, bool decoded);
+
+extern bool
+mmap_notify_enabled(void);
+
+/*
+ * Whether an address space may be shared by processes of different
+ * thread groups, so that a change reported for one of them has to be
+ * applied to all of them.
+ */
+extern bool
+mmap_notify_vm_shared(void);
+
+/*
+ * Report the changes of memory mappings made by the syscall of tcp,
+ * has_result tells whether its return value has been fetched.
+ */
+extern void
+mmap_notify_syscall(struct tcb *, bool has_result);
+
+/* Whether the clients have to see syscall s.  */
+extern bool
+mmap_notify_needs_syscall(const struct_sysent *);
 
 #endif /* !STRACE_MMAP_NOTIFY_H */
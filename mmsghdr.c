@@ -132,6 +132,13 @@ dumpiov_in_mmsghdr(struct tcb *const tcp, kernel_ulong_t addr)
 	unsigned int i, fetched;
 	struct mmsghdr mmsg;
 
+	/* Read all the headers at once.  */
+	const struct umove_req req = {
+		.addr = addr,
+		.len = MIN((kernel_ulong_t) len * sizeof_struct_mmsghdr(), -1U)
+	};
+	umove_prefetch(tcp, &req, 1);
+
 	for (i = 0; i < len; ++i, addr += fetched) {
 		fetched = fetch_struct_mmsghdr(tcp, addr, &mmsg);
 		if (!fetched)
@@ -14,7 +14,6 @@
  */
 
 #include "defs.h"
-#include "xstring.h"
 
 #include <asm/fcntl.h>
 
@@ -58,35 +57,24 @@ sprint_open_modes(unsigned int flags)
 {
 	static char outstr[(1 + ARRAY_SIZE(open_mode_flags)) * sizeof("O_LARGEFILE")];
 	char *p;
-	char sep;
+	const char *sep;
 	const char *str;
-	const struct xlat *x;
 
-	sep = ' ';
+	sep = " ";
 	p = stpcpy(outstr, "flags");
 	str = xlookup(open_access_modes, flags & 3);
 	if (str) {
-		*p++ = sep;
+		p = stpcpy(p, sep);
 		p = stpcpy(p, str);
 		flags &= ~3;
 		if (!flags)
 			return outstr;
-		sep = '|';
+		sep = "|";
 	}
 
-	for (x = open_mode_flags; x->str; x++) {
-		if ((flags & x->val) == x->val) {
-			*p++ = sep;
-			p = stpcpy(p, x->str);
-			flags &= ~x->val;
-			if (!flags)
-				return outstr;
-			sep = '|';
-		}
-	}
-	/* flags is still nonzero */
-	*p++ = sep;
-	p = xappendstr(outstr, p, "%#x", flags);
+	/* flags is nonzero, so sprintflags_buf cannot return NULL */
+	sprintflags_buf(p, outstr + sizeof(outstr) - p, sep, open_mode_flags,
+			flags, XLAT_STYLE_ABBREV);
 	return outstr;
 }
 
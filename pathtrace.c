@@ -11,26 +11,160 @@
 #include <limits.h>
 #include <poll.h>
 
+#include "bintrace.h"
+#include "fdtab.h"
 #include "syscall.h"
 #include "xstring.h"
 
 struct path_set global_path_set;
 
 /*
- * Return true if specified path matches one that we're tracing.
+ * Paths ending with a slash select whole directory trees.  These are kept
+ * in a trie of path components, while the other paths are looked up
+ * in a hash table.
+ */
+struct path_trie {
+	struct path_trie *child;	/* the first subdirectory */
+	struct path_trie *next;		/* the next directory of the parent */
+	const char *name;		/* not terminated */
+	size_t len;
+	bool subtree;			/* the directory and all below it */
+};
+
+static size_t
+hash_path(const char *path)
+{
+	/* FNV-1a */
+	size_t h = 2166136261U;
+
+	for (; *path; ++path)
+		h = (h ^ (unsigned char) *path) * 16777619U;
+
+	return h;
+}
+
+static const char **
+hash_find(const char *path, const struct path_set *set)
+{
+	const size_t mask = set->hash_size - 1;
+	size_t i = hash_path(path) & mask;
+
+	for (; set->hash[i]; i = (i + 1) & mask) {
+		if (strcmp(path, set->hash[i]) == 0)
+			break;
+	}
+
+	return &set->hash[i];
+}
+
+static void
+hash_insert(const char *path, struct path_set *set)
+{
+	/* Keep the table at most half full.  */
+	if (set->num_selected * 2 >= set->hash_size) {
+		const char **const old = set->hash;
+		const size_t old_size = set->hash_size;
+
+		set->hash_size = old_size ? old_size * 2 : 16;
+		set->hash = xcalloc(set->hash_size, sizeof(*set->hash));
+
+		for (size_t i = 0; i < old_size; ++i) {
+			if (old[i])
+				*hash_find(old[i], set) = old[i];
+		}
+		free(old);
+	}
+
+	*hash_find(path, set) = path;
+}
+
+/*
+ * Return the length of the first component of path
+ * and the pointer to the rest of it, NULL if there is none.
  */
+static size_t
+next_component(const char *path, const char **rest)
+{
+	const char *const slash = strchr(path, '/');
+
+	if (!slash) {
+		*rest = NULL;
+		return strlen(path);
+	}
+
+	*rest = slash + 1;
+	return slash - path;
+}
+
 static bool
-pathmatch(const char *path, struct path_set *set)
+trie_match(const struct path_trie *node, const char *path)
 {
-	unsigned i;
+	while (path && node) {
+		const char *rest;
+		const size_t len = next_component(path, &rest);
 
-	for (i = 0; i < set->num_selected; ++i) {
-		if (strcmp(path, set->paths_selected[i]) == 0)
+		for (; node; node = node->next) {
+			if (node->len == len && !memcmp(node->name, path, len))
+				break;
+		}
+
+		if (node && node->subtree)
 			return true;
+
+		node = node ? node->child : NULL;
+		path = rest;
 	}
+
 	return false;
 }
 
+/*
+ * Select the tree of path, which has no trailing slashes,
+ * "" stands for the root directory.
+ */
+static void
+trie_insert(const char *path, struct path_set *set)
+{
+	struct path_trie **p = &set->trie;
+
+	for (;;) {
+		const char *rest;
+		const size_t len = next_component(path, &rest);
+		struct path_trie *node;
+
+		for (node = *p; node; node = node->next) {
+			if (node->len == len && !memcmp(node->name, path, len))
+				break;
+		}
+
+		if (!node) {
+			node = xcalloc(1, sizeof(*node));
+			node->name = path;
+			node->len = len;
+			node->next = *p;
+			*p = node;
+		}
+
+		if (!rest) {
+			node->subtree = true;
+			return;
+		}
+
+		p = &node->child;
+		path = rest;
+	}
+}
+
+/*
+ * Return true if specified path matches one that we're tracing.
+ */
+static bool
+pathmatch(const char *path, const struct path_set *set)
+{
+	return (set->hash_size && *hash_find(path, set))
+	       || trie_match(set->trie, path);
+}
+
 /*
  * Return true if specified path (in user-space) matches.
  */
@@ -46,25 +180,51 @@ upathmatch(struct tcb *const tcp, const kernel_ulong_t upath,
 
 /*
  * Return true if specified fd maps to a path we're tracing.
+ * The result is remembered in the descriptor table, so it is forgotten
+ * when the descriptor is closed and when any traced process calls
+ * a syscall that may change paths of open files, see fdtab_syscall.
  */
 static bool
 fdmatch(struct tcb *tcp, int fd, struct path_set *set)
 {
+	struct fd_info *const info =
+		set == &global_path_set ? get_fd_info(tcp, fd) : NULL;
+
+	if (info && info->match_checked) {
+		count_fd_info(true);
+		return info->match;
+	}
+
 	char path[PATH_MAX + 1];
 	int n = getfdpath(tcp, fd, path, sizeof(path));
+	const bool match = n >= 0 && pathmatch(path, set);
 
-	return n >= 0 && pathmatch(path, set);
+	if (info && n >= 0) {
+		info->match = match;
+		info->match_checked = true;
+	}
+
+	return match;
 }
 
 /*
  * Add a path to the set we're tracing.
- * Specifying NULL will delete all paths.
+ * A path ending with a slash selects the whole tree.
  */
 static void
 storepath(const char *path, struct path_set *set)
 {
-	if (pathmatch(path, set))
-		return; /* already in table */
+	size_t len = strlen(path);
+
+	if (len && path[len - 1] == '/') {
+		while (len && path[len - 1] == '/')
+			--len;
+		trie_insert(xstrndup(path, len), set);
+	} else {
+		if (pathmatch(path, set))
+			return; /* already in table */
+		hash_insert(path, set);
+	}
 
 	if (set->num_selected >= set->size)
 		set->paths_selected =
@@ -81,25 +241,62 @@ int
 getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
 {
 	char linkpath[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int)*3];
+	char path[PATH_MAX + 1];
 	ssize_t n;
 
 	if (fd < 0)
 		return -1;
 
-	xsprintf(linkpath, "/proc/%u/fd/%u", tcp->pid, fd);
-	n = readlink(linkpath, buf, bufsize - 1);
-	/*
-	 * NB: if buf is too small, readlink doesn't fail,
-	 * it returns truncated result (IOW: n == bufsize - 1).
-	 */
-	if (n >= 0)
+	if (bintrace_replaying)
+		return bintrace_replay_fdpath(fd, buf, bufsize);
+
+	struct fd_info *const info = get_fd_info(tcp, fd);
+
+	if (info && info->path) {
+		count_fd_info(true);
+		n = MIN((unsigned int) info->path_len, bufsize - 1);
+		memcpy(buf, info->path, n);
 		buf[n] = '\0';
+		if (bintrace_recording)
+			bintrace_record_fdpath(fd, info->path, info->path_len);
+		return n;
+	}
+
+	xsprintf(linkpath, "/proc/%u/fd/%u", tcp->pid, fd);
+
+	if (!info) {
+		n = readlink(linkpath, buf, bufsize - 1);
+		/*
+		 * NB: if buf is too small, readlink doesn't fail,
+		 * it returns truncated result (IOW: n == bufsize - 1).
+		 */
+		if (n >= 0)
+			buf[n] = '\0';
+		if (bintrace_recording)
+			bintrace_record_fdpath(fd, buf, n);
+		return n;
+	}
+
+	count_fd_info(false);
+	n = readlink(linkpath, path, sizeof(path) - 1);
+	if (bintrace_recording)
+		bintrace_record_fdpath(fd, path, n);
+	if (n < 0)
+		return n;
+	path[n] = '\0';
+
+	info->path = xstrndup(path, n);
+	info->path_len = n;
+
+	n = MIN((size_t) n, bufsize - 1);
+	memcpy(buf, path, n);
+	buf[n] = '\0';
 	return n;
 }
 
 /*
  * Add a path to the set we're tracing.  Also add the canonicalized
- * version of the path.  Specifying NULL will delete all paths.
+ * version of the path.
  */
 void
 pathtrace_select_set(const char *path, struct path_set *set)
@@ -113,13 +310,29 @@ pathtrace_select_set(const char *path, struct path_set *set)
 	if (rpath == NULL)
 		return;
 
+	/* realpath strips the trailing slash of a tree */
+	size_t len = strlen(path);
+	const bool tree = len && path[len - 1] == '/';
+
+	while (tree && len > 1 && path[len - 1] == '/')
+		--len;
+
 	/* if realpath and specified path are same, we're done */
-	if (strcmp(path, rpath) == 0) {
+	if (strlen(rpath) == len && strncmp(path, rpath, len) == 0) {
 		free(rpath);
 		return;
 	}
 
 	error_msg("Requested path '%s' resolved into '%s'", path, rpath);
+
+	if (tree && strcmp(rpath, "/") != 0) {
+		const size_t rlen = strlen(rpath);
+
+		rpath = xreallocarray(rpath, rlen + 2, 1);
+		rpath[rlen] = '/';
+		rpath[rlen + 1] = '\0';
+	}
+
 	storepath(rpath, set);
 }
 
@@ -288,7 +501,7 @@ pathtrace_match_set(struct tcb *tcp, struct path_set *set)
 	case SEN_poll:
 	case SEN_ppoll:
 	{
-		struct pollfd fds;
+		struct pollfd fds[256];
 		unsigned nfds;
 		kernel_ulong_t start, cur, end;
 
@@ -297,16 +510,30 @@ pathtrace_match_set(struct tcb *tcp, struct path_set *set)
 
 		if (nfds > 1024 * 1024)
 			nfds = 1024 * 1024;
-		end = start + sizeof(fds) * nfds;
+		end = start + sizeof(fds[0]) * nfds;
 
 		if (nfds == 0 || end < start)
 			return false;
 
 		for (cur = start; cur < end; cur += sizeof(fds)) {
-			if (umove(tcp, cur, &fds))
-				break;
-			if (fdmatch(tcp, fds.fd, set))
-				return true;
+			const unsigned int n =
+				MIN(ARRAY_SIZE(fds),
+				    (end - cur) / sizeof(fds[0]));
+
+			/*
+			 * If the chunk cannot be read as a whole,
+			 * read it element by element up to the bad address.
+			 */
+			const bool chunk_ok =
+				!umoven(tcp, cur, n * sizeof(fds[0]), fds);
+
+			for (unsigned int i = 0; i < n; ++i) {
+				if (!chunk_ok &&
+				    umove(tcp, cur + i * sizeof(fds[0]), &fds[i]))
+					return false;
+				if (fdmatch(tcp, fds[i].fd, set))
+					return true;
+			}
 		}
 
 		return false;
@@ -39,7 +39,8 @@ SYS_FUNC(personality)
 				      pers & PER_MASK, "PER_???");
 	pers &= ~PER_MASK;
 	if (pers)
-		strcpy(p, sprintflags("|", personality_flags, pers));
+		sprintflags_buf(p, outstr + sizeof(outstr) - p, "|",
+				personality_flags, pers, XLAT_STYLE_DEFAULT);
 	tcp->auxstr = outstr;
 	return RVAL_HEX | RVAL_STR;
 }
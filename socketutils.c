@@ -8,9 +8,11 @@
  */
 
 #include "defs.h"
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <asm/unistd.h>
 #include "netlink.h"
 #include <linux/sock_diag.h>
 #include <linux/inet_diag.h>
@@ -30,22 +32,116 @@
 #include "xlat/inet_protocols.h"
 #undef XLAT_MACROS_ONLY
 
-typedef struct {
+/*
+ * Details of the sockets that have been looked up, most recently used
+ * first.  The entries are found by inode through hash chains.
+ */
+struct cache_entry {
 	unsigned long inode;
 	char *details;
-} cache_entry;
+	struct cache_entry *chain;
+	struct cache_entry *newer;
+	struct cache_entry *older;
+};
 
 #define CACHE_SIZE 1024U
-static cache_entry cache[CACHE_SIZE];
 #define CACHE_MASK (CACHE_SIZE - 1)
+static struct cache_entry cache[CACHE_SIZE];
+static struct cache_entry *cache_buckets[CACHE_SIZE];
+static struct cache_entry *cache_newest;
+static struct cache_entry *cache_oldest;
+static struct cache_entry *cache_free;
+static unsigned int cache_used;
+
+static struct {
+	unsigned long hits;
+	unsigned long exact_queries;
+	unsigned long dumps;
+} sock_diag_stats;
+
+static struct cache_entry **
+cache_find(const unsigned long inode)
+{
+	struct cache_entry **p = &cache_buckets[inode & CACHE_MASK];
+
+	for (; *p; p = &(*p)->chain) {
+		if ((*p)->inode == inode)
+			break;
+	}
+
+	return p;
+}
+
+static void
+cache_unlink(struct cache_entry *const e)
+{
+	if (e->newer)
+		e->newer->older = e->older;
+	else
+		cache_newest = e->older;
+
+	if (e->older)
+		e->older->newer = e->newer;
+	else
+		cache_oldest = e->newer;
+}
+
+static void
+cache_link(struct cache_entry *const e)
+{
+	e->newer = NULL;
+	e->older = cache_newest;
+	if (cache_newest)
+		cache_newest->newer = e;
+	else
+		cache_oldest = e;
+	cache_newest = e;
+}
+
+static void
+cache_remove(struct cache_entry **const p)
+{
+	struct cache_entry *const e = *p;
+
+	*p = e->chain;
+	cache_unlink(e);
+	free(e->details);
+	e->details = NULL;
+	e->chain = cache_free;
+	cache_free = e;
+}
 
 static int
 cache_inode_details(const unsigned long inode, char *const details)
 {
-	cache_entry *e = &cache[inode & CACHE_MASK];
-	free(e->details);
+	struct cache_entry **p = cache_find(inode);
+	struct cache_entry *e = *p;
+
+	if (e) {
+		free(e->details);
+		e->details = details;
+		cache_unlink(e);
+		cache_link(e);
+		return 1;
+	}
+
+	if (cache_free) {
+		e = cache_free;
+		cache_free = e->chain;
+	} else if (cache_used < CACHE_SIZE) {
+		e = &cache[cache_used++];
+	} else {
+		cache_remove(cache_find(cache_oldest->inode));
+		e = cache_free;
+		cache_free = e->chain;
+		p = cache_find(inode);
+	}
+
 	e->inode = inode;
 	e->details = details;
+	e->chain = NULL;
+	*p = e;
+	cache_link(e);
 
 	return 1;
 }
@@ -53,8 +149,17 @@ cache_inode_details(const unsigned long inode, char *const details)
 static const char *
 get_sockaddr_by_inode_cached(const unsigned long inode)
 {
-	const cache_entry *const e = &cache[inode & CACHE_MASK];
-	return (e && inode == e->inode) ? e->details : NULL;
+	struct cache_entry *const e = *cache_find(inode);
+
+	if (!e)
+		return NULL;
+
+	if (e != cache_newest) {
+		cache_unlink(e);
+		cache_link(e);
+	}
+
+	return e->details;
 }
 
 static bool
@@ -62,12 +167,123 @@ print_sockaddr_by_inode_cached(const unsigned long inode)
 {
 	const char *const details = get_sockaddr_by_inode_cached(inode);
 	if (details) {
+		++sock_diag_stats.hits;
 		tprints(details);
 		return true;
 	}
 	return false;
 }
 
+/* Forget the details of the socket, e.g. when it is closed.  */
+void
+invalidate_sockaddr_by_inode(const unsigned long inode)
+{
+	struct cache_entry **const p = cache_find(inode);
+
+	if (*p)
+		cache_remove(p);
+}
+
+void
+print_sockaddr_stats(void)
+{
+	debug_msg("socket details: %lu hits, %lu exact queries, %lu dumps",
+		  sock_diag_stats.hits, sock_diag_stats.exact_queries,
+		  sock_diag_stats.dumps);
+}
+
+/*
+ * The NETLINK_SOCK_DIAG socket is kept open between the lookups.
+ * If a dump is not read till the end, the rest of it would be received
+ * as a response to the next query, so the socket is reopened instead.
+ */
+static int sock_diag_fd = -1;
+static bool sock_diag_pending;
+
+static int
+get_sock_diag_fd(void)
+{
+	if (sock_diag_fd < 0) {
+		sock_diag_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+				      NETLINK_SOCK_DIAG);
+		sock_diag_pending = false;
+	}
+
+	return sock_diag_fd;
+}
+
+static void
+release_sock_diag_fd(void)
+{
+	if (sock_diag_pending) {
+		close(sock_diag_fd);
+		sock_diag_fd = -1;
+		sock_diag_pending = false;
+	}
+}
+
+#if defined __NR_pidfd_open && defined __NR_pidfd_getfd
+# ifndef PIDFD_THREAD
+#  define PIDFD_THREAD O_EXCL
+# endif
+
+/*
+ * Return a duplicate of descriptor fd of tcp, or -1 if it cannot be
+ * obtained.  It allows looking up the socket by its addresses instead
+ * of dumping all the sockets of the family.
+ */
+static int
+dup_tracee_fd(struct tcb *const tcp, const int fd)
+{
+	static bool pidfd_getfd_not_supported;
+	static bool pidfd_thread_not_supported;
+
+	if (pidfd_getfd_not_supported)
+		return -1;
+
+	int pidfd = syscall(__NR_pidfd_open, tcp->pid, 0);
+	/* Threads other than the thread group leader need PIDFD_THREAD.  */
+	if (pidfd < 0 && errno == EINVAL && !pidfd_thread_not_supported) {
+		pidfd = syscall(__NR_pidfd_open, tcp->pid, PIDFD_THREAD);
+		if (pidfd < 0 && errno == EINVAL)
+			pidfd_thread_not_supported = true;
+	}
+
+	int rc = -1;
+
+	if (pidfd >= 0) {
+		rc = syscall(__NR_pidfd_getfd, pidfd, fd, 0);
+		const int saved_errno = errno;
+		close(pidfd);
+		errno = saved_errno;
+	}
+
+	if (rc < 0) {
+		switch (errno) {
+		case ENOSYS:
+			debug_func_perror_msg("pidfd_getfd");
+			pidfd_getfd_not_supported = true;
+			break;
+		case EPERM:
+			/*
+			 * Denied for this tracee only, e.g. by an LSM,
+			 * or because it has changed its credentials.
+			 */
+			debug_func_perror_msg("pidfd_getfd: pid %d", tcp->pid);
+			break;
+		}
+	}
+
+	return rc;
+}
+#else
+static int
+dup_tracee_fd(struct tcb *const tcp, const int fd)
+{
+	return -1;
+}
+#endif
+
 static bool
 send_query(struct tcb *tcp, const int fd, void *req, size_t req_size)
 {
@@ -91,6 +307,8 @@ send_query(struct tcb *tcp, const int fd, void *req, size_t req_size)
 				continue;
 			return false;
 		}
+		if (((const struct nlmsghdr *) req)->nlmsg_flags & NLM_F_DUMP)
+			sock_diag_pending = true;
 		return true;
 	}
 }
@@ -117,6 +335,103 @@ inet_send_query(struct tcb *tcp, const int fd, const int family,
 	return send_query(tcp, fd, &req, sizeof(req));
 }
 
+/*
+ * The kernel can find sockets of these protocols by their addresses
+ * without dumping all sockets of the family.
+ */
+static bool
+inet_has_exact_lookup(const int proto)
+{
+	switch (proto) {
+	case IPPROTO_DCCP:
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Fill id with the local and remote addresses of descriptor tracee_fd
+ * of tcp, as expected by the exact lookup of protocol proto.
+ */
+static bool
+inet_get_sockid(struct tcb *tcp, const int tracee_fd, const int family,
+		const int proto, struct inet_diag_sockid *const id)
+{
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} local, peer;
+	socklen_t local_len = sizeof(local);
+	socklen_t peer_len = sizeof(peer);
+
+	const int fd = dup_tracee_fd(tcp, tracee_fd);
+	if (fd < 0)
+		return false;
+
+	const bool ok = !getsockname(fd, &local.sa, &local_len)
+			&& local.sa.sa_family == family;
+	if (ok && (getpeername(fd, &peer.sa, &peer_len)
+		   || peer.sa.sa_family != family))
+		memset(&peer, 0, sizeof(peer));
+	close(fd);
+	if (!ok)
+		return false;
+
+	memset(id, 0, sizeof(*id));
+	id->idiag_cookie[0] = id->idiag_cookie[1] = ~0U;
+
+	/* The addresses of UDP sockets are swapped for historical reasons.  */
+	const bool swap = proto == IPPROTO_UDP || proto == IPPROTO_UDPLITE;
+	__be16 *const lport = swap ? &id->idiag_dport : &id->idiag_sport;
+	__be16 *const rport = swap ? &id->idiag_sport : &id->idiag_dport;
+	__be32 *const laddr = swap ? id->idiag_dst : id->idiag_src;
+	__be32 *const raddr = swap ? id->idiag_src : id->idiag_dst;
+
+	if (family == AF_INET) {
+		*lport = local.sin.sin_port;
+		*rport = peer.sin.sin_port;
+		memcpy(laddr, &local.sin.sin_addr, sizeof(local.sin.sin_addr));
+		memcpy(raddr, &peer.sin.sin_addr, sizeof(peer.sin.sin_addr));
+	} else {
+		*lport = local.sin6.sin6_port;
+		*rport = peer.sin6.sin6_port;
+		memcpy(laddr, &local.sin6.sin6_addr,
+		       sizeof(local.sin6.sin6_addr));
+		memcpy(raddr, &peer.sin6.sin6_addr,
+		       sizeof(peer.sin6.sin6_addr));
+	}
+
+	return true;
+}
+
+static bool
+inet_send_exact_query(struct tcb *tcp, const int fd, const int family,
+		      const int proto, const struct inet_diag_sockid *const id)
+{
+	struct {
+		const struct nlmsghdr nlh;
+		const struct inet_diag_req_v2 idr;
+	} req = {
+		.nlh = {
+			.nlmsg_len = sizeof(req),
+			.nlmsg_type = SOCK_DIAG_BY_FAMILY,
+			.nlmsg_flags = NLM_F_REQUEST
+		},
+		.idr = {
+			.sdiag_family = family,
+			.sdiag_protocol = proto,
+			.idiag_states = -1,
+			.id = *id
+		}
+	};
+	return send_query(tcp, fd, &req, sizeof(req));
+}
+
 static int
 inet_parse_response(const void *const data, const int data_len,
 		    const unsigned long inode, void *opaque_data)
@@ -218,8 +533,12 @@ receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 		if (!is_nlmsg_ok(h, ret))
 			return false;
 		for (; is_nlmsg_ok(h, ret); h = NLMSG_NEXT(h, ret)) {
-			if (h->nlmsg_type != expected_msg_type)
+			if (h->nlmsg_type != expected_msg_type) {
+				if (h->nlmsg_type == NLMSG_DONE
+				    || h->nlmsg_type == NLMSG_ERROR)
+					sock_diag_pending = false;
 				return false;
+			}
 			const int rc = parser(NLMSG_DATA(h),
 					      h->nlmsg_len, inode, opaque_data);
 			if (rc > 0)
@@ -340,7 +659,7 @@ unix_parse_response(const void *data, const int data_len,
 }
 
 static bool
-netlink_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
+netlink_send_query(struct tcb *tcp, const int fd, const int protocol)
 {
 	struct {
 		const struct nlmsghdr nlh;
@@ -353,7 +672,7 @@ netlink_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 		},
 		.ndr = {
 			.sdiag_family = AF_NETLINK,
-			.sdiag_protocol = NDIAG_PROTO_ALL
+			.sdiag_protocol = protocol
 		}
 	};
 	return send_query(tcp, fd, &req, sizeof(req));
@@ -394,9 +713,10 @@ netlink_parse_response(const void *data, const int data_len,
 }
 
 static const char *
-unix_get(struct tcb *tcp, const int fd, const int family, const int proto,
-	 const unsigned long inode, const char *name)
+unix_get(struct tcb *tcp, const int fd, const int tracee_fd, const int family,
+	 const int proto, const unsigned long inode, const char *name)
 {
+	++sock_diag_stats.exact_queries;
 	return unix_send_query(tcp, fd, inode)
 		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
 				     unix_parse_response, (void *) name)
@@ -404,20 +724,63 @@ unix_get(struct tcb *tcp, const int fd, const int family, const int proto,
 }
 
 static const char *
-inet_get(struct tcb *tcp, const int fd, const int family, const int protocol,
-	 const unsigned long inode, const char *proto_name)
+inet_get(struct tcb *tcp, const int fd, const int tracee_fd, const int family,
+	 const int protocol, const unsigned long inode,
+	 const char *proto_name)
 {
+	struct inet_diag_sockid id;
+
+	if (inet_has_exact_lookup(protocol)
+	    && inet_get_sockid(tcp, tracee_fd, family, protocol, &id)) {
+		/* Unbound sockets are not hashed and cannot be found.  */
+		if (!id.idiag_sport && !id.idiag_dport)
+			return NULL;
+
+		++sock_diag_stats.exact_queries;
+		if (inet_send_exact_query(tcp, fd, family, protocol, &id)
+		    && receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
+					 inet_parse_response,
+					 (void *) proto_name))
+			return get_sockaddr_by_inode_cached(inode);
+	}
+
+	++sock_diag_stats.dumps;
 	return inet_send_query(tcp, fd, family, protocol)
 		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
 				     inet_parse_response, (void *) proto_name)
 		? get_sockaddr_by_inode_cached(inode) : NULL;
 }
 
+/*
+ * Return the netlink protocol of descriptor tracee_fd of tcp,
+ * NDIAG_PROTO_ALL if it is not known.
+ */
+static int
+netlink_get_protocol(struct tcb *tcp, const int tracee_fd)
+{
+	int protocol = NDIAG_PROTO_ALL;
+#ifdef SO_PROTOCOL
+	const int fd = dup_tracee_fd(tcp, tracee_fd);
+
+	if (fd >= 0) {
+		socklen_t len = sizeof(protocol);
+
+		if (getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len))
+			protocol = NDIAG_PROTO_ALL;
+		close(fd);
+	}
+#endif
+	return protocol;
+}
+
 static const char *
-netlink_get(struct tcb *tcp, const int fd, const int family, const int protocol,
-	    const unsigned long inode, const char *proto_name)
+netlink_get(struct tcb *tcp, const int fd, const int tracee_fd,
+	    const int family, const int protocol, const unsigned long inode,
+	    const char *proto_name)
 {
-	return netlink_send_query(tcp, fd, inode)
+	++sock_diag_stats.dumps;
+	return netlink_send_query(tcp, fd,
+				  netlink_get_protocol(tcp, tracee_fd))
 		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
 				     netlink_parse_response,
 				     (void *) proto_name)
@@ -426,9 +789,9 @@ netlink_get(struct tcb *tcp, const int fd, const int family, const int protocol,
 
 static const struct {
 	const char *const name;
-	const char * (*const get)(struct tcb *, int fd, int family,
-				  int protocol, unsigned long inode,
-				  const char *proto_name);
+	const char * (*const get)(struct tcb *, int fd, int tracee_fd,
+				  int family, int protocol,
+				  unsigned long inode, const char *proto_name);
 	int family;
 	int proto;
 } protocols[] = {
@@ -495,20 +858,22 @@ get_family_by_proto(enum sock_proto proto)
 }
 
 static const char *
-get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
+get_sockaddr_by_inode_uncached(struct tcb *tcp, const int tracee_fd,
+			       const unsigned long inode,
 			       const enum sock_proto proto)
 {
 	if ((unsigned int) proto >= ARRAY_SIZE(protocols) ||
 	    (proto != SOCK_PROTO_UNKNOWN && !protocols[proto].get))
 		return NULL;
 
-	const int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
+	const int fd = get_sock_diag_fd();
 	if (fd < 0)
 		return NULL;
 	const char *details = NULL;
 
 	if (proto != SOCK_PROTO_UNKNOWN) {
-		details = protocols[proto].get(tcp, fd, protocols[proto].family,
+		details = protocols[proto].get(tcp, fd, tracee_fd,
+					       protocols[proto].family,
 					       protocols[proto].proto, inode,
 					       protocols[proto].name);
 	} else {
@@ -517,7 +882,7 @@ get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 		     i < ARRAY_SIZE(protocols); ++i) {
 			if (!protocols[i].get)
 				continue;
-			details = protocols[i].get(tcp, fd,
+			details = protocols[i].get(tcp, fd, tracee_fd,
 						   protocols[proto].family,
 						   protocols[proto].proto,
 						   inode,
@@ -527,15 +892,17 @@ get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 		}
 	}
 
-	close(fd);
+	release_sock_diag_fd();
 	return details;
 }
 
 static bool
-print_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
+print_sockaddr_by_inode_uncached(struct tcb *tcp, const int tracee_fd,
+				 const unsigned long inode,
 				 const enum sock_proto proto)
 {
-	const char *details = get_sockaddr_by_inode_uncached(tcp, inode, proto);
+	const char *details =
+		get_sockaddr_by_inode_uncached(tcp, tracee_fd, inode, proto);
 
 	if (details) {
 		tprints(details);
@@ -557,8 +924,14 @@ get_sockaddr_by_inode(struct tcb *const tcp, const int fd,
 		      const unsigned long inode)
 {
 	const char *details = get_sockaddr_by_inode_cached(inode);
-	return details ? details :
-		get_sockaddr_by_inode_uncached(tcp, inode, getfdproto(tcp, fd));
+
+	if (details) {
+		++sock_diag_stats.hits;
+		return details;
+	}
+
+	return get_sockaddr_by_inode_uncached(tcp, fd, inode,
+					      getfdproto(tcp, fd));
 }
 
 /* Given an inode number of a socket, print out its protocol details.  */
@@ -567,7 +940,7 @@ print_sockaddr_by_inode(struct tcb *const tcp, const int fd,
 			const unsigned long inode)
 {
 	return print_sockaddr_by_inode_cached(inode) ? true :
-		print_sockaddr_by_inode_uncached(tcp, inode,
+		print_sockaddr_by_inode_uncached(tcp, fd, inode,
 						 getfdproto(tcp, fd));
 }
 
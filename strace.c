@@ -13,6 +13,7 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include "ptrace.h"
 #include <signal.h>
 #include <sys/resource.h>
@@ -39,7 +40,10 @@
 #include "printsiginfo.h"
 #include "trace_event.h"
 #include "xstring.h"
+#include "bintrace.h"
 #include "delay.h"
+#include "fdtab.h"
+#include "filter_seccomp.h"
 #include "wait.h"
 
 /* In some libc, these aren't declared. Do it ourself: */
@@ -50,6 +54,8 @@ extern char *optarg;
 #ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 bool stack_trace_enabled;
+bool stack_trace_frame_pointers;
+bool stack_profile_enabled;
 #endif
 
 #define my_tkill(tid, sig) syscall(__NR_tkill, (tid), (sig))
@@ -151,6 +157,15 @@ static struct tcb **tcbtab;
 static unsigned int nprocs;
 static size_t tcbtabsize;
 
+/*
+ * Index of active tcbs by pid: a table of pid_hash_size (a power of 2)
+ * chains linked through tcb->pid_hash_next.  Free tcbs are linked
+ * through the same field into the free_tcbs list.
+ */
+static struct tcb **pid_hash;
+static size_t pid_hash_size;
+static struct tcb *free_tcbs;
+
 static struct tcb_wait_data *tcb_wait_tab;
 static size_t tcb_wait_tab_size;
 
@@ -239,6 +254,8 @@ usage: strace [-CdffhiqrtttTvVwxxy] [-I n] [-e expr]...\n\
               -p pid... / [-D] [-E var=val]... [-u username] PROG [ARGS]\n\
    or: strace -c[dfw] [-I n] [-e expr]... [-O overhead] [-S sortby]\n\
               -p pid... / [-D] [-E var=val]... [-u username] PROG [ARGS]\n\
+   or: strace --render=FILE [-rtttTvxxy] [-e expr]... [-a column] [-o file]\n\
+              [-s strsize]\n\
 \n\
 Output format:\n\
   -a column      alignment COLUMN for printing syscall results (default %d)\n\
@@ -247,10 +264,20 @@ Output format:\n\
 #ifdef ENABLE_STACKTRACE
 "\
   -k             obtain stack trace between each syscall\n\
+  --stack-trace[=dwarf|fp]\n\
+                 same as -k, fp walks frame pointer chains and unwinds\n\
+                 with DWARF only when a chain looks broken\n\
+  --stack-profile[=folded|table[:N]]\n\
+                 count the calls and the time of syscalls per stack trace,\n\
+                 print folded stacks or the top N stacks (default 20) at exit\n\
 "
 #endif
 "\
   -o file        send trace output to FILE instead of stderr\n\
+  --output-flush=line|syscall|size:N|interval:MS\n\
+                 flush the output after each line, after each syscall,\n\
+                 when N bytes are buffered, or MS milliseconds after\n\
+                 it is written (default: line)\n\
   -q             suppress messages about attaching, detaching, etc.\n\
   -r             print relative timestamp\n\
   -s strsize     limit length of print strings to STRSIZE chars (default %d)\n\
@@ -260,15 +287,36 @@ Output format:\n\
   -x             print non-ascii strings in hex\n\
   -xx            print all strings in hex\n\
   -X format      set the format for printing of named constants and flags\n\
+  --format=binary\n\
+                 write binary records to the -o FILE instead of text\n\
+  --format=pipelined\n\
+                 record syscalls while tracees are stopped and print them\n\
+                 as text in a separate formatter process\n\
+  --render=FILE  print the binary trace FILE as text and exit\n\
   -y             print paths associated with file descriptor arguments\n\
   -yy            print protocol specific information associated with socket file descriptors\n\
 \n\
 Statistics:\n\
   -c             count time, calls, and errors for each syscall and report summary\n\
   -C             like -c but also print regular output\n\
-  -O overhead    set overhead for tracing syscalls to OVERHEAD usecs\n\
-  -S sortby      sort syscall counts by: time, calls, name, nothing (default %s)\n\
+  -O overhead    set overhead for tracing syscalls to OVERHEAD usecs,\n\
+                 or measure it at startup if OVERHEAD is auto\n\
+  -S sortby      sort syscall counts by: time, calls, name, p99, nothing\n\
+                 (default %s)\n\
   -w             summarise syscall latency (default is system time)\n\
+  --summary-latency\n\
+                 report latency percentiles and histograms of syscalls\n\
+  --summary-by=tid|tgid|comm\n\
+                 also report syscall counts of every thread, process,\n\
+                 or command name\n\
+  --summary-top=N\n\
+                 report the N busiest groups of --summary-by (default 10)\n\
+  --summary-interval=N\n\
+                 also report statistics of every N seconds of tracing\n\
+  --summary-format=table|json\n\
+                 format of --summary-interval reports (default table)\n\
+  --summary-overhead\n\
+                 print the overhead subtracted from syscall times\n\
 \n\
 Filtering:\n\
   -e expr        a qualifying expression: option=[!]all or option=[!]val1[,val2]...\n\
@@ -280,6 +328,7 @@ Tracing:\n\
   -D             run tracer process as a detached grandchild, not as parent\n\
   -f             follow forks\n\
   -ff            follow forks with output into separate files\n\
+  --seccomp-bpf  enable seccomp-bpf filtering (requires -f)\n\
   -I interruptible\n\
      1:          no signals are blocked\n\
      2:          fatal signals are blocked while decoding syscall (default)\n\
@@ -366,6 +415,7 @@ ptrace_restart(const unsigned int op, struct tcb *const tcp, unsigned int sig)
 {
 	int err;
 
+	invalidate_umove_cache();
 	errno = 0;
 	ptrace(op, tcp->pid, 0L, (unsigned long) sig);
 	err = errno;
@@ -493,6 +543,64 @@ strace_popen(const char *command)
 	return fp;
 }
 
+/*
+ * With --format=pipelined, the syscalls are recorded as binary trace
+ * records while the tracees are stopped, and a formatter process renders
+ * them as text from the other end of a pipe, see bintrace_render.
+ */
+static bool pipelined_output;
+static int formatter_pid;
+
+/*
+ * Start the formatter writing the text to OUT,
+ * return the stream to write the records to.
+ */
+static FILE *
+start_formatter(FILE *const out)
+{
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		perror_msg_and_die("pipe");
+
+	set_cloexec_flag(fds[1]); /* never fails */
+
+	fflush(NULL);
+	const int pid = fork();
+	if (pid < 0)
+		perror_msg_and_die("fork");
+
+	if (pid == 0) {
+		/* child */
+		close(fds[1]);
+		if (fds[0] != 0) {
+			if (dup2(fds[0], 0))
+				perror_msg_and_die("dup2");
+			close(fds[0]);
+		}
+		/*
+		 * The formatter exits when strace closes the pipe,
+		 * after the records written before are rendered.
+		 */
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGINT, SIG_IGN);
+		signal(SIGQUIT, SIG_IGN);
+		signal(SIGTERM, SIG_IGN);
+		setvbuf(out, NULL, _IOLBF, 0);
+		exit(bintrace_render("-", out));
+	}
+
+	/* parent */
+	formatter_pid = pid;
+	close(fds[0]);
+	if (out != stderr)
+		fclose(out);
+	FILE *const fp = fdopen(fds[1], "w");
+	if (!fp)
+		perror_msg_and_die("fdopen");
+	return fp;
+}
+
 static void
 outf_perror(const struct tcb * const tcp)
 {
@@ -568,13 +676,257 @@ tprintf_comment(const char *fmt, ...)
 	va_end(args);
 }
 
+/*
+ * The policy of flushing the trace output set by --output-flush:
+ *
+ * line: the output is flushed as soon as a line or a part of a line
+ *	that is not going to be finished before the next event is printed,
+ *	the default;
+ * syscall: the output is flushed when the tracer is about to wait
+ *	for the next event, so that tracees are restarted before the log
+ *	is written out;
+ * size: the output is flushed when its buffer of the given size is full;
+ * interval: the output is flushed when its buffer is full, and
+ *	at most the given number of milliseconds after it has been written.
+ *
+ * Every output has its own buffer, which is shared by all tracees
+ * writing to it, so the order of lines, e.g. of an <unfinished ...>
+ * syscall and of its <... resumed> part, is kept by any policy.
+ */
+static enum {
+	OUTPUT_FLUSH_LINE,
+	OUTPUT_FLUSH_SYSCALL,
+	OUTPUT_FLUSH_SIZE,
+	OUTPUT_FLUSH_INTERVAL,
+} output_flush;
+static size_t output_buffer_size;
+static unsigned int output_flush_interval;
+
+#define DEFAULT_OUTPUT_BUFFER_SIZE	65536
+
+static struct tcb *deferred_flush_tcp;
+
+static bool output_flush_pending;
+static struct timespec output_flush_deadline;
+static timer_t output_flush_timer;
+static bool output_flush_timer_is_created;
+static bool output_flush_timer_is_armed;
+static volatile sig_atomic_t output_flush_timer_fired;
+
 static void
-flush_tcp_output(const struct tcb *const tcp)
+set_output_flush(const char *const arg)
+{
+	const char *val;
+	int i;
+
+	if (!strcmp(arg, "line")) {
+		output_flush = OUTPUT_FLUSH_LINE;
+	} else if (!strcmp(arg, "syscall")) {
+		output_flush = OUTPUT_FLUSH_SYSCALL;
+	} else if ((val = STR_STRIP_PREFIX(arg, "size:")) != arg) {
+		i = string_to_uint(val);
+		if (i <= 0)
+			error_msg_and_help("invalid --output-flush argument:"
+					   " '%s'", arg);
+		output_flush = OUTPUT_FLUSH_SIZE;
+		output_buffer_size = i;
+	} else if ((val = STR_STRIP_PREFIX(arg, "interval:")) != arg) {
+		i = string_to_uint(val);
+		if (i <= 0)
+			error_msg_and_help("invalid --output-flush argument:"
+					   " '%s'", arg);
+		output_flush = OUTPUT_FLUSH_INTERVAL;
+		output_flush_interval = i;
+	} else {
+		error_msg_and_help("invalid --output-flush argument: '%s'",
+				   arg);
+	}
+}
+
+/*
+ * Buffers of output streams, the size of a buffer allocated by stdio
+ * cannot be chosen.
+ */
+struct output_buffer {
+	struct output_buffer *next;
+	FILE *fp;
+	char data[];
+};
+
+static struct output_buffer *output_buffers;
+
+/* Set up the buffer of an output stream for the flush policy.  */
+static void
+setup_output_buffer(FILE *const fp)
+{
+	switch (output_flush) {
+	case OUTPUT_FLUSH_LINE:
+		setvbuf(fp, NULL, _IOLBF, 0);
+		break;
+	case OUTPUT_FLUSH_SIZE:
+	case OUTPUT_FLUSH_INTERVAL: {
+		const size_t size = output_buffer_size
+				    ? output_buffer_size
+				    : DEFAULT_OUTPUT_BUFFER_SIZE;
+		struct output_buffer *const b = xmalloc(sizeof(*b) + size);
+
+		b->fp = fp;
+		b->next = output_buffers;
+		output_buffers = b;
+		setvbuf(fp, b->data, _IOFBF, size);
+		break;
+	}
+	default:
+		setvbuf(fp, NULL, _IOFBF, BUFSIZ);
+		break;
+	}
+}
+
+/* Close an output stream and free its buffer.  */
+static void
+close_output(FILE *const fp)
+{
+	fclose(fp);
+
+	for (struct output_buffer **p = &output_buffers; *p; p = &(*p)->next) {
+		if ((*p)->fp == fp) {
+			struct output_buffer *const b = *p;
+
+			*p = b->next;
+			free(b);
+			break;
+		}
+	}
+}
+
+static void
+flush_tcp_output_now(const struct tcb *const tcp)
 {
 	if (fflush(tcp->outf))
 		outf_perror(tcp);
 }
 
+static void
+flush_deferred_output(void)
+{
+	if (deferred_flush_tcp) {
+		flush_tcp_output_now(deferred_flush_tcp);
+		deferred_flush_tcp = NULL;
+	}
+}
+
+/* Write out the buffers of all outputs.  */
+static void
+flush_all_output(void)
+{
+	deferred_flush_tcp = NULL;
+	output_flush_pending = false;
+
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		struct tcb *tcp = tcbtab[i];
+
+		if (tcp->pid && tcp->outf && tcp->outf != shared_log)
+			flush_tcp_output_now(tcp);
+	}
+
+	if (shared_log && fflush(shared_log)) {
+		if (outfname)
+			perror_msg("%s", outfname);
+		else
+			perror_msg("stderr");
+	}
+}
+
+void
+flush_tcp_output(struct tcb *const tcp)
+{
+	switch (output_flush) {
+	case OUTPUT_FLUSH_LINE:
+		flush_tcp_output_now(tcp);
+		break;
+	case OUTPUT_FLUSH_SYSCALL:
+		if (deferred_flush_tcp && deferred_flush_tcp->outf != tcp->outf)
+			flush_deferred_output();
+		deferred_flush_tcp = tcp;
+		break;
+	case OUTPUT_FLUSH_INTERVAL:
+		if (!output_flush_pending) {
+			clock_gettime(CLOCK_MONOTONIC, &output_flush_deadline);
+			ts_add(&output_flush_deadline, &output_flush_deadline,
+			       &(struct timespec) {
+					.tv_sec = output_flush_interval / 1000,
+					.tv_nsec = output_flush_interval % 1000
+						   * 1000000 });
+			output_flush_pending = true;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Called from the SIGALRM handler, which is shared with the delay
+ * timer and the summary timer.
+ */
+static void
+output_flush_timer_expired(void)
+{
+	if (output_flush_timer_is_armed) {
+		output_flush_timer_is_armed = false;
+		output_flush_timer_fired = 1;
+	}
+}
+
+/*
+ * Write out the output that is due before the tracer waits
+ * for the next event, arm the timer of the output that is not due yet.
+ */
+static void
+flush_output_before_wait(void)
+{
+	flush_deferred_output();
+
+	if (!output_flush_pending)
+		return;
+
+	struct timespec ts_now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_now);
+	if (output_flush_timer_fired
+	    || ts_cmp(&ts_now, &output_flush_deadline) >= 0) {
+		output_flush_timer_fired = 0;
+		flush_all_output();
+		return;
+	}
+
+	if (output_flush_timer_is_armed)
+		return;
+
+	if (!output_flush_timer_is_created) {
+		if (timer_create(CLOCK_MONOTONIC, NULL, &output_flush_timer))
+			perror_msg_and_die("timer_create");
+		output_flush_timer_is_created = true;
+	}
+
+	const struct itimerspec its = { .it_value = output_flush_deadline };
+
+	if (timer_settime(output_flush_timer, TIMER_ABSTIME, &its, NULL))
+		perror_msg_and_die("timer_settime");
+	output_flush_timer_is_armed = true;
+}
+
+/* Write out the output whose timer has expired while waiting.  */
+static void
+flush_output_after_wait(void)
+{
+	if (output_flush_timer_fired) {
+		output_flush_timer_fired = 0;
+		if (output_flush_pending)
+			flush_all_output();
+	}
+}
+
 void
 line_ended(void)
 {
@@ -598,6 +950,46 @@ set_current_tcp(const struct tcb *tcp)
 		set_personality(current_tcp->currpers);
 }
 
+static void
+print_timestamps(const struct timespec *ts, const struct timespec *rts)
+{
+	if (tflag) {
+		if (tflag > 2) {
+			tprintf("%lld.%06ld ",
+				(long long) ts->tv_sec, (long) ts->tv_nsec / 1000);
+		} else {
+			time_t local = ts->tv_sec;
+			char str[MAX(sizeof("HH:MM:SS"), sizeof(ts->tv_sec) * 3)];
+			struct tm *tm = localtime(&local);
+
+			if (tm)
+				strftime(str, sizeof(str), "%T", tm);
+			else
+				xsprintf(str, "%lld", (long long) local);
+			if (tflag > 1)
+				tprintf("%s.%06ld ",
+					str, (long) ts->tv_nsec / 1000);
+			else
+				tprintf("%s ", str);
+		}
+	}
+
+	if (rflag) {
+		static struct timespec ots;
+		if (ots.tv_sec == 0)
+			ots = *rts;
+
+		struct timespec dts;
+		ts_sub(&dts, rts, &ots);
+		ots = *rts;
+
+		tprintf("%s%6ld.%06ld%s ",
+			tflag ? "(+" : "",
+			(long) dts.tv_sec, (long) dts.tv_nsec / 1000,
+			tflag ? ")" : "");
+	}
+}
+
 void
 printleader(struct tcb *tcp)
 {
@@ -630,50 +1022,33 @@ printleader(struct tcb *tcp)
 	else if (nprocs > 1 && !outfname)
 		tprintf("[pid %5u] ", tcp->pid);
 
-	if (tflag) {
-		struct timespec ts;
+	struct timespec ts = { 0 }, rts = { 0 };
+	if (tflag)
 		clock_gettime(CLOCK_REALTIME, &ts);
+	if (rflag)
+		clock_gettime(CLOCK_MONOTONIC, &rts);
+	print_timestamps(&ts, &rts);
 
-		if (tflag > 2) {
-			tprintf("%lld.%06ld ",
-				(long long) ts.tv_sec, (long) ts.tv_nsec / 1000);
-		} else {
-			time_t local = ts.tv_sec;
-			char str[MAX(sizeof("HH:MM:SS"), sizeof(ts.tv_sec) * 3)];
-			struct tm *tm = localtime(&local);
-
-			if (tm)
-				strftime(str, sizeof(str), "%T", tm);
-			else
-				xsprintf(str, "%lld", (long long) local);
-			if (tflag > 1)
-				tprintf("%s.%06ld ",
-					str, (long) ts.tv_nsec / 1000);
-			else
-				tprintf("%s ", str);
-		}
-	}
-
-	if (rflag) {
-		struct timespec ts;
-		clock_gettime(CLOCK_MONOTONIC, &ts);
-
-		static struct timespec ots;
-		if (ots.tv_sec == 0)
-			ots = ts;
+	if (iflag)
+		print_instruction_pointer(tcp);
+}
 
-		struct timespec dts;
-		ts_sub(&dts, &ts, &ots);
-		ots = ts;
+/*
+ * Start a line of a trace rendered from a binary trace record,
+ * see bintrace_render().
+ */
+void
+printleader_replay(struct tcb *tcp, const struct timespec *ts,
+		   const bool pid_prefix)
+{
+	printing_tcp = tcp;
+	set_current_tcp(tcp);
+	current_tcp->curcol = 0;
 
-		tprintf("%s%6ld.%06ld%s ",
-			tflag ? "(+" : "",
-			(long) dts.tv_sec, (long) dts.tv_nsec / 1000,
-			tflag ? ")" : "");
-	}
+	if (pid_prefix)
+		tprintf("%-5d ", tcp->pid);
 
-	if (iflag)
-		print_instruction_pointer(tcp);
+	print_timestamps(ts, ts);
 }
 
 void
@@ -696,6 +1071,9 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 		char name[PATH_MAX];
 		xsprintf(name, "%s.%u", outfname, tcp->pid);
 		tcp->outf = strace_fopen(name);
+		setup_output_buffer(tcp->outf);
+		if (binary_output)
+			bintrace_start(tcp->outf, false);
 	}
 
 #ifdef ENABLE_STACKTRACE
@@ -704,6 +1082,35 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 #endif
 }
 
+static struct tcb **
+pid_hash_bucket(const int pid)
+{
+	return &pid_hash[(unsigned int) pid & (pid_hash_size - 1)];
+}
+
+static void
+pid_hash_insert(struct tcb *const tcp)
+{
+	struct tcb **const bucket = pid_hash_bucket(tcp->pid);
+
+	tcp->pid_hash_next = *bucket;
+	*bucket = tcp;
+}
+
+static void
+pid_hash_remove(struct tcb *const tcp)
+{
+	for (struct tcb **ptcp = pid_hash_bucket(tcp->pid); *ptcp;
+	     ptcp = &(*ptcp)->pid_hash_next) {
+		if (*ptcp == tcp) {
+			*ptcp = tcp->pid_hash_next;
+			tcp->pid_hash_next = NULL;
+			return;
+		}
+	}
+	error_func_msg_and_die("tcb for pid %d is not found", tcp->pid);
+}
+
 static void
 expand_tcbtab(void)
 {
@@ -721,36 +1128,51 @@ expand_tcbtab(void)
 	tcbtab = xgrowarray(tcbtab, &tcbtabsize, sizeof(tcbtab[0]));
 	newtcbs = xcalloc(tcbtabsize - old_tcbtabsize, sizeof(newtcbs[0]));
 
-	for (tcb_ptr = tcbtab + old_tcbtabsize;
-	    tcb_ptr < tcbtab + tcbtabsize; tcb_ptr++, newtcbs++)
-		*tcb_ptr = newtcbs;
+	for (tcb_ptr = tcbtab + tcbtabsize - 1;
+	     tcb_ptr >= tcbtab + old_tcbtabsize; tcb_ptr--) {
+		*tcb_ptr = &newtcbs[tcb_ptr - tcbtab - old_tcbtabsize];
+		(*tcb_ptr)->pid_hash_next = free_tcbs;
+		free_tcbs = *tcb_ptr;
+	}
+
+	/* Keep the pid index at least as large as the table.  */
+	if (pid_hash_size >= tcbtabsize)
+		return;
+
+	free(pid_hash);
+	if (!pid_hash_size)
+		pid_hash_size = 1;
+	while (pid_hash_size < tcbtabsize)
+		pid_hash_size <<= 1;
+	pid_hash = xcalloc(pid_hash_size, sizeof(pid_hash[0]));
+
+	for (size_t i = 0; i < old_tcbtabsize; ++i) {
+		if (tcbtab[i]->pid)
+			pid_hash_insert(tcbtab[i]);
+	}
 }
 
 static struct tcb *
 alloctcb(int pid)
 {
-	unsigned int i;
 	struct tcb *tcp;
 
-	if (nprocs == tcbtabsize)
+	if (!free_tcbs)
 		expand_tcbtab();
 
-	for (i = 0; i < tcbtabsize; i++) {
-		tcp = tcbtab[i];
-		if (!tcp->pid) {
-			memset(tcp, 0, sizeof(*tcp));
-			list_init(&tcp->wait_list);
-			tcp->pid = pid;
+	tcp = free_tcbs;
+	free_tcbs = tcp->pid_hash_next;
+
+	memset(tcp, 0, sizeof(*tcp));
+	list_init(&tcp->wait_list);
+	tcp->pid = pid;
 #if SUPPORTED_PERSONALITIES > 1
-			tcp->currpers = current_personality;
+	tcp->currpers = current_personality;
 #endif
-			nprocs++;
-			debug_msg("new tcb for pid %d, active tcbs:%d",
-				  tcp->pid, nprocs);
-			return tcp;
-		}
-	}
-	error_msg_and_die("bug in alloctcb");
+	pid_hash_insert(tcp);
+	nprocs++;
+	debug_msg("new tcb for pid %d, active tcbs:%d", tcp->pid, nprocs);
+	return tcp;
 }
 
 void *
@@ -784,16 +1206,21 @@ free_tcb_priv_data(struct tcb *tcp)
 	}
 }
 
+struct tcb_cold *
+get_tcb_cold(struct tcb *const tcp)
+{
+	if (!tcp->cold)
+		tcp->cold = xcalloc(1, sizeof(*tcp->cold));
+
+	return tcp->cold;
+}
+
 static void
 droptcb(struct tcb *tcp)
 {
 	if (tcp->pid == 0)
 		return;
 
-	int p;
-	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p)
-		free(tcp->inject_vec[p]);
-
 	free_tcb_priv_data(tcp);
 
 #ifdef ENABLE_STACKTRACE
@@ -811,15 +1238,18 @@ droptcb(struct tcb *tcp)
 	nprocs--;
 	debug_msg("dropped tcb for pid %d, %d remain", tcp->pid, nprocs);
 
+	if (deferred_flush_tcp == tcp)
+		deferred_flush_tcp = NULL;
+
 	if (tcp->outf) {
 		if (followfork >= 2) {
 			if (tcp->curcol != 0)
 				fprintf(tcp->outf, " <detached ...>\n");
-			fclose(tcp->outf);
+			close_output(tcp->outf);
 		} else {
 			if (printing_tcp == tcp && tcp->curcol != 0)
 				fprintf(tcp->outf, " <detached ...>\n");
-			flush_tcp_output(tcp);
+			flush_tcp_output_now(tcp);
 		}
 	}
 
@@ -829,8 +1259,21 @@ droptcb(struct tcb *tcp)
 		printing_tcp = NULL;
 
 	list_remove(&tcp->wait_list);
+	pid_hash_remove(tcp);
+	invalidate_umove_cache();
+	reset_umove_method(tcp);
+	release_fdtab(tcp);
+	bintrace_release(tcp);
+
+	if (tcp->cold) {
+		for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p)
+			free(tcp->cold->inject_vec[p]);
+		free(tcp->cold);
+	}
 
 	memset(tcp, 0, sizeof(*tcp));
+	tcp->pid_hash_next = free_tcbs;
+	free_tcbs = tcp;
 }
 
 /* Detach traced process.
@@ -1205,6 +1648,9 @@ exec_or_die(void)
 	if (params_for_tracee.child_sa.sa_handler != SIG_DFL)
 		sigaction(SIGCHLD, &params_for_tracee.child_sa, NULL);
 
+	if (seccomp_filtering)
+		init_seccomp_filter();
+
 	execv(params->pathname, params->argv);
 	perror_msg_and_die("exec");
 }
@@ -1560,6 +2006,7 @@ init(int argc, char *argv[])
 {
 	int c, i;
 	int optF = 0;
+	bool summary_interval_given = false;
 
 	if (!program_invocation_name || !*program_invocation_name) {
 		static char name[] = "strace";
@@ -1581,11 +2028,46 @@ init(int argc, char *argv[])
 # error Bug in DEFAULT_QUAL_FLAGS
 #endif
 	qualify("signal=all");
-	while ((c = getopt(argc, argv, "+"
+
+	enum {
+		GETOPT_SECCOMP = 0x100,
+		GETOPT_FORMAT,
+		GETOPT_RENDER,
+		GETOPT_SUMMARY_LATENCY,
+		GETOPT_SUMMARY_BY,
+		GETOPT_SUMMARY_TOP,
+		GETOPT_SUMMARY_INTERVAL,
+		GETOPT_SUMMARY_FORMAT,
+		GETOPT_SUMMARY_OVERHEAD,
+		GETOPT_STACK_TRACE,
+		GETOPT_STACK_PROFILE,
+		GETOPT_OUTPUT_FLUSH,
+	};
+	static const struct option longopts[] = {
+		{ "seccomp-bpf", no_argument, 0, GETOPT_SECCOMP },
+		{ "format", required_argument, 0, GETOPT_FORMAT },
+		{ "render", required_argument, 0, GETOPT_RENDER },
+		{ "summary-latency", no_argument, 0, GETOPT_SUMMARY_LATENCY },
+		{ "summary-by", required_argument, 0, GETOPT_SUMMARY_BY },
+		{ "summary-top", required_argument, 0, GETOPT_SUMMARY_TOP },
+		{ "summary-interval", required_argument, 0, GETOPT_SUMMARY_INTERVAL },
+		{ "summary-format", required_argument, 0, GETOPT_SUMMARY_FORMAT },
+		{ "summary-overhead", no_argument, 0, GETOPT_SUMMARY_OVERHEAD },
+		{ "output-flush", required_argument, 0, GETOPT_OUTPUT_FLUSH },
+#ifdef ENABLE_STACKTRACE
+		{ "stack-trace", optional_argument, 0, GETOPT_STACK_TRACE },
+		{ "stack-profile", optional_argument, 0, GETOPT_STACK_PROFILE },
+#endif
+		{ 0, 0, 0, 0 }
+	};
+	const char *render_file = NULL;
+
+	while ((c = getopt_long(argc, argv, "+"
 #ifdef ENABLE_STACKTRACE
 	    "k"
 #endif
-	    "a:Ab:cCdDe:E:fFhiI:o:O:p:P:qrs:S:tTu:vVwxX:yz")) != EOF) {
+	    "a:Ab:cCdDe:E:fFhiI:o:O:p:P:qrs:S:tTu:vVwxX:yz",
+	    longopts, NULL)) != EOF) {
 		switch (c) {
 		case 'a':
 			acolumn = string_to_uint(optarg);
@@ -1647,11 +2129,30 @@ init(int argc, char *argv[])
 		case 'k':
 			stack_trace_enabled = true;
 			break;
+		case GETOPT_STACK_TRACE:
+			stack_trace_enabled = true;
+			if (!optarg || !strcmp(optarg, "dwarf"))
+				stack_trace_frame_pointers = false;
+			else if (!strcmp(optarg, "fp"))
+				stack_trace_frame_pointers = true;
+			else
+				error_msg_and_help("invalid --stack-trace argument:"
+						   " '%s'", optarg);
+			break;
+		case GETOPT_STACK_PROFILE:
+			stack_trace_enabled = true;
+			stack_profile_enabled = true;
+			set_stack_profile(optarg);
+			break;
 #endif
 		case 'o':
 			outfname = optarg;
 			break;
 		case 'O':
+			if (!strcmp(optarg, "auto")) {
+				set_overhead_auto();
+				break;
+			}
 			i = string_to_uint(optarg);
 			if (i < 0)
 				error_opt_arg(c, optarg);
@@ -1716,6 +2217,50 @@ init(int argc, char *argv[])
 		case 'z':
 			not_failing_only = 1;
 			break;
+		case GETOPT_SECCOMP:
+			seccomp_filtering = true;
+			break;
+		case GETOPT_FORMAT:
+			binary_output = !strcmp(optarg, "binary");
+			pipelined_output = !strcmp(optarg, "pipelined");
+			if (!binary_output && !pipelined_output
+			    && strcmp(optarg, "text"))
+				error_msg_and_help("invalid --format argument: '%s'",
+						   optarg);
+			break;
+		case GETOPT_RENDER:
+			render_file = optarg;
+			break;
+		case GETOPT_SUMMARY_LATENCY:
+			set_count_latency();
+			break;
+		case GETOPT_SUMMARY_BY:
+			set_count_group(optarg);
+			break;
+		case GETOPT_SUMMARY_TOP:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_msg_and_help("invalid --summary-top"
+						   " argument: '%s'", optarg);
+			set_count_group_top(i);
+			break;
+		case GETOPT_SUMMARY_INTERVAL:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_msg_and_help("invalid --summary-interval"
+						   " argument: '%s'", optarg);
+			set_summary_interval(i);
+			summary_interval_given = true;
+			break;
+		case GETOPT_SUMMARY_FORMAT:
+			set_summary_format(optarg);
+			break;
+		case GETOPT_SUMMARY_OVERHEAD:
+			set_print_overhead();
+			break;
+		case GETOPT_OUTPUT_FLUSH:
+			set_output_flush(optarg);
+			break;
 		default:
 			error_msg_and_help(NULL);
 			break;
@@ -1725,7 +2270,16 @@ init(int argc, char *argv[])
 	argv += optind;
 	argc -= optind;
 
-	if (argc < 0 || (!nprocs && !argc)) {
+	if (render_file) {
+		if (argc || nprocs)
+			error_msg_and_help("--render cannot be used "
+					   "with PROG [ARGS] or -p PID");
+		if (binary_output || pipelined_output)
+			error_msg_and_help("--render and --format=%s "
+					   "are mutually exclusive",
+					   binary_output ? "binary"
+							 : "pipelined");
+	} else if (argc < 0 || (!nprocs && !argc)) {
 		error_msg_and_help("must have PROG [ARGS] or -p PID");
 	}
 
@@ -1751,11 +2305,65 @@ init(int argc, char *argv[])
 		error_msg_and_help("-w must be given with (-c or -C)");
 	}
 
+	if (summary_interval_given && !cflag) {
+		error_msg_and_help("--summary-interval must be given"
+				   " with (-c or -C)");
+	}
+
+	if (binary_output) {
+		if (!outfname)
+			error_msg_and_help("--format=binary requires -o FILE");
+		if (cflag)
+			error_msg_and_help("(-c or -C) and --format=binary "
+					   "are mutually exclusive");
+		if (stack_trace_enabled)
+			error_msg_and_help("-k and --format=binary "
+					   "are mutually exclusive");
+	}
+
+	if (pipelined_output) {
+		if (followfork >= 2)
+			error_msg_and_help("-ff and --format=pipelined "
+					   "are mutually exclusive");
+		if (cflag)
+			error_msg_and_help("(-c or -C) and --format=pipelined "
+					   "are mutually exclusive");
+		if (stack_trace_enabled)
+			error_msg_and_help("-k and --format=pipelined "
+					   "are mutually exclusive");
+	}
+
+	/*
+	 * Details of sockets are looked up on the host and are not recorded,
+	 * so -yy works like -y with binary traces.
+	 */
+	if ((binary_output || pipelined_output || render_file)
+	    && show_fd_path > 1)
+		show_fd_path = 1;
+
+	if (seccomp_filtering) {
+		if (!followfork)
+			error_msg_and_help("--seccomp-bpf requires -f");
+		if (nprocs) {
+			error_msg("--seccomp-bpf is not enabled "
+				  "for processes attached with -p");
+			seccomp_filtering = false;
+		} else if (detach_on_execve) {
+			error_msg("--seccomp-bpf is not enabled "
+				  "because it is not compatible with -b");
+			seccomp_filtering = false;
+		}
+	}
+
 	if (cflag == CFLAG_ONLY_STATS) {
 		if (iflag)
 			error_msg("-%c has no effect with -c", 'i');
-		if (stack_trace_enabled)
+#ifdef ENABLE_STACKTRACE
+		if (stack_trace_enabled && !stack_profile_enabled) {
 			error_msg("-%c has no effect with -c", 'k');
+			stack_trace_enabled = false;
+		}
+#endif
 		if (rflag)
 			error_msg("-%c has no effect with -c", 'r');
 		if (tflag)
@@ -1799,9 +2407,18 @@ init(int argc, char *argv[])
 		ptrace_setoptions |= PTRACE_O_TRACECLONE |
 				     PTRACE_O_TRACEFORK |
 				     PTRACE_O_TRACEVFORK;
+
+	check_seccomp_filter();
+	if (seccomp_filtering)
+		ptrace_setoptions |= PTRACE_O_TRACESECCOMP;
+
 	debug_msg("ptrace_setoptions = %#x", ptrace_setoptions);
-	test_ptrace_seize();
-	test_ptrace_get_syscall_info();
+	if (!render_file) {
+		test_ptrace_seize();
+		test_ptrace_get_syscall_info();
+		if (cflag)
+			calibrate_overhead();
+	}
 
 	/*
 	 * Is something weird with our stdin and/or stdout -
@@ -1840,10 +2457,21 @@ init(int argc, char *argv[])
 			followfork = 1;
 	}
 
-	if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
-		setvbuf(shared_log, NULL, _IOLBF, 0);
+	if (pipelined_output) {
+		shared_log = start_formatter(shared_log);
+		binary_output = true;
 	}
 
+	/* If -ff, the trace is written to the files of tracees.  */
+	if (followfork < 2)
+		setup_output_buffer(shared_log);
+
+	if (render_file)
+		exit(bintrace_render(render_file, shared_log));
+
+	if (binary_output && followfork < 2)
+		bintrace_start(shared_log, followfork == 1 || nprocs > 1);
+
 	/*
 	 * argv[0]	-pPID	-oFILE	Default interactive setting
 	 * yes		*	0	INTR_WHILE_WAIT
@@ -1895,6 +2523,7 @@ init(int argc, char *argv[])
 	sigaddset(&timer_set, SIGALRM);
 	sigprocmask(SIG_BLOCK, &timer_set, NULL);
 	set_sighandler(SIGALRM, timer_sighandler, NULL);
+	arm_summary_timer();
 
 	if (nprocs != 0 || daemonized_tracer)
 		startup_attach();
@@ -1910,23 +2539,13 @@ init(int argc, char *argv[])
 static struct tcb *
 pid2tcb(const int pid)
 {
-	if (pid <= 0)
+	if (pid <= 0 || !pid_hash)
 		return NULL;
 
-#define PID2TCB_CACHE_SIZE 1024U
-#define PID2TCB_CACHE_MASK (PID2TCB_CACHE_SIZE - 1)
-
-	static struct tcb *pid2tcb_cache[PID2TCB_CACHE_SIZE];
-	struct tcb **const ptcp = &pid2tcb_cache[pid & PID2TCB_CACHE_MASK];
-	struct tcb *tcp = *ptcp;
-
-	if (tcp && tcp->pid == pid)
-		return tcp;
-
-	for (unsigned int i = 0; i < tcbtabsize; ++i) {
-		tcp = tcbtab[i];
+	for (struct tcb *tcp = *pid_hash_bucket(pid); tcp;
+	     tcp = tcp->pid_hash_next) {
 		if (tcp->pid == pid)
-			return *ptcp = tcp;
+			return tcp;
 	}
 
 	return NULL;
@@ -1938,6 +2557,12 @@ cleanup(int fatal_sig)
 	unsigned int i;
 	struct tcb *tcp;
 
+	/*
+	 * Write out the trace before detaching, which may take a while,
+	 * so that it is not lost if strace is killed in the meantime.
+	 */
+	flush_all_output();
+
 	if (!fatal_sig)
 		fatal_sig = SIGTERM;
 
@@ -2071,8 +2696,11 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	droptcb(tcp);
 	/* Switch to the thread, reusing leader's outfile and pid */
 	tcp = execve_thread;
+	pid_hash_remove(tcp);
+	reset_umove_method(tcp);
 	tcp->pid = pid;
-	if (cflag != CFLAG_ONLY_STATS) {
+	pid_hash_insert(tcp);
+	if (cflag != CFLAG_ONLY_STATS && !binary_output) {
 		printleader(tcp);
 		tprintf("+++ superseded by execve in pid %lu +++\n", old_pid);
 		line_ended();
@@ -2090,6 +2718,11 @@ print_signalled(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
+	if (binary_output) {
+		bintrace_exit(tcp, status);
+		return;
+	}
+
 	if (cflag != CFLAG_ONLY_STATS
 	    && is_number_in_set(WTERMSIG(status), signal_set)) {
 		printleader(tcp);
@@ -2108,6 +2741,11 @@ print_exited(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
+	if (binary_output) {
+		bintrace_exit(tcp, status);
+		return;
+	}
+
 	if (cflag != CFLAG_ONLY_STATS &&
 	    qflag < 2) {
 		printleader(tcp);
@@ -2119,6 +2757,12 @@ print_exited(struct tcb *tcp, const int pid, int status)
 static void
 print_stopped(struct tcb *tcp, const siginfo_t *si, const unsigned int sig)
 {
+	if (binary_output) {
+		if (!hide_log(tcp))
+			bintrace_signal(tcp, sig, si);
+		return;
+	}
+
 	if (cflag != CFLAG_ONLY_STATS
 	    && !hide_log(tcp)
 	    && is_number_in_set(sig, signal_set)) {
@@ -2168,6 +2812,11 @@ print_event_exit(struct tcb *tcp)
 		return;
 	}
 
+	if (binary_output) {
+		bintrace_syscall(tcp, NULL, BINTRACE_SYSCALL_UNFINISHED);
+		return;
+	}
+
 	if (followfork < 2 && printing_tcp && printing_tcp != tcp
 	    && printing_tcp->curcol != 0) {
 		set_current_tcp(printing_tcp);
@@ -2273,7 +2922,7 @@ next_event(void)
 	 *  19923 +++ exited with 1 +++
 	 * Exiting only when wait() returns ECHILD works better.
 	 */
-	if (popen_pid != 0) {
+	if (popen_pid != 0 || formatter_pid != 0) {
 		/* However, if -o|logger is in use, we can't do that.
 		 * Can work around that by double-forking the logger,
 		 * but that loses the ability to wait for its completion
@@ -2283,17 +2932,25 @@ next_event(void)
 			return NULL;
 	}
 
-	const bool unblock_delay_timer = is_delay_timer_armed();
+	/* Write out the log before waiting for the next event.  */
+	flush_output_before_wait();
+
+	const bool unblock_delay_timer = is_delay_timer_armed()
+					 || is_summary_timer_armed()
+					 || output_flush_timer_is_armed;
 
 	/*
 	 * The window of opportunity to handle expirations
-	 * of the delay timer opens here.
+	 * of the delay timer and the summary timer opens here.
 	 *
-	 * Unblock the signal handler for the delay timer
-	 * iff the delay timer is already created.
+	 * Unblock the signal handler for the timers
+	 * iff one of them is already created.
 	 */
-	if (unblock_delay_timer)
+	if (unblock_delay_timer) {
 		sigprocmask(SIG_UNBLOCK, &timer_set, NULL);
+		/* The output timer may have expired before.  */
+		flush_output_after_wait();
+	}
 
 	/*
 	 * If the delay timer has expired, then its expiration
@@ -2317,6 +2974,7 @@ next_event(void)
 	 */
 	if (unblock_delay_timer) {
 		sigprocmask(SIG_BLOCK, &timer_set, NULL);
+		flush_output_after_wait();
 
 		if (restart_failed)
 			return NULL;
@@ -2357,6 +3015,12 @@ next_event(void)
 			break;
 		}
 
+		if (pid == formatter_pid) {
+			if (!WIFSTOPPED(status))
+				formatter_pid = 0;
+			break;
+		}
+
 		if (debug_flag)
 			print_debug_info(pid, status);
 
@@ -2463,6 +3127,9 @@ next_event(void)
 			case PTRACE_EVENT_EXIT:
 				wd->te = TE_STOP_BEFORE_EXIT;
 				break;
+			case PTRACE_EVENT_SECCOMP:
+				wd->te = TE_SECCOMP;
+				break;
 			default:
 				wd->te = TE_RESTART;
 			}
@@ -2487,6 +3154,17 @@ next_event(void)
 		if (extra_tcp)
 			break;
 
+		/*
+		 * A single tracee stopped at a syscall cannot have another
+		 * event pending, and the events of new tracees are seen
+		 * by the next wait4() anyway.  This is done only with -c,
+		 * where the extra wait4() is a noticeable part of the time
+		 * spent per stop.
+		 */
+		if (cflag == CFLAG_ONLY_STATS && nprocs == 1
+		    && wd->te == TE_SYSCALL_STOP)
+			break;
+
 next_event_wait_next:
 		pid = wait4(-1, &status, __WALL | WNOHANG, (cflag ? &ru : NULL));
 		wait_errno = errno;
@@ -2548,7 +3226,7 @@ trace_syscall(struct tcb *tcp, unsigned int *sig)
 static bool
 dispatch_event(const struct tcb_wait_data *wd)
 {
-	unsigned int restart_op = PTRACE_SYSCALL;
+	unsigned int restart_op = 0;	/* 0 stands for the default */
 	unsigned int restart_sig = 0;
 	enum trace_event te = wd ? wd->te : TE_BREAK;
 	/*
@@ -2567,6 +3245,23 @@ dispatch_event(const struct tcb_wait_data *wd)
 	case TE_RESTART:
 		break;
 
+	case TE_SECCOMP:
+		if (seccomp_before_sysentry) {
+			/*
+			 * Before Linux 4.8, PTRACE_EVENT_SECCOMP stop
+			 * precedes syscall-entry-stop, the latter is
+			 * expected to follow after PTRACE_SYSCALL.
+			 */
+			restart_op = PTRACE_SYSCALL;
+			break;
+		}
+		/*
+		 * Since Linux 4.8, seccomp filter is run after
+		 * syscall-entry-stop which we have skipped with PTRACE_CONT,
+		 * so PTRACE_EVENT_SECCOMP stop is handled as syscall-entry.
+		 */
+		ATTRIBUTE_FALLTHROUGH;
+
 	case TE_SYSCALL_STOP:
 		if (trace_syscall(current_tcp, &restart_sig) < 0) {
 			/*
@@ -2617,6 +3312,13 @@ dispatch_event(const struct tcb_wait_data *wd)
 	case TE_STOP_BEFORE_EXECVE:
 		/* The syscall succeeded, clear the flag.  */
 		current_tcp->flags &= ~TCB_CHECK_EXEC_SYSCALL;
+		/* The address space has been replaced.  */
+		reset_umove_method(current_tcp);
+		/* Close-on-exec descriptors have been closed.  */
+		invalidate_fdtab(current_tcp);
+		/* The command name has changed.  */
+		if (current_tcp->cold)
+			current_tcp->cold->count_group = NULL;
 		/*
 		 * Check that we are inside syscall now (next event after
 		 * PTRACE_EVENT_EXEC should be for syscall exiting).  If it is
@@ -2691,6 +3393,17 @@ dispatch_event(const struct tcb_wait_data *wd)
 		return true;
 	}
 
+	if (!restart_op) {
+		/*
+		 * When seccomp filter is in use, syscalls that have to be
+		 * traced stop the tracee with PTRACE_EVENT_SECCOMP,
+		 * so there is no need to stop at every syscall-entry.
+		 * Syscall-exit-stop is still needed for traced syscalls.
+		 */
+		restart_op = seccomp_filtering && entering(current_tcp)
+			     ? PTRACE_CONT : PTRACE_SYSCALL;
+	}
+
 	if (ptrace_restart(restart_op, current_tcp, restart_sig) < 0) {
 		/* Note: ptrace_restart emitted error message */
 		exit_code = 1;
@@ -2739,14 +3452,15 @@ restart_delayed_tcbs(void)
 		struct tcb *tcp = tcbtab[i];
 
 		if (tcp->pid && syscall_delayed(tcp)) {
-			if (ts_cmp(&ts_now, &tcp->delay_expiration_time) > 0) {
+			if (ts_cmp(&ts_now,
+				   &tcp->cold->delay_expiration_time) > 0) {
 				if (!restart_delayed_tcb(tcp))
 					return false;
 			} else {
 				/* Check whether this tcb is the next.  */
 				if (!tcp_next ||
-				    ts_cmp(&tcp_next->delay_expiration_time,
-					   &tcp->delay_expiration_time) > 0) {
+				    ts_cmp(&tcp_next->cold->delay_expiration_time,
+					   &tcp->cold->delay_expiration_time) > 0) {
 					tcp_next = tcp;
 				}
 			}
@@ -2767,7 +3481,9 @@ restart_delayed_tcbs(void)
 static void
 timer_sighandler(int sig)
 {
+	summary_timer_expired();
 	delay_timer_expired();
+	output_flush_timer_expired();
 
 	if (restart_failed)
 		return;
@@ -2789,12 +3505,32 @@ terminate(void)
 {
 	int sig = interrupted;
 
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_enabled)
+		unwind_print_deferred();
+#endif
 	cleanup(sig);
+	print_umove_cache_stats();
+	print_fdtab_stats();
+	print_mmap_cache_stats();
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_enabled)
+		print_unwind_stats();
+#endif
+	print_sockaddr_stats();
 	if (cflag)
 		call_summary(shared_log);
+#ifdef ENABLE_STACKTRACE
+	if (stack_profile_enabled)
+		print_stack_profile(shared_log);
+#endif
 	fflush(NULL);
 	if (shared_log != stderr)
-		fclose(shared_log);
+		close_output(shared_log);
+	if (formatter_pid) {
+		while (waitpid(formatter_pid, NULL, 0) < 0 && errno == EINTR)
+			;
+	}
 	if (popen_pid) {
 		while (waitpid(popen_pid, NULL, 0) < 0 && errno == EINTR)
 			;
@@ -2839,7 +3575,16 @@ main(int argc, char *argv[])
 
 	exit_code = !nprocs;
 
-	while (dispatch_event(next_event()))
-		;
+	while (dispatch_event(next_event())) {
+#ifdef ENABLE_STACKTRACE
+		/*
+		 * The stack trace of the event is resolved and printed
+		 * after its tracee is restarted.
+		 */
+		if (stack_trace_enabled)
+			unwind_print_deferred();
+#endif
+		interval_summary(shared_log);
+	}
 	terminate();
 }
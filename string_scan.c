@@ -0,0 +1,221 @@
+/*
+ * Scanning of strings for the characters string_quote has to escape.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "string_scan.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+# define HAVE_SCAN_SSE2 1
+#endif
+
+#if defined __x86_64__ && (GNUC_PREREQ(4, 9) || CLANG_PREREQ(3, 8))
+# include <immintrin.h>
+# define HAVE_SCAN_AVX2 1
+#endif
+
+enum scan_class {
+	SCAN_PLAIN,
+	SCAN_TEXT,
+};
+
+static inline size_t
+scan_scalar(const unsigned char *const s, const size_t len,
+	    const enum scan_class cls)
+{
+	size_t i = 0;
+
+	if (cls == SCAN_PLAIN) {
+		while (i < len && is_plain_char(s[i]))
+			++i;
+	} else {
+		while (i < len && is_text_char(s[i]))
+			++i;
+	}
+
+	return i;
+}
+
+#ifndef HAVE_SCAN_SSE2
+static size_t
+scan_plain_scalar(const unsigned char *const s, const size_t len)
+{
+	return scan_scalar(s, len, SCAN_PLAIN);
+}
+
+static size_t
+scan_text_scalar(const unsigned char *const s, const size_t len)
+{
+	return scan_scalar(s, len, SCAN_TEXT);
+}
+#else /* HAVE_SCAN_SSE2 */
+/*
+ * Bytes are compared as signed, so the bytes above 0x7f are negative
+ * and fail the lower bound check of the printable range.
+ */
+static inline __m128i
+classify_sse2(const __m128i v, const enum scan_class cls)
+{
+	const __m128i ok =
+		_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(' ' - 1)),
+			      _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+
+	if (cls == SCAN_PLAIN)
+		return _mm_andnot_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\"')),
+				     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+			ok);
+
+	return _mm_or_si128(ok,
+		_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+			      _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1))));
+}
+
+static inline size_t
+scan_sse2(const unsigned char *const s, const size_t len,
+	  const enum scan_class cls)
+{
+	size_t i = 0;
+
+	for (; len - i >= 16; i += 16) {
+		const __m128i v = _mm_loadu_si128((const void *) (s + i));
+		const unsigned int bad =
+			~_mm_movemask_epi8(classify_sse2(v, cls)) & 0xffff;
+
+		if (bad)
+			return i + __builtin_ctz(bad);
+	}
+
+	return i + scan_scalar(s + i, len - i, cls);
+}
+
+static size_t
+scan_plain_sse2(const unsigned char *const s, const size_t len)
+{
+	return scan_sse2(s, len, SCAN_PLAIN);
+}
+
+static size_t
+scan_text_sse2(const unsigned char *const s, const size_t len)
+{
+	return scan_sse2(s, len, SCAN_TEXT);
+}
+#endif /* HAVE_SCAN_SSE2 */
+
+#ifdef HAVE_SCAN_AVX2
+static inline __attribute__((__target__("avx2"))) size_t
+scan_avx2(const unsigned char *const s, const size_t len,
+	  const enum scan_class cls)
+{
+	size_t i = 0;
+
+	for (; len - i >= 32; i += 32) {
+		const __m256i v = _mm256_loadu_si256((const void *) (s + i));
+		__m256i ok =
+			_mm256_and_si256(
+				_mm256_cmpgt_epi8(v, _mm256_set1_epi8(' ' - 1)),
+				_mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v));
+
+		if (cls == SCAN_PLAIN)
+			ok = _mm256_andnot_si256(
+				_mm256_or_si256(
+					_mm256_cmpeq_epi8(v,
+						_mm256_set1_epi8('\"')),
+					_mm256_cmpeq_epi8(v,
+						_mm256_set1_epi8('\\'))),
+				ok);
+		else
+			ok = _mm256_or_si256(ok,
+				_mm256_and_si256(
+					_mm256_cmpgt_epi8(v,
+						_mm256_set1_epi8('\t' - 1)),
+					_mm256_cmpgt_epi8(
+						_mm256_set1_epi8('\r' + 1),
+						v)));
+
+		const uint32_t bad = ~(uint32_t) _mm256_movemask_epi8(ok);
+
+		if (bad)
+			return i + __builtin_ctz(bad);
+	}
+
+# ifdef HAVE_SCAN_SSE2
+	return i + scan_sse2(s + i, len - i, cls);
+# else
+	return i + scan_scalar(s + i, len - i, cls);
+# endif
+}
+
+static __attribute__((__target__("avx2"))) size_t
+scan_plain_avx2(const unsigned char *const s, const size_t len)
+{
+	return scan_avx2(s, len, SCAN_PLAIN);
+}
+
+static __attribute__((__target__("avx2"))) size_t
+scan_text_avx2(const unsigned char *const s, const size_t len)
+{
+	return scan_avx2(s, len, SCAN_TEXT);
+}
+#endif /* HAVE_SCAN_AVX2 */
+
+static size_t scan_plain_init(const unsigned char *, size_t);
+static size_t scan_text_init(const unsigned char *, size_t);
+
+static size_t (*scan_plain_fn)(const unsigned char *, size_t) = scan_plain_init;
+static size_t (*scan_text_fn)(const unsigned char *, size_t) = scan_text_init;
+
+/* Choose the fastest implementation supported by the CPU.  */
+static void
+choose_scan_fns(void)
+{
+#ifdef HAVE_SCAN_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan_plain_fn = scan_plain_avx2;
+		scan_text_fn = scan_text_avx2;
+		debug_msg("string scan: using avx2");
+		return;
+	}
+#endif
+#ifdef HAVE_SCAN_SSE2
+	scan_plain_fn = scan_plain_sse2;
+	scan_text_fn = scan_text_sse2;
+	debug_msg("string scan: using sse2");
+#else
+	scan_plain_fn = scan_plain_scalar;
+	scan_text_fn = scan_text_scalar;
+#endif
+}
+
+static size_t
+scan_plain_init(const unsigned char *const s, const size_t len)
+{
+	choose_scan_fns();
+	return scan_plain_fn(s, len);
+}
+
+static size_t
+scan_text_init(const unsigned char *const s, const size_t len)
+{
+	choose_scan_fns();
+	return scan_text_fn(s, len);
+}
+
+size_t
+string_scan_plain(const unsigned char *const s, const size_t len)
+{
+	return scan_plain_fn(s, len);
+}
+
+size_t
+string_scan_text(const unsigned char *const s, const size_t len)
+{
+	return scan_text_fn(s, len);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_STRING_SCAN_H
+# define STRACE_STRING_SCAN_H
+
+# include <stddef.h>
+# include <stdbool.h>
+# include <stdint.h>
+
+/*
+ * Character classes used by string_quote, see string_scan_plain
+ * and string_scan_text.
+ */
+static inline bool
+is_plain_char(uint8_t c)
+{
+	return c >= ' ' && c < 0x7f && c != '\"' && c != '\\';
+}
+
+static inline bool
+is_text_char(uint8_t c)
+{
+	return (c >= ' ' && c < 0x7f) || (c >= '\t' && c <= '\r');
+}
+
+/*
+ * Return the length of the leading part of the `len' bytes at `s'
+ * that consists of printable ASCII characters other than '"' and '\\',
+ * that is, of the characters string_quote copies as is.
+ */
+extern size_t string_scan_plain(const unsigned char *s, size_t len);
+
+/*
+ * Return the length of the leading part of the `len' bytes at `s'
+ * that consists of printable ASCII and whitespace characters,
+ * that is, of the characters that do not force -x to hex-quote a string.
+ */
+extern size_t string_scan_text(const unsigned char *s, size_t len);
+
+#endif /* !STRACE_STRING_SCAN_H */
@@ -13,6 +13,7 @@
  */
 
 #include "defs.h"
+#include "bintrace.h"
 #include "get_personality.h"
 #include "mmap_notify.h"
 #include "native_defs.h"
@@ -21,6 +22,7 @@
 #include "nsig.h"
 #include "number_set.h"
 #include "delay.h"
+#include "fdtab.h"
 #include "retval.h"
 #include <limits.h>
 
@@ -455,18 +457,22 @@ struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
 static struct inject_opts *
 tcb_inject_opts(struct tcb *tcp)
 {
-	return (scno_in_range(tcp->scno) && tcp->inject_vec[current_personality])
-	       ? &tcp->inject_vec[current_personality][tcp->scno] : NULL;
+	return (scno_in_range(tcp->scno) && tcp->cold
+		&& tcp->cold->inject_vec[current_personality])
+	       ? &tcp->cold->inject_vec[current_personality][tcp->scno]
+	       : NULL;
 }
 
 
 static long
 tamper_with_syscall_entering(struct tcb *tcp, unsigned int *signo)
 {
-	if (!tcp->inject_vec[current_personality]) {
-		tcp->inject_vec[current_personality] =
+	struct tcb_cold *const cold = get_tcb_cold(tcp);
+
+	if (!cold->inject_vec[current_personality]) {
+		cold->inject_vec[current_personality] =
 			xcalloc(nsyscalls, sizeof(**inject_vec));
-		memcpy(tcp->inject_vec[current_personality],
+		memcpy(cold->inject_vec[current_personality],
 		       inject_vec[current_personality],
 		       nsyscalls * sizeof(**inject_vec));
 	}
@@ -551,6 +557,38 @@ tamper_with_syscall_exiting(struct tcb *tcp)
 	return 0;
 }
 
+/*
+ * With -c alone, only the number, the time, and the error of a syscall
+ * are needed, unless its arguments select it, choose a subcall, or
+ * update the descriptor table, or it is tampered with.  Fetching the
+ * arguments may take several ptrace requests on architectures that do
+ * not support PTRACE_GET_SYSCALL_INFO.
+ */
+static bool
+syscall_needs_args(struct tcb *tcp)
+{
+	if (cflag != CFLAG_ONLY_STATS || tracing_paths || inject(tcp))
+		return true;
+
+	switch (tcp_sysent(tcp)->sen) {
+#ifdef SYS_ipc_subcall
+	case SEN_ipc:
+		return true;
+#endif
+#ifdef SYS_socket_subcall
+	case SEN_socketcall:
+		return true;
+#endif
+#ifdef SYS_syscall_subcall
+	case SEN_syscall:
+		return true;
+#endif
+	}
+
+	return fdtab_needs_syscall(tcp_sysent(tcp))
+	       || mmap_notify_needs_syscall(tcp_sysent(tcp));
+}
+
 /*
  * Returns:
  * 0: "ignore this ptrace stop", bail out silently.
@@ -565,7 +603,11 @@ syscall_entering_decode(struct tcb *tcp)
 	int res = get_scno(tcp);
 	if (res == 0)
 		return res;
+	if (res == 1 && !syscall_needs_args(tcp))
+		return res;
 	if (res != 1 || (res = get_syscall_args(tcp)) != 1) {
+		if (binary_output)
+			return res;
 		printleader(tcp);
 		tprintf("%s(", tcp_sysent(tcp)->sys_name);
 		/*
@@ -602,6 +644,8 @@ syscall_entering_decode(struct tcb *tcp)
 	}
 #endif
 
+	fdtab_syscall(tcp);
+
 	return 1;
 }
 
@@ -641,10 +685,6 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	if (inject(tcp))
 		tamper_with_syscall_entering(tcp, sig);
 
-	if (cflag == CFLAG_ONLY_STATS) {
-		return 0;
-	}
-
 #ifdef ENABLE_STACKTRACE
 	if (stack_trace_enabled) {
 		if (tcp_sysent(tcp)->sys_flags & STACKTRACE_CAPTURE_ON_ENTER)
@@ -652,10 +692,27 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	}
 #endif
 
+	if (cflag == CFLAG_ONLY_STATS) {
+		return 0;
+	}
+
+	if (binary_output) {
+		/*
+		 * Run the decoder without printing anything to record
+		 * the tracee memory it reads, see bintrace.c.
+		 */
+		bintrace_record_start(tcp);
+		set_current_tcp(NULL);
+		int res = raw(tcp) ? printargs(tcp) : tcp_sysent(tcp)->sys_func(tcp);
+		set_current_tcp(tcp);
+		bintrace_record_stop();
+		return res;
+	}
+
 	printleader(tcp);
 	tprintf("%s(", tcp_sysent(tcp)->sys_name);
 	int res = raw(tcp) ? printargs(tcp) : tcp_sysent(tcp)->sys_func(tcp);
-	fflush(tcp->outf);
+	flush_tcp_output(tcp);
 	return res;
 }
 
@@ -665,7 +722,8 @@ syscall_entering_finish(struct tcb *tcp, int res)
 	tcp->flags |= TCB_INSYSCALL;
 	tcp->sys_func_rval = res;
 	/* Measure the entrance time as late as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if ((Tflag || cflag || binary_output || stack_profile_enabled)
+	    && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, &tcp->etime);
 }
 
@@ -681,14 +739,17 @@ int
 syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 {
 	/* Measure the exit time as early as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if ((Tflag || cflag || binary_output || stack_profile_enabled)
+	    && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, pts);
 
-	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
-		mmap_notify_report(tcp);
+	fdtab_syscall(tcp);
 
-	if (filtered(tcp))
+	if (filtered(tcp)) {
+		if (mmap_notify_needs_syscall(tcp_sysent(tcp)))
+			mmap_notify_syscall(tcp, get_syscall_result(tcp) == 1);
 		return 0;
+	}
 
 	if (check_exec_syscall(tcp)) {
 		/* The check failed, hide the log.  */
@@ -699,7 +760,12 @@ syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 	update_personality(tcp, tcp->currpers);
 #endif
 
-	return get_syscall_result(tcp);
+	const int res = get_syscall_result(tcp);
+
+	if (mmap_notify_needs_syscall(tcp_sysent(tcp)))
+		mmap_notify_syscall(tcp, res == 1);
+
+	return res;
 }
 
 void
@@ -722,12 +788,42 @@ print_syscall_resume(struct tcb *tcp)
 	}
 }
 
+/*
+ * Run the decoder on exiting the syscall without printing anything
+ * to record the tracee memory and the descriptor paths it reads,
+ * including those printed along with the return value.
+ */
+static void
+record_syscall_exiting(struct tcb *tcp)
+{
+	bintrace_record_start(tcp);
+	set_current_tcp(NULL);
+
+	int sys_res = tcp->sys_func_rval;
+	if (!raw(tcp) && !(sys_res & RVAL_DECODED))
+		sys_res = tcp_sysent(tcp)->sys_func(tcp);
+	if (!raw(tcp) && !tcp->u_error && show_fd_path
+	    && (sys_res & (RVAL_NONE | RVAL_MASK)) == RVAL_FD) {
+		init_fd_info(tcp, tcp->u_rval);
+		printfd(tcp, tcp->u_rval);
+	}
+	dumpio(tcp);
+
+	set_current_tcp(tcp);
+	bintrace_record_stop();
+}
+
 int
 syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 {
 	if (syscall_tampered(tcp) || inject_delay_exit(tcp))
 		tamper_with_syscall_exiting(tcp);
 
+#ifdef ENABLE_STACKTRACE
+	if (stack_profile_enabled)
+		unwind_tcb_profile(tcp, ts);
+#endif
+
 	if (cflag) {
 		count_syscall(tcp, ts);
 		if (cflag == CFLAG_ONLY_STATS) {
@@ -735,6 +831,16 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 		}
 	}
 
+	if (binary_output) {
+		if (res == 1 && not_failing_only && tcp->u_error)
+			return 0;
+		if (res == 1)
+			record_syscall_exiting(tcp);
+		bintrace_syscall(tcp, ts,
+				 res != 1 ? BINTRACE_SYSCALL_UNAVAILABLE : 0);
+		return res;
+	}
+
 	print_syscall_resume(tcp);
 	printing_tcp = tcp;
 
@@ -769,6 +875,23 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			sys_res = tcp_sysent(tcp)->sys_func(tcp);
 	}
 
+	print_syscall_exit(tcp, sys_res, ts);
+
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_enabled)
+		unwind_tcb_print(tcp);
+#endif
+	return 0;
+}
+
+/*
+ * Print the rest of the line of a syscall whose exiting part
+ * has been decoded with result sys_res: the return value, and the time
+ * spent in the syscall since tcp->etime till ts.
+ */
+void
+print_syscall_exit(struct tcb *tcp, int sys_res, struct timespec *ts)
+{
 	tprints(") ");
 	tabto();
 
@@ -876,6 +999,8 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 				break;
 			case RVAL_FD:
 				if (show_fd_path) {
+					/* A new descriptor, see init_fd_info.  */
+					init_fd_info(tcp, tcp->u_rval);
 					tprints("= ");
 					printfd(tcp, tcp->u_rval);
 				} else
@@ -899,12 +1024,6 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	tprints("\n");
 	dumpio(tcp);
 	line_ended();
-
-#ifdef ENABLE_STACKTRACE
-	if (stack_trace_enabled)
-		unwind_tcb_print(tcp);
-#endif
-	return 0;
 }
 
 void
@@ -1241,6 +1360,19 @@ get_stack_pointer(struct tcb *tcp, kernel_ulong_t *sp)
 #endif
 }
 
+bool
+get_frame_pointer(struct tcb *tcp, kernel_ulong_t *fp)
+{
+#if defined ARCH_FP_REG
+	if (get_regs(tcp) < 0)
+		return false;
+	*fp = (kernel_ulong_t) ARCH_FP_REG;
+	return true;
+#else
+	return false;
+#endif
+}
+
 static int
 get_syscall_regs(struct tcb *tcp)
 {
@@ -1255,7 +1387,7 @@ get_syscall_regs(struct tcb *tcp)
 
 const struct_sysent stub_sysent = {
 	.nargs = MAX_ARGS,
-	.sys_flags = MEMORY_MAPPING_CHANGE,
+	.sys_flags = MEMORY_MAPPING_CHANGE | UNKNOWN_SYSCALL,
 	.sen = SEN_printargs,
 	.sys_func = printargs,
 	.sys_name = "????",
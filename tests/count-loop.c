@@ -0,0 +1,36 @@
+/*
+ * Make the given number of getppid syscalls.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+
+#ifdef __NR_getppid
+
+# include <stdlib.h>
+# include <unistd.h>
+
+int
+main(int ac, char **av)
+{
+	if (ac != 2)
+		error_msg_and_fail("usage: count-loop count");
+
+	const unsigned long n = strtoul(av[1], NULL, 0);
+
+	for (unsigned long i = 0; i < n; ++i)
+		syscall(__NR_getppid);
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_getppid")
+
+#endif
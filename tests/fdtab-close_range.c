@@ -0,0 +1,82 @@
+/*
+ * Check that strace -y mode does not print stale file names
+ * of descriptors that have been closed by close_range
+ * and reused by pipe2.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#ifdef __NR_close_range
+
+# include <fcntl.h>
+# include <limits.h>
+# include <stdio.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+static char dir[PATH_MAX + 1];
+
+static void
+test_fsync(const int fd, const char *const name)
+{
+	const int rc = fsync(fd);
+
+	printf("fsync(%d<", fd);
+	print_quoted_string_ex(dir, false, ">:");
+	printf("/%s>) = %s\n", name, sprintrc(rc));
+}
+
+static unsigned long
+inode_of(const int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		perror_msg_and_fail("fstat");
+
+	return st.st_ino;
+}
+
+int
+main(void)
+{
+	static const char name[] = "fdtab-close_range.sample";
+
+	if (!getcwd(dir, sizeof(dir)))
+		perror_msg_and_fail("getcwd");
+
+	const int fd = open(name, O_RDONLY | O_CREAT, 0600);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", name);
+	test_fsync(fd, name);
+
+	if (syscall(__NR_close_range, fd, fd, 0))
+		perror_msg_and_skip("close_range");
+
+	int fds[2];
+	if (pipe2(fds, 0))
+		perror_msg_and_fail("pipe2");
+	if (fds[0] != fd)
+		error_msg_and_fail("descriptor %d is not reused", fd);
+
+	printf("pipe2([%d<pipe:[%lu]>, %d<pipe:[%lu]>], 0) = 0\n",
+	       fds[0], inode_of(fds[0]), fds[1], inode_of(fds[1]));
+
+	if (unlink(name))
+		perror_msg_and_fail("unlink: %s", name);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_close_range")
+
+#endif
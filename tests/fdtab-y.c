@@ -0,0 +1,136 @@
+/*
+ * Check that strace -y mode does not print stale file names
+ * of descriptors that have been closed, replaced, renamed, or unlinked
+ * by syscalls that are not traced, including syscalls of other processes,
+ * and of descriptors duplicated by dup.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static char dir[PATH_MAX + 1];
+static int pid;
+
+static void
+test_fsync(const int fd, const char *const name, const char *const suffix)
+{
+	const int rc = fsync(fd);
+
+	printf("%-5d fsync(%d<", pid, fd);
+	print_quoted_string_ex(dir, false, ">:");
+	printf("/%s%s>) = %s\n", name, suffix, sprintrc(rc));
+}
+
+static void
+print_fd(const int fd, const char *const name)
+{
+	printf("%d<", fd);
+	print_quoted_string_ex(dir, false, ">:");
+	printf("/%s>", name);
+}
+
+static int
+test_dup(const int fd, const char *const name)
+{
+	const int rc = dup(fd);
+
+	if (rc < 0)
+		perror_msg_and_fail("dup");
+
+	printf("%-5d dup(", pid);
+	print_fd(fd, name);
+	printf(") = ");
+	print_fd(rc, name);
+	printf("\n");
+
+	return rc;
+}
+
+static int
+create(const char *const name)
+{
+	const int fd = open(name, O_RDONLY | O_CREAT, 0600);
+
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", name);
+
+	return fd;
+}
+
+int
+main(void)
+{
+	static const char name1[] = "fdtab-y.1";
+	static const char name2[] = "fdtab-y.2";
+	static const char name3[] = "fdtab-y.3";
+
+	if (!getcwd(dir, sizeof(dir)))
+		perror_msg_and_fail("getcwd");
+	pid = getpid();
+
+	/* A descriptor number reused after close.  */
+	int fd = create(name1);
+	test_fsync(fd, name1, "");
+	test_fsync(fd, name1, "");
+	close(fd);
+	if (create(name2) != fd)
+		error_msg_and_fail("descriptor %d is not reused", fd);
+	test_fsync(fd, name2, "");
+
+	/* A descriptor replaced by dup2.  */
+	const int fd1 = create(name1);
+	test_fsync(fd1, name1, "");
+	if (dup2(fd, fd1) != fd1)
+		perror_msg_and_fail("dup2");
+	test_fsync(fd1, name2, "");
+
+	/* A file renamed and unlinked.  */
+	if (rename(name2, name3))
+		perror_msg_and_fail("rename");
+	test_fsync(fd, name3, "");
+	test_fsync(fd1, name3, "");
+	if (unlink(name3))
+		perror_msg_and_fail("unlink");
+	test_fsync(fd, name3, " (deleted)");
+
+	/* A descriptor duplicated by dup.  */
+	const int fd2 = create(name1);
+	const int fd3 = test_dup(fd2, name1);
+	test_fsync(fd3, name1, "");
+
+	/* A file renamed by another process.  */
+	const pid_t child = fork();
+	if (child < 0)
+		perror_msg_and_fail("fork");
+	if (!child) {
+		if (rename(name1, name2))
+			perror_msg_and_fail("rename");
+		_exit(0);
+	}
+
+	int status;
+	if (waitpid(child, &status, 0) != child)
+		perror_msg_and_fail("waitpid");
+	if (status)
+		error_msg_and_fail("status %#x", status);
+	printf("%-5d +++ exited with 0 +++\n", child);
+
+	test_fsync(fd2, name2, "");
+	test_fsync(fd3, name2, "");
+
+	if (unlink(name2))
+		perror_msg_and_fail("unlink");
+
+	printf("%-5d +++ exited with 0 +++\n", pid);
+	return 0;
+}
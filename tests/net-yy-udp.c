@@ -0,0 +1,102 @@
+/*
+ * Check decoding of ip:port pairs associated with UDP socket descriptors.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+int
+main(void)
+{
+	skip_if_unavailable("/proc/self/fd/");
+
+	const struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+	};
+	struct sockaddr * const bind_sa = tail_memdup(&addr, sizeof(addr));
+	TAIL_ALLOC_OBJECT_CONST_PTR(socklen_t, len);
+	*len = sizeof(addr);
+
+	const int bind_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (bind_fd < 0)
+		perror_msg_and_skip("socket");
+	const unsigned long bind_inode = inode_of_sockfd(bind_fd);
+	printf("socket(AF_INET, SOCK_DGRAM, IPPROTO_IP) = %d<UDP:[%lu]>\n",
+	       bind_fd, bind_inode);
+
+	if (bind(bind_fd, bind_sa, *len))
+		perror_msg_and_skip("bind");
+	printf("bind(%d<UDP:[%lu]>, {sa_family=AF_INET, sin_port=htons(0)"
+	       ", sin_addr=inet_addr(\"127.0.0.1\")}, %u) = 0\n",
+	       bind_fd, bind_inode, (unsigned) *len);
+
+	if (getsockname(bind_fd, bind_sa, len))
+		perror_msg_and_fail("getsockname");
+	const unsigned int bind_port =
+		ntohs(((struct sockaddr_in *) bind_sa)->sin_port);
+	printf("getsockname(%d<UDP:[127.0.0.1:%u]>, {sa_family=AF_INET"
+	       ", sin_port=htons(%u), sin_addr=inet_addr(\"127.0.0.1\")}"
+	       ", [%u]) = 0\n",
+	       bind_fd, bind_port, bind_port, (unsigned) *len);
+
+	const int connect_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (connect_fd < 0)
+		perror_msg_and_fail("socket");
+	const unsigned long connect_inode = inode_of_sockfd(connect_fd);
+	printf("socket(AF_INET, SOCK_DGRAM, IPPROTO_IP) = %d<UDP:[%lu]>\n",
+	       connect_fd, connect_inode);
+
+	if (connect(connect_fd, bind_sa, *len))
+		perror_msg_and_fail("connect");
+	printf("connect(%d<UDP:[%lu]>, {sa_family=AF_INET, sin_port=htons(%u)"
+	       ", sin_addr=inet_addr(\"127.0.0.1\")}, %u) = 0\n",
+	       connect_fd, connect_inode, bind_port, (unsigned) *len);
+
+	struct sockaddr * const connect_sa = tail_alloc(sizeof(addr));
+	*len = sizeof(addr);
+	if (getsockname(connect_fd, connect_sa, len))
+		perror_msg_and_fail("getsockname");
+	const unsigned int connect_port =
+		ntohs(((struct sockaddr_in *) connect_sa)->sin_port);
+	printf("getsockname(%d<UDP:[127.0.0.1:%u->127.0.0.1:%u]>"
+	       ", {sa_family=AF_INET, sin_port=htons(%u)"
+	       ", sin_addr=inet_addr(\"127.0.0.1\")}, [%u]) = 0\n",
+	       connect_fd, connect_port, bind_port, connect_port,
+	       (unsigned) *len);
+
+	char text[] = "text";
+	assert(sendto(connect_fd, text, sizeof(text) - 1, MSG_DONTWAIT,
+		      NULL, 0) == sizeof(text) - 1);
+	printf("sendto(%d<UDP:[127.0.0.1:%u->127.0.0.1:%u]>, \"%s\", %u"
+	       ", MSG_DONTWAIT, NULL, 0) = %u\n",
+	       connect_fd, connect_port, bind_port, text,
+	       (unsigned) sizeof(text) - 1, (unsigned) sizeof(text) - 1);
+
+	assert(recvfrom(bind_fd, text, sizeof(text) - 1, 0,
+			NULL, NULL) == sizeof(text) - 1);
+	printf("recvfrom(%d<UDP:[127.0.0.1:%u]>, \"%s\", %u, 0, NULL, NULL)"
+	       " = %u\n",
+	       bind_fd, bind_port, text,
+	       (unsigned) sizeof(text) - 1, (unsigned) sizeof(text) - 1);
+
+	assert(close(connect_fd) == 0);
+	printf("close(%d<UDP:[127.0.0.1:%u->127.0.0.1:%u]>) = 0\n",
+	       connect_fd, connect_port, bind_port);
+
+	assert(close(bind_fd) == 0);
+	printf("close(%d<UDP:[127.0.0.1:%u]>) = 0\n", bind_fd, bind_port);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Check that -P DIR/ selects the directory and all files below it,
+ * and that descriptors are matched again after they are closed
+ * or their files are renamed by syscalls that are not traced.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static int pid;
+
+static void
+test_fsync(const int fd, const bool selected)
+{
+	const int rc = fsync(fd);
+
+	if (selected)
+		printf("%-5d fsync(%d) = %s\n", pid, fd, sprintrc(rc));
+}
+
+static int
+create(const char *const name, const int flags)
+{
+	const int fd = open(name, flags, 0600);
+
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", name);
+
+	return fd;
+}
+
+static void
+make_dir(const char *const name)
+{
+	if (mkdir(name, 0700) && errno != EEXIST)
+		perror_msg_and_fail("mkdir: %s", name);
+}
+
+/* Rename a file in a child process.  */
+static void
+child_rename(const char *const oldpath, const char *const newpath)
+{
+	const pid_t child = fork();
+
+	if (child < 0)
+		perror_msg_and_fail("fork");
+	if (!child) {
+		if (rename(oldpath, newpath))
+			perror_msg_and_fail("rename");
+		_exit(0);
+	}
+
+	int status;
+	if (waitpid(child, &status, 0) != child)
+		perror_msg_and_fail("waitpid");
+	if (status)
+		error_msg_and_fail("status %#x", status);
+	printf("%-5d +++ exited with 0 +++\n", child);
+}
+
+int
+main(void)
+{
+	pid = getpid();
+	make_dir("tree");
+	make_dir("tree/sub");
+
+	/* A file in the tree and a descriptor reused outside of it.  */
+	int fd = create("tree/a", O_RDONLY | O_CREAT);
+	test_fsync(fd, true);
+	test_fsync(fd, true);
+	close(fd);
+	if (create("tree-a", O_RDONLY | O_CREAT) != fd)
+		error_msg_and_fail("descriptor %d is not reused", fd);
+	test_fsync(fd, false);
+	test_fsync(fd, false);
+	close(fd);
+
+	/* The tree itself and a file deeper in it.  */
+	const int dir_fd = create("tree", O_RDONLY | O_DIRECTORY);
+	test_fsync(dir_fd, true);
+	const int cwd_fd = create(".", O_RDONLY | O_DIRECTORY);
+	test_fsync(cwd_fd, false);
+	fd = create("tree/sub/b", O_RDONLY | O_CREAT);
+	test_fsync(fd, true);
+
+	/* A file moved out of the tree.  */
+	if (rename("tree/sub/b", "b"))
+		perror_msg_and_fail("rename");
+	test_fsync(fd, false);
+
+	/* Files moved out of and into the tree by another process.  */
+	fd = create("tree/c", O_RDONLY | O_CREAT);
+	test_fsync(fd, true);
+	child_rename("tree/c", "c");
+	test_fsync(fd, false);
+	child_rename("c", "tree/sub/c");
+	test_fsync(fd, true);
+
+	printf("%-5d +++ exited with 0 +++\n", pid);
+	return 0;
+}
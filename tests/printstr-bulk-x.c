@@ -0,0 +1,2 @@
+#define XFLAG 1
+#include "printstr-bulk.c"
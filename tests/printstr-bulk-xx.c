@@ -0,0 +1,2 @@
+#define XFLAG 2
+#include "printstr-bulk.c"
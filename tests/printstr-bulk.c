@@ -0,0 +1,168 @@
+/*
+ * Check quoting and hex dumping of strings of various lengths
+ * with characters that have to be escaped at every position.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* 0 - default, 1 - -x, 2 - -xx */
+#ifndef XFLAG
+# define XFLAG 0
+#endif
+
+#define MAX_STRLEN	1024
+#define DUMP_FD		7
+
+static const unsigned char specials[] = {
+	'"', '\\', '\n', '\t', '\0', 0x1f, 0x7f, 0x80, 0xff
+};
+
+static void
+fill(unsigned char *const buf, const size_t len, const size_t seed)
+{
+	for (size_t i = 0; i < len; ++i) {
+		const unsigned char c = ' ' + (seed + i * 7) % 95;
+
+		buf[i] = (c == '"' || c == '\\') ? 'x' : c;
+	}
+}
+
+static void
+print_str(const unsigned char *const buf, const size_t len)
+{
+	bool hex = XFLAG > 1;
+
+	for (size_t i = 0; XFLAG == 1 && i < len; ++i) {
+		if (buf[i] > 0x7e || (buf[i] < ' ' &&
+				      (buf[i] < '\t' || buf[i] > '\r'))) {
+			hex = true;
+			break;
+		}
+	}
+
+	if (hex)
+		print_quoted_hex(buf, len);
+	else
+		print_quoted_memory(buf, len);
+}
+
+static void
+print_dump(const unsigned char *const buf, const size_t len)
+{
+	for (size_t i = 0; i < len; i += 16) {
+		printf(" | %05zx ", i);
+		for (size_t k = 0; k < 16; ++k) {
+			if (i + k < len)
+				printf(" %02x", buf[i + k]);
+			else
+				printf("   ");
+			if (k == 7)
+				putchar(' ');
+		}
+		printf("  ");
+		for (size_t k = 0; k < 16; ++k) {
+			if (i + k >= len)
+				putchar(' ');
+			else if (buf[i + k] >= ' ' && buf[i + k] < 0x7f)
+				putchar(buf[i + k]);
+			else
+				putchar('.');
+		}
+		printf(" |\n");
+	}
+}
+
+static void
+test_pwrite(const int fd, const unsigned char *const buf, const size_t len)
+{
+	const long rc = pwrite(fd, buf, len, 0);
+
+	printf("pwrite64(%d, ", fd);
+	print_str(buf, MIN(len, MAX_STRLEN));
+	printf("%s, %zu, 0) = %s\n", len > MAX_STRLEN ? "..." : "", len,
+	       sprintrc(rc));
+	if (fd == DUMP_FD)
+		print_dump(buf, len);
+}
+
+static void
+test_chdir(const unsigned char *const buf)
+{
+	const long rc = chdir((const char *) buf);
+
+	printf("chdir(");
+	print_str(buf, strlen((const char *) buf));
+	printf(") = %s\n", sprintrc(rc));
+}
+
+int
+main(void)
+{
+	static const size_t lens[] = {
+		0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65,
+		95, 96, 97, 127, 128, 129, 255, 256, 257
+	};
+	unsigned char *const buf = tail_alloc(MAX_STRLEN + 16);
+	unsigned int n = 0;
+
+	close(DUMP_FD);
+
+	for (size_t i = 0; i < ARRAY_SIZE(lens); ++i) {
+		const size_t len = lens[i];
+
+		/* Strings without special characters.  */
+		fill(buf, len, len);
+		test_pwrite(-1, buf, len);
+
+		/* One special character at every position.  */
+		for (size_t pos = 0; pos < len; ++pos, ++n) {
+			fill(buf, len, pos);
+			buf[pos] = specials[n % ARRAY_SIZE(specials)];
+			test_pwrite(-1, buf, len);
+		}
+	}
+
+	/* The same at unaligned addresses.  */
+	for (size_t off = 1; off < 16; ++off) {
+		fill(buf + off, 100, off);
+		buf[off + 90] = specials[off % ARRAY_SIZE(specials)];
+		test_pwrite(-1, buf + off, 100);
+	}
+
+	/* NUL-terminated strings.  */
+	for (size_t len = 0; len < 70; ++len) {
+		fill(buf, len, len);
+		buf[len] = '\0';
+		test_chdir(buf);
+
+		if (len) {
+			buf[len / 2] = specials[len % (ARRAY_SIZE(specials) - 5)];
+			test_chdir(buf);
+		}
+	}
+
+	/* Hex dumps.  */
+	for (size_t len = 0; len <= 48; ++len) {
+		fill(buf, len, len);
+		if (len)
+			buf[len - 1] = specials[len % ARRAY_SIZE(specials)];
+		test_pwrite(DUMP_FD, buf, len);
+	}
+
+	/* Truncated strings.  */
+	fill(buf, MAX_STRLEN + 16, 0);
+	test_pwrite(DUMP_FD, buf, MAX_STRLEN + 16);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "stack-fcall.h"
+
+int main(int ac, char **av)
+{
+	/* The program executed by f3 does nothing.  */
+	if (ac > 1)
+		return 0;
+
+	f0(2);
+	return 1;
+}
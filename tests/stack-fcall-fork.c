@@ -0,0 +1,37 @@
+/*
+ * Check that stack traces of a parent and its child, which share
+ * the same DSOs, are both resolved.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "stack-fcall.h"
+
+int main(void)
+{
+	f0(0);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		perror_msg_and_fail("fork");
+
+	if (!pid) {
+		f0(0);
+		return 0;
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status))
+		error_msg_and_fail("waitpid: status %d", status);
+
+	f0(0);
+	return 0;
+}
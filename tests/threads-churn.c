@@ -0,0 +1,56 @@
+/*
+ * Spawn lots of short-lived threads, up to a given number at a time.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void *
+thread(void *arg)
+{
+	assert(chdir(".") == 0);
+	return arg;
+}
+
+int
+main(int ac, const char *av[])
+{
+	assert(ac == 3);
+
+	int num_threads = atoi(av[1]);
+	assert(num_threads > 0);
+
+	const int batch = atoi(av[2]);
+	assert(batch > 0);
+
+	pthread_t *const t = tail_alloc(sizeof(*t) * batch);
+
+	while (num_threads > 0) {
+		const int n = num_threads < batch ? num_threads : batch;
+
+		for (int i = 0; i < n; ++i) {
+			errno = pthread_create(&t[i], NULL, thread, NULL);
+			if (errno)
+				perror_msg_and_fail("pthread_create");
+		}
+
+		for (int i = 0; i < n; ++i) {
+			errno = pthread_join(t[i], NULL);
+			if (errno)
+				perror_msg_and_fail("pthread_join");
+		}
+
+		num_threads -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Check that the tracee memory read across a page boundary
+ * is not served from stale cached pages after the tracee writes to it.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <asm/unistd.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+check_chdir(const char *const path)
+{
+	int rc = chdir(path);
+	printf("chdir(\"%s\") = %s\n", path, sprintrc(rc));
+}
+
+int
+main(void)
+{
+	const size_t page_size = get_page_size();
+	char *const buf = tail_alloc(page_size + 8);
+	/* The first byte of the second page of buf.  */
+	char *const page = buf + 8;
+	char *const str = page - 4;
+
+	/* Both pages are read.  */
+	memcpy(str, "abc/def", 8);
+	check_chdir(str);
+
+	/* The tracee changes both pages between syscalls.  */
+	memcpy(str, "ghi/jkl", 8);
+	check_chdir(str);
+
+	/* The tracee changes the second page only.  */
+	page[1] = 'X';
+	check_chdir(str);
+
+	/* Only the first page is read, then it is changed.  */
+	memcpy(buf, "mno", 4);
+	check_chdir(buf);
+	str[0] = 'p';
+	check_chdir(str);
+
+#ifdef __NR_poll
+	/*
+	 * The kernel changes the second page after the first one
+	 * has been read on entering.
+	 */
+	struct pollfd *const pfd = (void *) (page - sizeof(pfd->fd));
+	int fds[2];
+
+	if (pipe(fds) || write(fds[1], "", 1) != 1)
+		perror_msg_and_fail("pipe");
+
+	pfd->fd = fds[0];
+	pfd->events = POLLIN;
+	pfd->revents = 0;
+	int rc = syscall(__NR_poll, pfd, 1, 0);
+	if (rc != 1)
+		perror_msg_and_fail("poll");
+	printf("poll([{fd=%d, events=POLLIN}], 1, 0) = 1"
+	       " ([{fd=%d, revents=POLLIN}])\n", fds[0], fds[0]);
+#endif
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
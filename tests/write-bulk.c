@@ -0,0 +1,48 @@
+/*
+ * Write large text or binary buffers a given number of times.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BULK_FD		9
+#define BULK_SIZE	65536
+
+int
+main(int ac, const char *av[])
+{
+	assert(ac == 3);
+
+	const int n = atoi(av[1]);
+	assert(n > 0);
+
+	const bool text = !strcmp(av[2], "text");
+	static char buf[BULK_SIZE];
+
+	for (size_t i = 0; i < sizeof(buf); ++i) {
+		if (text)
+			buf[i] = i % 80 == 79 ? '\n' : 'a' + i % 26;
+		else
+			buf[i] = i * 7;
+	}
+
+	int fd = open("/dev/null", O_WRONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", "/dev/null");
+	if (dup2(fd, BULK_FD) != BULK_FD)
+		perror_msg_and_fail("dup2");
+
+	for (int i = 0; i < n; ++i)
+		assert(write(BULK_FD, buf, sizeof(buf)) == sizeof(buf));
+
+	return 0;
+}
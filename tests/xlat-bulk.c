@@ -0,0 +1,53 @@
+/*
+ * Invoke a given number of times each of the syscalls whose arguments
+ * are decoded using constant and flag tables of various sizes and layouts.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#if defined __NR_fcntl && defined __NR_lseek && defined __NR_madvise \
+ && defined __NR_openat && defined __NR_setsockopt && defined __NR_socket
+
+# include <assert.h>
+# include <stdlib.h>
+# include <unistd.h>
+# include <netinet/in.h>
+# include <sys/socket.h>
+
+int
+main(int ac, const char *av[])
+{
+	static const int levels[] = {
+		SOL_SOCKET, IPPROTO_IP, IPPROTO_TCP, IPPROTO_IPV6, IPPROTO_UDP
+	};
+
+	assert(ac == 2);
+
+	const int n = atoi(av[1]);
+	assert(n > 0);
+
+	for (int i = 0; i < n; ++i) {
+		syscall(__NR_fcntl, -1, (i & 1 ? 1024 : 0) + i / 2 % 16, 0);
+		syscall(__NR_lseek, -1, 0, i % 6);
+		syscall(__NR_madvise, 1, 0, i % 32);
+		syscall(__NR_openat, -1, "", i * 0x10101 & 0xfffff, 0);
+		syscall(__NR_setsockopt, -1, levels[i % ARRAY_SIZE(levels)],
+			i % 80, 0, 0);
+		syscall(__NR_socket, i % 48, 0xff, 0);
+	}
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_fcntl && __NR_lseek && __NR_madvise"
+		    " && __NR_openat && __NR_setsockopt && __NR_socket")
+
+#endif
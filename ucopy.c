@@ -13,11 +13,14 @@
  */
 
 #include "defs.h"
+#include <fcntl.h>
 #include <sys/uio.h>
 #include <asm/unistd.h>
 
+#include "bintrace.h"
 #include "scno.h"
 #include "ptrace.h"
+#include "xstring.h"
 
 static bool process_vm_readv_not_supported;
 
@@ -70,6 +73,340 @@ vm_read_mem(const pid_t pid, void *const laddr,
 	return rc;
 }
 
+/*
+ * Methods of reading tracee memory, in the order of preference.
+ * Every tracee starts with process_vm_readv; when a read turns out
+ * to be not permitted, umove_fallback chooses the next method, which
+ * is kept in the cold part of the tcb until the tracee calls execve.
+ */
+enum umove_method {
+	UMOVE_METHOD_VM_READV,	/* process_vm_readv */
+	UMOVE_METHOD_PROC_MEM,	/* pread from /proc/PID/mem */
+	UMOVE_METHOD_PEEKDATA,	/* PTRACE_PEEKDATA, a word at a time */
+};
+
+static const char *const umove_method_names[] = {
+	[UMOVE_METHOD_VM_READV]	= "process_vm_readv",
+	[UMOVE_METHOD_PROC_MEM]	= "/proc/pid/mem",
+	[UMOVE_METHOD_PEEKDATA]	= "PTRACE_PEEKDATA",
+};
+
+static bool
+proc_mem_open(struct tcb *const tcp)
+{
+	char path[sizeof("/proc/%u/mem") + sizeof(int)*3];
+
+	xsprintf(path, "/proc/%u/mem", tcp->pid);
+	tcp->cold->mem_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	return tcp->cold->mem_fd >= 0;
+}
+
+/*
+ * Choose the first method starting with `method' that is permitted
+ * for the tracee other than process_vm_readv; /proc/PID/mem checks
+ * the permission when it is opened.
+ */
+static void
+umove_probe(struct tcb *const tcp, unsigned int method)
+{
+	struct tcb_cold *const cold = get_tcb_cold(tcp);
+
+	if (method <= UMOVE_METHOD_PROC_MEM && proc_mem_open(tcp))
+		method = UMOVE_METHOD_PROC_MEM;
+	else
+		method = UMOVE_METHOD_PEEKDATA;
+
+	cold->umove_method = method;
+	debug_msg("pid %d: reading memory using %s",
+		  tcp->pid, umove_method_names[method]);
+}
+
+static unsigned int
+umove_method(struct tcb *const tcp)
+{
+	if (tcp->cold && tcp->cold->umove_method != UMOVE_METHOD_VM_READV)
+		return tcp->cold->umove_method;
+
+	if (process_vm_readv_not_supported) {
+		umove_probe(tcp, UMOVE_METHOD_PROC_MEM);
+		return tcp->cold->umove_method;
+	}
+
+	return UMOVE_METHOD_VM_READV;
+}
+
+/* The current method has turned out to be not permitted, try the next one.  */
+static void
+umove_fallback(struct tcb *const tcp)
+{
+	const unsigned int method = umove_method(tcp);
+
+	reset_umove_method(tcp);
+	umove_probe(tcp, method + 1);
+}
+
+void
+reset_umove_method(struct tcb *const tcp)
+{
+	if (!tcp->cold)
+		return;
+	if (tcp->cold->umove_method == UMOVE_METHOD_PROC_MEM)
+		close(tcp->cold->mem_fd);
+	tcp->cold->umove_method = UMOVE_METHOD_VM_READV;
+}
+
+static ssize_t
+proc_mem_read(struct tcb *const tcp, void *const laddr,
+	      const kernel_ulong_t raddr, const size_t len)
+{
+	if ((kernel_ulong_t) (off_t) raddr != raddr) {
+		errno = EIO;
+		return -1;
+	}
+
+	ssize_t rc = pread(tcp->cold->mem_fd, laddr, len, (off_t) raddr);
+	if (rc || !len)
+		return rc;
+
+	/*
+	 * The address space the descriptor refers to is gone,
+	 * e.g. the tracee has called execve, reopen it once.
+	 */
+	close(tcp->cold->mem_fd);
+	if (!proc_mem_open(tcp)) {
+		tcp->cold->umove_method = UMOVE_METHOD_VM_READV;
+		errno = ESRCH;
+		return -1;
+	}
+
+	rc = pread(tcp->cold->mem_fd, laddr, len, (off_t) raddr);
+	if (!rc)
+		errno = ESRCH;
+	return rc ? rc : -1;
+}
+
+/*
+ * Read memory of the tracee using its current method,
+ * which is not PTRACE_PEEKDATA.
+ */
+static ssize_t
+read_mem(struct tcb *const tcp, void *const laddr,
+	 const kernel_ulong_t raddr, const size_t len)
+{
+	if (umove_method(tcp) == UMOVE_METHOD_PROC_MEM)
+		return proc_mem_read(tcp, laddr, raddr, len);
+
+	return vm_read_mem(tcp->pid, laddr, raddr, len);
+}
+
+/*
+ * Cache of tracee memory pages.  Decoders fetch many small objects
+ * while printing a single event, often from the same pages, so pages
+ * are read from the tracee as a whole and kept until the tracee
+ * is restarted, see invalidate_umove_cache.
+ * The cache is direct-mapped by the page address.
+ */
+#define UMOVE_CACHE_PAGES	16
+
+static struct {
+	int pid;
+	bool valid[UMOVE_CACHE_PAGES];
+	kernel_ulong_t addr[UMOVE_CACHE_PAGES];
+	char *data;
+	unsigned long hits;
+	unsigned long misses;
+} umove_cache;
+
+/* Cache pages to be read from the tracee with a single syscall.  */
+struct umove_cache_fill {
+	struct iovec local[UMOVE_CACHE_PAGES];
+	struct iovec remote[UMOVE_CACHE_PAGES];
+	unsigned int slots[UMOVE_CACHE_PAGES];
+	unsigned int n;
+};
+
+void
+invalidate_umove_cache(void)
+{
+	umove_cache.pid = 0;
+}
+
+void
+print_umove_cache_stats(void)
+{
+	debug_msg("umove cache: %lu hits, %lu misses",
+		  umove_cache.hits, umove_cache.misses);
+}
+
+/*
+ * Calculate the addresses of the first and the last page
+ * of `len' bytes at address `addr'.
+ *
+ * Returns false if the range cannot be cached.
+ */
+static bool
+umove_cache_range(const kernel_ulong_t addr, const kernel_ulong_t len,
+		  kernel_ulong_t *const first, kernel_ulong_t *const last)
+{
+	const kernel_ulong_t page_mask = -(kernel_ulong_t) get_pagesize();
+
+	if (!len || addr + len - 1 < addr)
+		return false;
+
+	*first = addr & page_mask;
+	*last = (addr + len - 1) & page_mask;
+
+#if SIZEOF_LONG < SIZEOF_KERNEL_LONG_T
+	if (*last != (kernel_ulong_t) (unsigned long) *last)
+		return false;
+#endif
+
+	return true;
+}
+
+static unsigned int
+umove_cache_slot(const kernel_ulong_t page)
+{
+	return (page / get_pagesize()) % UMOVE_CACHE_PAGES;
+}
+
+static void
+umove_cache_start(const int pid)
+{
+	if (!umove_cache.data)
+		umove_cache.data = xcalloc(UMOVE_CACHE_PAGES, get_pagesize());
+
+	if (umove_cache.pid != pid) {
+		memset(umove_cache.valid, 0, sizeof(umove_cache.valid));
+		umove_cache.pid = pid;
+	}
+}
+
+/*
+ * Add the page at address `page' to `fill' unless it is cached already.
+ *
+ * Returns false if the cache slot of the page is taken
+ * by another page of `fill'.
+ */
+static bool
+umove_cache_add(struct umove_cache_fill *const fill,
+		const kernel_ulong_t page)
+{
+	const size_t page_size = get_pagesize();
+	const unsigned int slot = umove_cache_slot(page);
+
+	if (umove_cache.addr[slot] == page) {
+		if (umove_cache.valid[slot])
+			return true;
+		for (unsigned int i = 0; i < fill->n; ++i) {
+			if (fill->slots[i] == slot)
+				return true;
+		}
+	} else {
+		for (unsigned int i = 0; i < fill->n; ++i) {
+			if (fill->slots[i] == slot)
+				return false;
+		}
+	}
+
+	umove_cache.valid[slot] = false;
+	umove_cache.addr[slot] = page;
+
+	fill->local[fill->n].iov_base = umove_cache.data + slot * page_size;
+	fill->local[fill->n].iov_len = page_size;
+	fill->remote[fill->n].iov_base = (void *) (unsigned long) page;
+	fill->remote[fill->n].iov_len = page_size;
+	fill->slots[fill->n] = slot;
+	++fill->n;
+
+	return true;
+}
+
+/*
+ * Read all pages of `fill' from the tracee at once.
+ *
+ * Returns true if all of them have been read.
+ */
+static bool
+umove_cache_read_pages(struct tcb *const tcp,
+		       const struct umove_cache_fill *const fill)
+{
+	if (!fill->n)
+		return true;
+
+	const size_t page_size = get_pagesize();
+	ssize_t rc;
+
+	if (umove_method(tcp) == UMOVE_METHOD_VM_READV) {
+		rc = process_vm_readv(tcp->pid, fill->local, fill->n,
+				      fill->remote, fill->n, 0);
+	} else {
+		/* pread cannot scatter, read the pages one by one.  */
+		rc = 0;
+		for (unsigned int i = 0; i < fill->n; ++i) {
+			if (proc_mem_read(tcp, fill->local[i].iov_base,
+					  (unsigned long) fill->remote[i].iov_base,
+					  page_size) != (ssize_t) page_size)
+				break;
+			rc += page_size;
+		}
+	}
+
+	for (unsigned int i = 0; i < fill->n; ++i)
+		umove_cache.valid[fill->slots[i]] =
+			rc >= (ssize_t) ((i + 1) * page_size);
+
+	return rc == (ssize_t) (fill->n * page_size);
+}
+
+/*
+ * Copy `len' bytes at address `addr' of the tracee using the cache,
+ * reading all missing pages at once.  Only reads that span at most
+ * two pages are served by the cache.
+ *
+ * Returns true on success, false if the caller has to read the memory
+ * by itself, e.g. to report the error properly.
+ */
+static bool
+umove_cache_read(struct tcb *const tcp, const kernel_ulong_t addr,
+		 const unsigned int len, char *const laddr)
+{
+	const size_t page_size = get_pagesize();
+	kernel_ulong_t first, last;
+
+	if (len > page_size || !umove_cache_range(addr, len, &first, &last))
+		return false;
+
+	umove_cache_start(tcp->pid);
+
+	struct umove_cache_fill fill = { .n = 0 };
+
+	umove_cache_add(&fill, first);
+	if (last != first)
+		umove_cache_add(&fill, last);
+
+	if (fill.n)
+		++umove_cache.misses;
+	else
+		++umove_cache.hits;
+
+	if (!umove_cache_read_pages(tcp, &fill))
+		return false;
+
+	const unsigned int offset = addr - first;
+	const unsigned int head = MIN(len, page_size - offset);
+
+	memcpy(laddr, umove_cache.data + umove_cache_slot(first) * page_size
+		      + offset, head);
+	if (head < len)
+		memcpy(laddr + head,
+		       umove_cache.data + umove_cache_slot(last) * page_size,
+		       len - head);
+
+	return true;
+}
+
 static bool
 tracee_addr_is_invalid(kernel_ulong_t addr)
 {
@@ -130,23 +467,22 @@ umoven_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 	return 0;
 }
 
-/*
- * Copy `len' bytes of data from process `pid'
- * at address `addr' to our space at `our_addr'.
- */
-int
-umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
-       void *const our_addr)
+static int
+umoven_tracee(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+	      void *const our_addr)
 {
 	if (tracee_addr_is_invalid(addr))
 		return -1;
 
 	const int pid = tcp->pid;
 
-	if (process_vm_readv_not_supported)
+	if (umove_method(tcp) == UMOVE_METHOD_PEEKDATA)
 		return umoven_peekdata(pid, addr, len, our_addr);
 
-	int r = vm_read_mem(pid, our_addr, addr, len);
+	if (umove_cache_read(tcp, addr, len, our_addr))
+		return 0;
+
+	int r = read_mem(tcp, our_addr, addr, len);
 	if ((unsigned int) r == len)
 		return 0;
 	if (r >= 0) {
@@ -157,8 +493,9 @@ umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 	switch (errno) {
 		case ENOSYS:
 		case EPERM:
-			/* try PTRACE_PEEKDATA */
-			return umoven_peekdata(pid, addr, len, our_addr);
+			/* try the next method */
+			umove_fallback(tcp);
+			return umoven_tracee(tcp, addr, len, our_addr);
 		case ESRCH:
 			/* the process is gone */
 			return -1;
@@ -167,12 +504,186 @@ umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 			return -1;
 		default:
 			/* all the rest is strange and should be reported */
-			perror_msg("process_vm_readv: pid:%d @0x%" PRI_klx,
-				    pid, addr);
+			perror_msg("%s: pid:%d @0x%" PRI_klx,
+				   umove_method_names[umove_method(tcp)],
+				   pid, addr);
 			return -1;
 	}
 }
 
+/*
+ * Copy `len' bytes of data from process `pid'
+ * at address `addr' to our space at `our_addr'.
+ */
+int
+umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+       void *const our_addr)
+{
+	if (bintrace_replaying)
+		return bintrace_replay_umove(BINTRACE_BLOB_UMOVEN,
+					     addr, len, our_addr);
+
+	const int rc = umoven_tracee(tcp, addr, len, our_addr);
+
+	if (bintrace_recording)
+		bintrace_record_umove(BINTRACE_BLOB_UMOVEN,
+				      addr, len, our_addr, len, rc);
+	return rc;
+}
+
+/* The maximum number of requests umoven_batch reads at once.  */
+#define UMOVEN_BATCH_MAX	256
+
+int
+umoven_batch(struct tcb *const tcp, struct umove_req *const reqs,
+	     const unsigned int n)
+{
+	int rc = 0;
+
+	if (bintrace_replaying) {
+		for (unsigned int i = 0; i < n; ++i) {
+			reqs[i].rc = umoven(tcp, reqs[i].addr, reqs[i].len,
+					    reqs[i].laddr);
+			if (reqs[i].rc < 0)
+				rc = -1;
+		}
+		return rc;
+	}
+
+	for (unsigned int i = 0; i < n;) {
+		struct iovec local[UMOVEN_BATCH_MAX];
+		struct iovec remote[UMOVEN_BATCH_MAX];
+		unsigned int cnt = 0;
+
+		for (; umove_method(tcp) == UMOVE_METHOD_VM_READV && i + cnt < n
+		       && cnt < UMOVEN_BATCH_MAX; ++cnt) {
+			const struct umove_req *const r = &reqs[i + cnt];
+
+			if (tracee_addr_is_invalid(r->addr))
+				break;
+#if SIZEOF_LONG < SIZEOF_KERNEL_LONG_T
+			if (r->addr != (kernel_ulong_t) (unsigned long) r->addr)
+				break;
+#endif
+			local[cnt].iov_base = r->laddr;
+			local[cnt].iov_len = r->len;
+			remote[cnt].iov_base = (void *) (unsigned long) r->addr;
+			remote[cnt].iov_len = r->len;
+		}
+
+		const unsigned int batched = cnt;
+		ssize_t got = cnt ? process_vm_readv(tcp->pid, local, cnt,
+						     remote, cnt, 0) : -1;
+		if (got < 0) {
+			if (cnt && errno == ENOSYS)
+				process_vm_readv_not_supported = true;
+			got = 0;
+		}
+
+		/* Requests that have been read in full.  */
+		for (; cnt && (size_t) got >= reqs[i].len; --cnt, ++i) {
+			got -= reqs[i].len;
+			reqs[i].rc = 0;
+			if (bintrace_recording)
+				bintrace_record_umove(BINTRACE_BLOB_UMOVEN,
+						      reqs[i].addr, reqs[i].len,
+						      reqs[i].laddr,
+						      reqs[i].len, 0);
+		}
+
+		/*
+		 * The request the read has stopped at, or the request
+		 * that cannot be read using process_vm_readv at all:
+		 * fall back to umoven that handles all the errors.
+		 */
+		if (cnt || !batched) {
+			reqs[i].rc = umoven(tcp, reqs[i].addr, reqs[i].len,
+					    reqs[i].laddr);
+			if (reqs[i].rc < 0)
+				rc = -1;
+			++i;
+		}
+	}
+
+	return rc;
+}
+
+unsigned int
+umove_pages(struct tcb *const tcp, const kernel_ulong_t addr,
+	    const unsigned int n, void *const laddr)
+{
+	const size_t page_size = get_pagesize();
+
+	if (tracee_addr_is_invalid(addr))
+		return 0;
+
+	if (umove_method(tcp) == UMOVE_METHOD_VM_READV
+	    && n <= UMOVE_CACHE_PAGES) {
+		struct iovec local[UMOVE_CACHE_PAGES];
+		struct iovec remote[UMOVE_CACHE_PAGES];
+
+		/*
+		 * process_vm_readv does not split iovec elements,
+		 * so there is one element per page.
+		 */
+		for (unsigned int i = 0; i < n; ++i) {
+			local[i].iov_base = (char *) laddr + i * page_size;
+			local[i].iov_len = page_size;
+			remote[i].iov_base =
+				(void *) (unsigned long) (addr + i * page_size);
+			remote[i].iov_len = page_size;
+		}
+
+		ssize_t rc = process_vm_readv(tcp->pid, local, n,
+					      remote, n, 0);
+		if (rc >= 0)
+			return rc / page_size;
+		if (errno != ENOSYS && errno != EPERM)
+			return 0;
+	}
+
+	/* Let umoven handle the fallback to other methods.  */
+	unsigned int i;
+	for (i = 0; i < n; ++i) {
+		if (umoven(tcp, addr + i * page_size, page_size,
+			   (char *) laddr + i * page_size))
+			break;
+	}
+
+	return i;
+}
+
+void
+umove_prefetch(struct tcb *const tcp, const struct umove_req *const reqs,
+	       const unsigned int n)
+{
+	if (bintrace_replaying || umove_method(tcp) != UMOVE_METHOD_VM_READV)
+		return;
+
+	const size_t page_size = get_pagesize();
+	struct umove_cache_fill fill = { .n = 0 };
+
+	umove_cache_start(tcp->pid);
+
+	for (unsigned int i = 0; i < n && fill.n < UMOVE_CACHE_PAGES; ++i) {
+		kernel_ulong_t first, last;
+
+		if (tracee_addr_is_invalid(reqs[i].addr)
+		    || !umove_cache_range(reqs[i].addr, reqs[i].len,
+					  &first, &last))
+			continue;
+
+		kernel_ulong_t page = first;
+		for (unsigned int k = 0; k < UMOVE_CACHE_PAGES
+		     && fill.n < UMOVE_CACHE_PAGES
+		     && umove_cache_add(&fill, page)
+		     && page != last; ++k)
+			page += page_size;
+	}
+
+	umove_cache_read_pages(tcp, &fill);
+}
+
 /*
  * Like umoven_peekdata but make the additional effort of looking
  * for a terminating zero byte.
@@ -229,27 +740,16 @@ umovestr_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 	return 0;
 }
 
-/*
- * Like `umove' but make the additional effort of looking
- * for a terminating zero byte.
- *
- * Returns < 0 on error, strlen + 1  if NUL was seen,
- * else 0 if len bytes were read but no NUL byte seen.
- *
- * Note: there is no guarantee we won't overwrite some bytes
- * in laddr[] _after_ terminating NUL (but, of course,
- * we never write past laddr[len-1]).
- */
-int
-umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
-	 char *laddr)
+static int
+umovestr_tracee(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+		char *laddr)
 {
 	if (tracee_addr_is_invalid(addr))
 		return -1;
 
 	const int pid = tcp->pid;
 
-	if (process_vm_readv_not_supported)
+	if (umove_method(tcp) == UMOVE_METHOD_PEEKDATA)
 		return umovestr_peekdata(pid, addr, len, laddr);
 
 	const size_t page_size = get_pagesize();
@@ -267,7 +767,9 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 		if (chunk_len > end_in_page) /* crosses to the next page */
 			chunk_len -= end_in_page;
 
-		int r = vm_read_mem(pid, laddr, addr, chunk_len);
+		int r = umove_cache_read(tcp, addr, chunk_len, laddr)
+			? (int) chunk_len
+			: read_mem(tcp, laddr, addr, chunk_len);
 		if (r > 0) {
 			char *nul_addr = memchr(laddr, '\0', r);
 
@@ -282,11 +784,12 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 		switch (errno) {
 			case ENOSYS:
 			case EPERM:
-				/* try PTRACE_PEEKDATA */
-				if (!nread)
-					return umovestr_peekdata(pid, addr,
-								 len, laddr);
-				ATTRIBUTE_FALLTHROUGH;
+				/* try the next method */
+				umove_fallback(tcp);
+				if (umove_method(tcp) != UMOVE_METHOD_PEEKDATA)
+					continue;
+				r = umovestr_peekdata(pid, addr, len, laddr);
+				return r > 0 ? (int) nread + r : r;
 			case EFAULT: case EIO:
 				/* address space is inaccessible */
 				if (nread)
@@ -298,11 +801,41 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 				return -1;
 			default:
 				/* all the rest is strange and should be reported */
-				perror_msg("process_vm_readv: pid:%d @0x%" PRI_klx,
-					    pid, addr);
+				perror_msg("%s: pid:%d @0x%" PRI_klx,
+					   umove_method_names[umove_method(tcp)],
+					   pid, addr);
 				return -1;
 		}
 	}
 
 	return 0;
 }
+
+/*
+ * Like `umove' but make the additional effort of looking
+ * for a terminating zero byte.
+ *
+ * Returns < 0 on error, strlen + 1  if NUL was seen,
+ * else 0 if len bytes were read but no NUL byte seen.
+ *
+ * Note: there is no guarantee we won't overwrite some bytes
+ * in laddr[] _after_ terminating NUL (but, of course,
+ * we never write past laddr[len-1]).
+ */
+int
+umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+	 char *laddr)
+{
+	if (bintrace_replaying)
+		return bintrace_replay_umove(BINTRACE_BLOB_UMOVESTR,
+					     addr, len, laddr);
+
+	const int rc = umovestr_tracee(tcp, addr, len, laddr);
+
+	/* The bytes past the terminating NUL are not valid.  */
+	if (bintrace_recording)
+		bintrace_record_umove(BINTRACE_BLOB_UMOVESTR, addr, len, laddr,
+				      rc > 0 ? strnlen(laddr, len) + 1 : len,
+				      rc);
+	return rc;
+}
@@ -0,0 +1,217 @@
+/*
+ * Frame pointer unwinder.
+ *
+ * Copyright (c) 2019 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "unwind.h"
+#include "mmap_cache.h"
+
+/*
+ * The stack is read in chunks of this many pages, a chunk usually holds
+ * all frames of the stack.
+ */
+#define STACK_CHUNK_PAGES	4
+
+struct stack_chunk {
+	unsigned long start;
+	unsigned long end;
+	unsigned long *data;
+};
+
+static struct {
+	unsigned long walks;
+	unsigned long fallbacks;
+} fp_stats;
+
+static void
+init(void)
+{
+	mmap_cache_enable();
+
+	if (unwinder.init)
+		unwinder.init();
+}
+
+static void *
+tcb_init(struct tcb *tcp)
+{
+	return unwinder.tcb_init(tcp);
+}
+
+static void
+tcb_fin(struct tcb *tcp)
+{
+	unwinder.tcb_fin(tcp);
+}
+
+/*
+ * Read the pages of the stack starting at the page of address addr,
+ * the read stops at the first page that cannot be read, e.g. past
+ * the end of the stack.
+ */
+static void
+read_chunk(struct tcb *tcp, struct stack_chunk *chunk, unsigned long addr)
+{
+	const unsigned long page_size = get_pagesize();
+
+	if (!chunk->data)
+		chunk->data = xcalloc(STACK_CHUNK_PAGES, page_size);
+
+	chunk->start = addr & -page_size;
+	chunk->end = chunk->start
+		     + umove_pages(tcp, chunk->start, STACK_CHUNK_PAGES,
+				   chunk->data) * page_size;
+}
+
+/*
+ * Fetch the word of the stack at address addr,
+ * reading the chunk of the stack that contains it if needed.
+ */
+static bool
+fetch_word(struct tcb *tcp, struct stack_chunk *chunk,
+	   unsigned long addr, unsigned long *word)
+{
+	if (addr % sizeof(*word))
+		return false;
+
+	if (addr < chunk->start || addr >= chunk->end) {
+		read_chunk(tcp, chunk, addr);
+		if (addr >= chunk->end)
+			return false;
+	}
+
+	*word = chunk->data[(addr - chunk->start) / sizeof(*word)];
+	return true;
+}
+
+static bool
+is_code_address(struct tcb *tcp, unsigned long addr)
+{
+	struct mmap_cache_entry_t *entry = mmap_cache_search(tcp, addr);
+
+	return entry && (entry->protections & MMAP_CACHE_PROT_EXECUTABLE);
+}
+
+/*
+ * Walk the chain of frame records: the frame pointer points
+ * to the saved frame pointer of the caller followed by the return
+ * address.  Return the number of program counters stored in pcs,
+ * or 0 if the chain looks broken, e.g. the code has been compiled
+ * without frame pointers.  If the chain breaks after some frames
+ * have been stored, the reason is stored in *error.
+ */
+static unsigned int
+walk_frame_pointers(struct tcb *tcp, unsigned long *pcs, unsigned int size,
+		    const char **error)
+{
+	kernel_ulong_t pc, sp, fp;
+
+	if (!get_instruction_pointer(tcp, &pc)
+	    || !get_stack_pointer(tcp, &sp)
+	    || !get_frame_pointer(tcp, &fp))
+		return 0;
+
+	switch (mmap_cache_rebuild_if_invalid(tcp, __func__)) {
+	case MMAP_CACHE_REBUILD_READY:
+	case MMAP_CACHE_REBUILD_RENEWED:
+		break;
+	default:
+		return 0;
+	}
+
+	static struct stack_chunk chunk;
+	chunk.start = chunk.end = 0;
+
+	unsigned int count = 0;
+	unsigned long word;
+
+	pcs[count++] = pc;
+
+	/*
+	 * The function the tracee is stopped in may have not set up
+	 * its frame record, syscall wrappers usually do not: if the word
+	 * at the stack pointer is a code address, it is the return address.
+	 */
+	if (fp != sp && fetch_word(tcp, &chunk, sp, &word)
+	    && is_code_address(tcp, word))
+		pcs[count++] = word - 1;
+
+	const unsigned int first_frame = count;
+
+	/* Frame records of callers are above the frame record of the callee.  */
+	for (unsigned long min_fp = sp; fp; ) {
+		unsigned long ret;
+
+		if (fp < min_fp
+		    || !fetch_word(tcp, &chunk, fp + sizeof(word), &ret)
+		    || !fetch_word(tcp, &chunk, fp, &word)
+		    || !ret) {
+			*error = "unexpected_backtracing_error";
+			break;
+		}
+
+		/*
+		 * The outermost frames may have no frame records:
+		 * the chain ends at the first return address
+		 * outside of the code.
+		 */
+		if (!is_code_address(tcp, ret))
+			break;
+
+		if (count >= size) {
+			*error = "too many stack frames";
+			break;
+		}
+		pcs[count++] = ret - 1;
+		min_fp = fp + 2 * sizeof(word);
+		fp = word;
+	}
+
+	return count > first_frame ? count : 0;
+}
+
+static unsigned int
+tcb_capture(struct tcb *tcp, unsigned long *pcs, unsigned int size,
+	    const char **error)
+{
+	unsigned int count = walk_frame_pointers(tcp, pcs, size, error);
+
+	if (!count) {
+		++fp_stats.fallbacks;
+		*error = NULL;
+		return unwinder.tcb_capture(tcp, pcs, size, error);
+	}
+
+	++fp_stats.walks;
+	if (unwinder.tcb_sync)
+		unwinder.tcb_sync(tcp);
+	return count;
+}
+
+static void
+tcb_resolve(struct tcb *tcp, const unsigned long *pcs, unsigned int count,
+	    unwind_call_action_fn call_action, void *data)
+{
+	unwinder.tcb_resolve(tcp, pcs, count, call_action, data);
+}
+
+void
+print_unwind_fp_stats(void)
+{
+	debug_msg("frame pointer unwinder: %lu walks, %lu DWARF fallbacks",
+		  fp_stats.walks, fp_stats.fallbacks);
+}
+
+const struct unwind_unwinder_t unwinder_fp = {
+	.name = "fp",
+	.init = init,
+	.tcb_init = tcb_init,
+	.tcb_fin = tcb_fin,
+	.tcb_capture = tcb_capture,
+	.tcb_resolve = tcb_resolve,
+};
@@ -19,23 +19,39 @@
 #include "mmap_notify.h"
 #include <elfutils/libdwfl.h>
 
+/*
+ * All threads of a process share the address space, so one Dwfl
+ * is kept per thread group and is referenced by the tcbs of its threads.
+ */
 struct ctx {
+	struct ctx *next;
 	Dwfl *dwfl;
-	unsigned int last_proc_updating;
+	int tgid;
+	unsigned int refcnt;
+	bool mappings_changed;
 };
 
-static unsigned int mapping_generation;
+/* Contexts of all thread groups.  */
+static struct ctx *ctxs;
 
 static void
-update_mapping_generation(struct tcb *tcp, void *unused)
+invalidate_mappings(struct tcb *tcp, bool decoded, void *unused)
 {
-	mapping_generation++;
+	if (mmap_notify_vm_shared()) {
+		for (struct ctx *ctx = ctxs; ctx; ctx = ctx->next)
+			ctx->mappings_changed = true;
+	} else {
+		struct ctx *ctx = tcp->unwind_ctx;
+
+		if (ctx)
+			ctx->mappings_changed = true;
+	}
 }
 
 static void
 init(void)
 {
-	mmap_notify_register_client(update_mapping_generation, NULL);
+	mmap_notify_register_client(invalidate_mappings, NULL);
 }
 
 static void *
@@ -46,13 +62,28 @@ tcb_init(struct tcb *tcp)
 		.find_debuginfo = dwfl_standard_find_debuginfo
 	};
 
+	int tgid;
+	unsigned int threads;
+
+	if (!read_thread_group(tcp->pid, &tgid, &threads))
+		tgid = tcp->pid;
+
+	struct ctx *ctx;
+
+	for (ctx = ctxs; ctx; ctx = ctx->next) {
+		if (ctx->tgid == tgid) {
+			++ctx->refcnt;
+			return ctx;
+		}
+	}
+
 	Dwfl *dwfl = dwfl_begin(&proc_callbacks);
 	if (dwfl == NULL) {
 		error_msg("dwfl_begin: %s", dwfl_errmsg(-1));
 		return NULL;
 	}
 
-	int r = dwfl_linux_proc_attach(dwfl, tcp->pid, true);
+	int r = dwfl_linux_proc_attach(dwfl, tgid, true);
 	if (r) {
 		const char *msg = NULL;
 
@@ -62,14 +93,18 @@ tcb_init(struct tcb *tcp)
 			msg = strerror(r);
 
 		error_msg("dwfl_linux_proc_attach returned an error"
-			  " for process %d: %s", tcp->pid, msg);
+			  " for process %d: %s", tgid, msg);
 		dwfl_end(dwfl);
 		return NULL;
 	}
 
-	struct ctx *ctx = xmalloc(sizeof(*ctx));
+	ctx = xmalloc(sizeof(*ctx));
 	ctx->dwfl = dwfl;
-	ctx->last_proc_updating = 0;
+	ctx->tgid = tgid;
+	ctx->refcnt = 1;
+	ctx->mappings_changed = true;
+	ctx->next = ctxs;
+	ctxs = ctx;
 	return ctx;
 }
 
@@ -77,10 +112,18 @@ static void
 tcb_fin(struct tcb *tcp)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
-	if (ctx) {
-		dwfl_end(ctx->dwfl);
-		free(ctx);
+	if (!ctx || --ctx->refcnt)
+		return;
+
+	for (struct ctx **p = &ctxs; *p; p = &(*p)->next) {
+		if (*p == ctx) {
+			*p = ctx->next;
+			break;
+		}
 	}
+
+	dwfl_end(ctx->dwfl);
+	free(ctx);
 }
 
 static void
@@ -90,35 +133,56 @@ flush_cache_maybe(struct tcb *tcp)
 	if (!ctx)
 		return;
 
-	if (ctx->last_proc_updating == mapping_generation)
+	if (!ctx->mappings_changed)
 		return;
 
-	int r = dwfl_linux_proc_report(ctx->dwfl, tcp->pid);
+	/* Captured program counters refer to the reported mappings.  */
+	unwind_resolve_captured();
+
+	int r = dwfl_linux_proc_report(ctx->dwfl, ctx->tgid);
 
 	if (r < 0)
 		error_msg("dwfl_linux_proc_report returned an error"
-			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
+			  " for pid %d: %s", ctx->tgid, dwfl_errmsg(-1));
 	else if (r > 0)
 		error_msg("dwfl_linux_proc_report returned an error"
-			  " for pid %d", tcp->pid);
+			  " for pid %d", ctx->tgid);
 	else if (dwfl_report_end(ctx->dwfl, NULL, NULL) != 0)
 		error_msg("dwfl_report_end returned an error"
-			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
+			  " for pid %d: %s", ctx->tgid, dwfl_errmsg(-1));
 
-	ctx->last_proc_updating = mapping_generation;
+	ctx->mappings_changed = false;
 }
 
-struct frame_user_data {
-	unwind_call_action_fn call_action;
-	unwind_error_action_fn error_action;
-	void *data;
-	int stack_depth;
+struct symbol_data {
+	Dwfl_Module *mod;
+	Dwarf_Addr pc;
+};
+
+static const char *
+resolve_symbol(void *data, unwind_function_offset_t *function_offset)
+{
+	struct symbol_data *symbol_data = data;
+	GElf_Off off = 0;
+	GElf_Sym sym;
+	const char *symname =
+		dwfl_module_addrinfo(symbol_data->mod, symbol_data->pc,
+				     &off, &sym, NULL, NULL, NULL);
+
+	*function_offset = off;
+	return symname;
+}
+
+struct capture_data {
+	unsigned long *pcs;
+	unsigned int size;
+	unsigned int count;
 };
 
 static int
 frame_callback(Dwfl_Frame *state, void *arg)
 {
-	struct frame_user_data *user_data = arg;
+	struct capture_data *capture_data = arg;
 	Dwarf_Addr pc;
 	bool isactivation;
 
@@ -130,56 +194,79 @@ frame_callback(Dwfl_Frame *state, void *arg)
 	if (!isactivation)
 		pc--;
 
-	Dwfl *dwfl = dwfl_thread_dwfl(dwfl_frame_thread(state));
-	Dwfl_Module *mod = dwfl_addrmodule(dwfl, pc);
-	GElf_Off off = 0;
-
-	if (mod != NULL) {
-		const char *modname = NULL;
-		const char *symname = NULL;
-		GElf_Sym sym;
-		Dwarf_Addr true_offset = pc;
+	capture_data->pcs[capture_data->count++] = pc;
 
-		modname = dwfl_module_info(mod, NULL, NULL, NULL, NULL,
-					   NULL, NULL, NULL);
-		symname = dwfl_module_addrinfo(mod, pc, &off, &sym,
-					       NULL, NULL, NULL);
-		dwfl_module_relocate_address(mod, &true_offset);
-		user_data->call_action(user_data->data, modname, symname,
-				       off, true_offset);
-	}
-	/* Max number of frames to print reached? */
-	if (user_data->stack_depth-- == 0)
+	/* Max number of frames to capture reached? */
+	if (capture_data->count >= capture_data->size)
 		return DWARF_CB_ABORT;
 
 	return DWARF_CB_OK;
 }
 
-static void
-tcb_walk(struct tcb *tcp,
-	 unwind_call_action_fn call_action,
-	 unwind_error_action_fn error_action,
-	 void *data)
+static unsigned int
+tcb_capture(struct tcb *tcp, unsigned long *pcs, unsigned int size,
+	    const char **error)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
 	if (!ctx)
-		return;
+		return 0;
 
-	struct frame_user_data user_data = {
-		.call_action = call_action,
-		.error_action = error_action,
-		.data = data,
-		.stack_depth = 256,
+	struct capture_data capture_data = {
+		.pcs = pcs,
+		.size = size,
 	};
 
 	flush_cache_maybe(tcp);
 
 	int r = dwfl_getthread_frames(ctx->dwfl, tcp->pid, frame_callback,
-				      &user_data);
+				      &capture_data);
 	if (r)
-		error_action(data,
-			     r < 0 ? dwfl_errmsg(-1) : "too many stack frames",
-			     0);
+		*error = r < 0 ? dwfl_errmsg(-1) : "too many stack frames";
+
+	return capture_data.count;
+}
+
+/*
+ * The modules of ctx->dwfl are those reported when the program counters
+ * were captured: flush_cache_maybe resolves the captured program counters
+ * before it reports the changed mappings.
+ */
+static void
+tcb_resolve(struct tcb *tcp, const unsigned long *pcs, unsigned int count,
+	    unwind_call_action_fn call_action, void *data)
+{
+	struct ctx *ctx = tcp->unwind_ctx;
+	if (!ctx)
+		return;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		Dwarf_Addr pc = pcs[i];
+		Dwfl_Module *mod = dwfl_addrmodule(ctx->dwfl, pc);
+
+		if (mod == NULL)
+			continue;
+
+		const char *modname = NULL;
+		const char *symname = NULL;
+		unwind_function_offset_t off = 0;
+		Dwarf_Addr true_offset = pc;
+		struct symbol_data symbol_data = { mod, pc };
+		const unsigned char *build_id = NULL;
+		GElf_Addr bias;
+		int build_id_len = 0;
+
+		modname = dwfl_module_info(mod, NULL, NULL, NULL, NULL,
+					   NULL, NULL, NULL);
+		dwfl_module_relocate_address(mod, &true_offset);
+		if (dwfl_module_getelf(mod, &bias))
+			build_id_len = dwfl_module_build_id(mod, &build_id,
+							    &bias);
+		symname = unwind_symbolize(build_id_len > 0 ? build_id : NULL,
+					   build_id_len > 0 ? build_id_len : 0,
+					   true_offset, resolve_symbol,
+					   &symbol_data, &off);
+		call_action(data, modname, symname, off, true_offset);
+	}
 }
 
 const struct unwind_unwinder_t unwinder = {
@@ -187,5 +274,7 @@ const struct unwind_unwinder_t unwinder = {
 	.init = init,
 	.tcb_init = tcb_init,
 	.tcb_fin = tcb_fin,
-	.tcb_walk = tcb_walk,
+	.tcb_capture = tcb_capture,
+	.tcb_resolve = tcb_resolve,
+	.tcb_sync = flush_cache_maybe,
 };
@@ -59,6 +59,24 @@ get_symbol_name(unw_cursor_t *cursor, char **name,
 	}
 }
 
+struct symbol_data {
+	unw_cursor_t *cursor;
+	char **name;
+	size_t *size;
+};
+
+static const char *
+resolve_symbol(void *data, unwind_function_offset_t *function_offset)
+{
+	struct symbol_data *symbol_data = data;
+	unw_word_t offset;
+
+	get_symbol_name(symbol_data->cursor, symbol_data->name,
+			symbol_data->size, &offset);
+	*function_offset = offset;
+	return *symbol_data->name;
+}
+
 static int
 print_stack_frame(struct tcb *tcp,
 		  unwind_call_action_fn call_action,
@@ -80,15 +98,24 @@ print_stack_frame(struct tcb *tcp,
 	if (entry
 	    /* ignore mappings that have no PROT_EXEC bit set */
 	    && (entry->protections & MMAP_CACHE_PROT_EXECUTABLE)) {
-		unw_word_t function_offset;
-
-		get_symbol_name(cursor, symbol_name, symbol_name_size,
-				&function_offset);
+		unwind_function_offset_t function_offset;
+		struct symbol_data symbol_data = {
+			cursor, symbol_name, symbol_name_size
+		};
+		/* Files without an inode, e.g. [vdso], are not cached.  */
+		const unsigned long file_id[] = {
+			entry->major, entry->minor, entry->inode
+		};
 		unsigned long true_offset =
 			ip - entry->start_addr + entry->mmap_offset;
+		const char *name =
+			unwind_symbolize(entry->inode ? file_id : NULL,
+					 sizeof(file_id), true_offset,
+					 resolve_symbol, &symbol_data,
+					 &function_offset);
 		call_action(data,
 			    entry->binary_filename,
-			    *symbol_name,
+			    name,
 			    function_offset,
 			    true_offset);
 
@@ -6,7 +6,12 @@
  */
 
 #include "defs.h"
+#include <sys/mman.h>
+
+#include "mmap_notify.h"
+#include "syscall.h"
 #include "unwind.h"
+#include "xstring.h"
 
 #ifdef USE_DEMANGLE
 # if defined HAVE_DEMANGLE_H
@@ -17,27 +22,364 @@
 #endif
 
 /*
- * Type used in stacktrace capturing
+ * Type used in stacktrace capturing,
+ * the strings are interned.
  */
 struct call_t {
 	struct call_t *next;
-	char *output_line;
+	const char *binary_filename;
+	const char *symbol_name;
+	unwind_function_offset_t function_offset;
+	unsigned long true_offset;
+	const char *error;
 };
 
 struct unwind_queue_t {
 	struct call_t *tail;
 	struct call_t *head;
+
+	/*
+	 * Program counters captured by backend->tcb_capture,
+	 * they are resolved into calls before the queue is printed.
+	 */
+	struct tcb *tcp;
+	struct unwind_queue_t *next_captured;
+	unsigned long *pcs;
+	unsigned int pcs_count;
+	const char *capture_error;
+	bool captured;
+};
+
+#define UNWIND_MAX_FRAMES	256
+
+/*
+ * The stack profile: the number of calls, errors, and the total latency
+ * of syscalls issued from each stack, the frames of a stack are interned
+ * as a single string of names separated by semicolons, outermost first.
+ */
+struct profile_stack {
+	struct profile_stack *next;
+	const char *frames;
+	const char *sys_name;
+	unsigned int hash;
+	unsigned long calls;
+	unsigned long errors;
+	struct timespec time;
+};
+
+/*
+ * Stacks captured as program counters are mapped to their profile
+ * entries without resolving the program counters again.  Program
+ * counters are meaningful only within an address space, and only
+ * until code is mapped or unmapped, so the key includes the context
+ * of the unwinder, that is shared by the threads of a process,
+ * and the generation of the mappings.
+ */
+struct profile_pcs {
+	struct profile_pcs *next;
+	const void *space;
+	unsigned long generation;
+	kernel_ulong_t scno;
+	const char *error;
+	struct profile_stack *stack;
+	unsigned int hash;
+	unsigned int count;
+	unsigned long pcs[];
 };
 
+#define PROFILE_HASH_SIZE		(1U << 14)
+#define PROFILE_PCS_MAX_ENTRIES		(1U << 16)
+#define PROFILE_DEFAULT_TOP		20
+
+static void queue_uncapture(struct unwind_queue_t *queue);
+static void queue_resolve(struct unwind_queue_t *queue);
 static void queue_print(struct unwind_queue_t *queue);
+static void queue_clear(struct unwind_queue_t *queue);
+static void profile_invalidate(struct tcb *, bool decoded, void *);
+
+/* The unwinder selected by unwind_init.  */
+static const struct unwind_unwinder_t *backend = &unwinder;
+
+/* Queues holding captured program counters that are not resolved yet.  */
+static struct unwind_queue_t *captured_queues;
+
+/*
+ * The tcb whose stack trace is printed after it is restarted,
+ * before the next event is handled.
+ */
+static struct tcb *deferred_print_tcp;
+
+/*
+ * Interned strings: the names of files and symbols printed in stack
+ * traces are few, so they are kept until exit and compared by address.
+ */
+struct interned_str {
+	struct interned_str *next;
+	unsigned int hash;
+	char str[];
+};
+
+static struct interned_str **interned_strs;
+static unsigned int interned_strs_size;
+static unsigned int interned_strs_count;
+
+/*
+ * The symbolization cache maps a file offset within a file identified
+ * by its build-id, or by its device and inode numbers, to the symbol
+ * at that offset.  It is shared by all tracees and is bounded by LRU.
+ */
+struct symcache_entry {
+	struct symcache_entry *hash_next;
+	struct symcache_entry *lru_prev;
+	struct symcache_entry *lru_next;
+	const char *symbol_name;
+	unwind_function_offset_t function_offset;
+	unsigned long true_offset;
+	unsigned int hash;
+	unsigned int file_id_len;
+	unsigned char file_id[];
+};
+
+#define SYMCACHE_HASH_SIZE	(1U << 14)
+#define SYMCACHE_MAX_ENTRIES	(1U << 16)
+
+static struct symcache_entry *symcache[SYMCACHE_HASH_SIZE];
+/* The most recently used entry is symcache_lru.lru_next.  */
+static struct symcache_entry symcache_lru = {
+	.lru_prev = &symcache_lru,
+	.lru_next = &symcache_lru,
+};
+static unsigned int symcache_count;
+
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+} symcache_stats;
+
+static struct profile_stack *profile_stacks[PROFILE_HASH_SIZE];
+static unsigned int profile_stacks_count;
+static struct profile_pcs *profile_pcs[PROFILE_HASH_SIZE];
+static unsigned int profile_pcs_count;
+static unsigned long profile_generation;
+/* The number of stacks printed in a table, 0 means folded stacks.  */
+static unsigned int profile_top;
+
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long flushes;
+} profile_stats;
+
+static unsigned int
+hash_bytes(unsigned int hash, const void *const data, const size_t len)
+{
+	const unsigned char *const p = data;
+
+	for (size_t i = 0; i < len; ++i)
+		hash = (hash ^ p[i]) * 16777619U;
+
+	return hash;
+}
+
+static void
+grow_interned_strs(void)
+{
+	const unsigned int size = interned_strs_size ? interned_strs_size * 2
+						     : 1024;
+	struct interned_str **strs = xcalloc(size, sizeof(*strs));
+
+	for (unsigned int i = 0; i < interned_strs_size; ++i) {
+		struct interned_str *next;
+
+		for (struct interned_str *s = interned_strs[i]; s; s = next) {
+			next = s->next;
+			s->next = strs[s->hash & (size - 1)];
+			strs[s->hash & (size - 1)] = s;
+		}
+	}
+
+	free(interned_strs);
+	interned_strs = strs;
+	interned_strs_size = size;
+}
+
+static const char *
+intern(const char *const str)
+{
+	if (!str)
+		return NULL;
+
+	const size_t len = strlen(str);
+	const unsigned int hash = hash_bytes(2166136261U, str, len);
+
+	if (interned_strs_size) {
+		for (struct interned_str *s =
+			interned_strs[hash & (interned_strs_size - 1)];
+		     s; s = s->next) {
+			if (s->hash == hash && !strcmp(s->str, str))
+				return s->str;
+		}
+	}
+
+	if (interned_strs_count >= interned_strs_size)
+		grow_interned_strs();
+
+	struct interned_str *const s = xmalloc(sizeof(*s) + len + 1);
+	struct interned_str **const bucket =
+		&interned_strs[hash & (interned_strs_size - 1)];
+
+	s->hash = hash;
+	memcpy(s->str, str, len + 1);
+	s->next = *bucket;
+	*bucket = s;
+	++interned_strs_count;
+
+	return s->str;
+}
+
+static const char *
+intern_symbol_name(const char *const symbol_name)
+{
+#ifdef USE_DEMANGLE
+	if (symbol_name && symbol_name[0] != '\0') {
+		char *demangled_name =
+			cplus_demangle(symbol_name, DMGL_AUTO | DMGL_PARAMS);
 
-static const char asprintf_error_str[] = "???";
+		if (demangled_name) {
+			const char *const name = intern(demangled_name);
+
+			free(demangled_name);
+			return name;
+		}
+	}
+#endif
+	return intern(symbol_name);
+}
+
+static void
+lru_unlink(struct symcache_entry *const e)
+{
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void
+lru_push(struct symcache_entry *const e)
+{
+	e->lru_prev = &symcache_lru;
+	e->lru_next = symcache_lru.lru_next;
+	symcache_lru.lru_next->lru_prev = e;
+	symcache_lru.lru_next = e;
+}
+
+static void
+symcache_evict(void)
+{
+	struct symcache_entry *const e = symcache_lru.lru_prev;
+	struct symcache_entry **p = &symcache[e->hash & (SYMCACHE_HASH_SIZE - 1)];
+
+	while (*p != e)
+		p = &(*p)->hash_next;
+	*p = e->hash_next;
+
+	lru_unlink(e);
+	free(e);
+	--symcache_count;
+	++symcache_stats.evictions;
+}
+
+const char *
+unwind_symbolize(const void *const file_id, const size_t file_id_len,
+		 const unsigned long true_offset,
+		 unwind_resolve_fn resolve, void *const data,
+		 unwind_function_offset_t *const function_offset)
+{
+	if (!file_id) {
+		++symcache_stats.misses;
+		return intern_symbol_name(resolve(data, function_offset));
+	}
+
+	const unsigned int hash =
+		hash_bytes(hash_bytes(2166136261U, file_id, file_id_len),
+			   &true_offset, sizeof(true_offset));
+	struct symcache_entry **const bucket =
+		&symcache[hash & (SYMCACHE_HASH_SIZE - 1)];
+
+	for (struct symcache_entry *e = *bucket; e; e = e->hash_next) {
+		if (e->hash == hash && e->true_offset == true_offset
+		    && e->file_id_len == file_id_len
+		    && !memcmp(e->file_id, file_id, file_id_len)) {
+			++symcache_stats.hits;
+			lru_unlink(e);
+			lru_push(e);
+			*function_offset = e->function_offset;
+			return e->symbol_name;
+		}
+	}
+
+	++symcache_stats.misses;
+
+	const char *const symbol_name =
+		intern_symbol_name(resolve(data, function_offset));
+
+	if (symcache_count >= SYMCACHE_MAX_ENTRIES)
+		symcache_evict();
+
+	struct symcache_entry *const e = xmalloc(sizeof(*e) + file_id_len);
+
+	e->symbol_name = symbol_name;
+	e->function_offset = *function_offset;
+	e->true_offset = true_offset;
+	e->hash = hash;
+	e->file_id_len = file_id_len;
+	memcpy(e->file_id, file_id, file_id_len);
+	e->hash_next = *bucket;
+	*bucket = e;
+	lru_push(e);
+	++symcache_count;
+
+	return symbol_name;
+}
+
+void
+print_unwind_stats(void)
+{
+	const unsigned long lookups =
+		symcache_stats.hits + symcache_stats.misses;
+
+	debug_msg("symbol cache: %lu hits, %lu misses (%.1f%% hit rate),"
+		  " %lu evictions, %u strings",
+		  symcache_stats.hits, symcache_stats.misses,
+		  lookups ? 100.0 * symcache_stats.hits / lookups : 0.0,
+		  symcache_stats.evictions, interned_strs_count);
+
+	if (backend == &unwinder_fp)
+		print_unwind_fp_stats();
+
+	if (stack_profile_enabled)
+		debug_msg("stack profile: %lu hits, %lu misses, %lu flushes,"
+			  " %u stacks",
+			  profile_stats.hits, profile_stats.misses,
+			  profile_stats.flushes, profile_stacks_count);
+}
 
 void
 unwind_init(void)
 {
-	if (unwinder.init)
-		unwinder.init();
+	if (stack_trace_frame_pointers) {
+		if (!unwinder.tcb_capture || !unwinder.tcb_resolve)
+			error_msg_and_die("frame pointer stack traces are not"
+					  " supported by the %s unwinder",
+					  unwinder.name);
+		backend = &unwinder_fp;
+	}
+
+	if (backend->init)
+		backend->init();
+
+	if (stack_profile_enabled)
+		mmap_notify_register_client(profile_invalidate, NULL);
 }
 
 void
@@ -46,11 +388,10 @@ unwind_tcb_init(struct tcb *tcp)
 	if (tcp->unwind_queue)
 		return;
 
-	tcp->unwind_queue = xmalloc(sizeof(*tcp->unwind_queue));
-	tcp->unwind_queue->head = NULL;
-	tcp->unwind_queue->tail = NULL;
+	tcp->unwind_queue = xcalloc(1, sizeof(*tcp->unwind_queue));
+	tcp->unwind_queue->tcp = tcp;
 
-	tcp->unwind_ctx = unwinder.tcb_init(tcp);
+	tcp->unwind_ctx = backend->tcb_init(tcp);
 }
 
 void
@@ -59,11 +400,27 @@ unwind_tcb_fin(struct tcb *tcp)
 	if (!tcp->unwind_queue)
 		return;
 
-	queue_print(tcp->unwind_queue);
+	if (deferred_print_tcp == tcp)
+		deferred_print_tcp = NULL;
+
+	if (stack_profile_enabled) {
+		/*
+		 * The syscall captured on entering, e.g. exit_group,
+		 * does not finish, as with -c it is not counted.
+		 * The context may be reused by another address space.
+		 */
+		queue_uncapture(tcp->unwind_queue);
+		queue_clear(tcp->unwind_queue);
+		++profile_generation;
+	} else {
+		queue_resolve(tcp->unwind_queue);
+		queue_print(tcp->unwind_queue);
+	}
+	free(tcp->unwind_queue->pcs);
 	free(tcp->unwind_queue);
 	tcp->unwind_queue = NULL;
 
-	unwinder.tcb_fin(tcp);
+	backend->tcb_fin(tcp);
 	tcp->unwind_ctx = NULL;
 }
 
@@ -102,21 +459,8 @@ print_call_cb(void *dummy,
 	      unwind_function_offset_t function_offset,
 	      unsigned long true_offset)
 {
-	if (symbol_name && (symbol_name[0] != '\0')) {
-#ifdef USE_DEMANGLE
-		char *demangled_name =
-			cplus_demangle(symbol_name,
-				       DMGL_AUTO | DMGL_PARAMS);
-#endif
-		tprintf(STACK_ENTRY_SYMBOL_FMT(
-#ifdef USE_DEMANGLE
-					       demangled_name ? demangled_name :
-#endif
-					       symbol_name));
-#ifdef USE_DEMANGLE
-		free(demangled_name);
-#endif
-	}
+	if (symbol_name && (symbol_name[0] != '\0'))
+		tprintf(STACK_ENTRY_SYMBOL_FMT(symbol_name));
 	else if (binary_filename)
 		tprintf(STACK_ENTRY_NOSYMBOL_FMT);
 	else
@@ -138,49 +482,6 @@ print_error_cb(void *dummy,
 	line_ended();
 }
 
-static char *
-sprint_call_or_error(const char *binary_filename,
-		     const char *symbol_name,
-		     unwind_function_offset_t function_offset,
-		     unsigned long true_offset,
-		     const char *error)
-{
-	char *output_line = NULL;
-	int n;
-
-	if (symbol_name) {
-#ifdef USE_DEMANGLE
-		char *demangled_name =
-			cplus_demangle(symbol_name,
-				       DMGL_AUTO | DMGL_PARAMS);
-#endif
-		n = asprintf(&output_line,
-			     STACK_ENTRY_SYMBOL_FMT(
-#ifdef USE_DEMANGLE
-						    demangled_name ? demangled_name :
-#endif
-						    symbol_name));
-#ifdef USE_DEMANGLE
-		free(demangled_name);
-#endif
-	}
-	else if (binary_filename)
-		n = asprintf(&output_line, STACK_ENTRY_NOSYMBOL_FMT);
-	else if (error)
-		n = true_offset
-			? asprintf(&output_line, STACK_ENTRY_ERROR_WITH_OFFSET_FMT)
-			: asprintf(&output_line, STACK_ENTRY_ERROR_FMT);
-	else
-		n = asprintf(&output_line, STACK_ENTRY_BUG_FMT, __func__);
-
-	if (n < 0) {
-		perror_func_msg("asprintf");
-		output_line = (char *) asprintf_error_str;
-	}
-
-	return output_line;
-}
-
 /*
  * queue manipulators
  */
@@ -195,11 +496,11 @@ queue_put(struct unwind_queue_t *queue,
 	struct call_t *call;
 
 	call = xmalloc(sizeof(*call));
-	call->output_line = sprint_call_or_error(binary_filename,
-						 symbol_name,
-						 function_offset,
-						 true_offset,
-						 error);
+	call->binary_filename = intern(binary_filename);
+	call->symbol_name = symbol_name;
+	call->function_offset = function_offset;
+	call->true_offset = true_offset;
+	call->error = intern(error);
 	call->next = NULL;
 
 	if (!queue->head) {
@@ -234,6 +535,87 @@ queue_put_error(void *queue,
 	queue_put(queue, NULL, NULL, 0, ip, error);
 }
 
+/*
+ * Capture the program counters of the stack without resolving them.
+ */
+static void
+queue_capture(struct unwind_queue_t *queue)
+{
+	const char *error = NULL;
+
+	if (!queue->pcs)
+		queue->pcs = xcalloc(UNWIND_MAX_FRAMES, sizeof(*queue->pcs));
+
+	queue->pcs_count = backend->tcb_capture(queue->tcp, queue->pcs,
+						UNWIND_MAX_FRAMES, &error);
+	queue->capture_error = intern(error);
+	queue->captured = true;
+	queue->next_captured = captured_queues;
+	captured_queues = queue;
+}
+
+/*
+ * Remove the queue from the list of captured queues,
+ * its program counters are not resolved.
+ */
+static void
+queue_uncapture(struct unwind_queue_t *queue)
+{
+	if (!queue->captured)
+		return;
+
+	for (struct unwind_queue_t **p = &captured_queues; *p;
+	     p = &(*p)->next_captured) {
+		if (*p == queue) {
+			*p = queue->next_captured;
+			break;
+		}
+	}
+	queue->captured = false;
+}
+
+static void
+queue_resolve(struct unwind_queue_t *queue)
+{
+	if (!queue->captured)
+		return;
+
+	queue_uncapture(queue);
+
+	backend->tcb_resolve(queue->tcp, queue->pcs, queue->pcs_count,
+			     queue_put_call, queue);
+	if (queue->capture_error)
+		queue_put_error(queue, queue->capture_error, 0);
+}
+
+void
+unwind_resolve_captured(void)
+{
+	while (captured_queues)
+		queue_resolve(captured_queues);
+}
+
+static void
+queue_print_call(const struct call_t *call)
+{
+	const char *binary_filename = call->binary_filename;
+	unwind_function_offset_t function_offset = call->function_offset;
+	unsigned long true_offset = call->true_offset;
+	const char *error = call->error;
+
+	if (call->symbol_name)
+		tprintf(STACK_ENTRY_SYMBOL_FMT(call->symbol_name));
+	else if (binary_filename)
+		tprintf(STACK_ENTRY_NOSYMBOL_FMT);
+	else if (error) {
+		if (true_offset)
+			tprintf(STACK_ENTRY_ERROR_WITH_OFFSET_FMT);
+		else
+			tprintf(STACK_ENTRY_ERROR_FMT);
+	} else
+		tprintf(STACK_ENTRY_BUG_FMT, __func__);
+}
+
 static void
 queue_print(struct unwind_queue_t *queue)
 {
@@ -246,18 +628,28 @@ queue_print(struct unwind_queue_t *queue)
 		tmp = call;
 		call = call->next;
 
-		tprints(tmp->output_line);
+		queue_print_call(tmp);
 		line_ended();
 
-		if (tmp->output_line != asprintf_error_str)
-			free(tmp->output_line);
-
-		tmp->output_line = NULL;
 		tmp->next = NULL;
 		free(tmp);
 	}
 }
 
+static void
+queue_clear(struct unwind_queue_t *queue)
+{
+	struct call_t *call = queue->head;
+
+	queue->head = queue->tail = NULL;
+	while (call) {
+		struct call_t *next = call->next;
+
+		free(call);
+		call = next;
+	}
+}
+
 /*
  * printing stack
  */
@@ -270,12 +662,40 @@ unwind_tcb_print(struct tcb *tcp)
 		return;
 	}
 #endif
-	if (tcp->unwind_queue->head) {
+	if (stack_profile_enabled) {
+		/* Stacks are accounted by unwind_tcb_profile.  */
+		return;
+	}
+	if (backend->tcb_capture) {
+		/*
+		 * Only the program counters are captured while the tracee
+		 * is stopped, they are resolved and printed
+		 * by unwind_print_deferred.
+		 */
+		unwind_print_deferred();
+		if (!tcp->unwind_queue->head && !tcp->unwind_queue->captured)
+			queue_capture(tcp->unwind_queue);
+		deferred_print_tcp = tcp;
+	} else if (tcp->unwind_queue->head) {
 		debug_func_msg("head: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
 		queue_print(tcp->unwind_queue);
 	} else
-		unwinder.tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
+		backend->tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
+}
+
+void
+unwind_print_deferred(void)
+{
+	struct tcb *tcp = deferred_print_tcp;
+
+	if (!tcp)
+		return;
+
+	deferred_print_tcp = NULL;
+	set_current_tcp(tcp);
+	queue_resolve(tcp->unwind_queue);
+	queue_print(tcp->unwind_queue);
 }
 
 /*
@@ -290,12 +710,399 @@ unwind_tcb_capture(struct tcb *tcp)
 		return;
 	}
 #endif
-	if (tcp->unwind_queue->head)
+	if (tcp->unwind_queue->head || tcp->unwind_queue->captured)
 		error_msg_and_die("bug: unprinted entries in queue");
-	else {
+	else if (backend->tcb_capture) {
+		debug_func_msg("capture: tcp=%p, queue=%p",
+			       tcp, tcp->unwind_queue);
+		queue_capture(tcp->unwind_queue);
+	} else {
 		debug_func_msg("walk: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
-		unwinder.tcb_walk(tcp, queue_put_call, queue_put_error,
+		backend->tcb_walk(tcp, queue_put_call, queue_put_error,
 				  tcp->unwind_queue);
 	}
 }
+
+/*
+ * stack profile
+ */
+void
+set_stack_profile(const char *arg)
+{
+	if (!arg || !strcmp(arg, "folded")) {
+		profile_top = 0;
+	} else if (!strcmp(arg, "table")) {
+		profile_top = PROFILE_DEFAULT_TOP;
+	} else if (!strncmp(arg, "table:", sizeof("table:") - 1)) {
+		int top = string_to_uint(arg + sizeof("table:") - 1);
+
+		if (top <= 0)
+			error_msg_and_help("invalid --stack-profile argument:"
+					   " '%s'", arg);
+		profile_top = top;
+	} else {
+		error_msg_and_help("invalid --stack-profile argument: '%s'",
+				   arg);
+	}
+}
+
+/*
+ * The program counters of the stacks captured so far stay valid
+ * unless code is mapped or unmapped, so changes that are known
+ * to map no code keep them.
+ */
+static void
+profile_invalidate(struct tcb *tcp, bool decoded, void *unused)
+{
+	if (decoded && !syscall_tampered(tcp)) {
+		switch (tcp_sysent(tcp)->sen) {
+		case SEN_brk:
+		case SEN_munmap:
+			return;
+		case SEN_mmap:
+		case SEN_mmap_pgoff:
+		case SEN_mmap_4koff:
+		case SEN_mprotect:
+		case SEN_pkey_mprotect:
+			if (!(tcp->u_arg[2] & PROT_EXEC))
+				return;
+			break;
+		}
+	}
+
+	++profile_generation;
+}
+
+static void
+profile_flush_pcs(void)
+{
+	for (unsigned int i = 0; i < PROFILE_HASH_SIZE; ++i) {
+		struct profile_pcs *next;
+
+		for (struct profile_pcs *e = profile_pcs[i]; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+		profile_pcs[i] = NULL;
+	}
+
+	profile_pcs_count = 0;
+	++profile_stats.flushes;
+}
+
+static void
+append_str(char **const buf, size_t *const size, size_t *const len,
+	   const char *const str)
+{
+	const size_t str_len = strlen(str);
+
+	while (*len + str_len + 1 > *size)
+		*buf = xgrowarray(*buf, size, 1);
+
+	memcpy(*buf + *len, str, str_len + 1);
+	*len += str_len;
+}
+
+/*
+ * Return the profile entry of the stack resolved into the calls
+ * of the queue, innermost first, for the current syscall of tcp.
+ */
+static struct profile_stack *
+profile_stack_get(struct tcb *tcp, const struct unwind_queue_t *queue)
+{
+	static char *buf;
+	static size_t size;
+	size_t len = 0;
+	unsigned int ncalls = 0;
+
+	for (const struct call_t *call = queue->head; call; call = call->next)
+		++ncalls;
+
+	const struct call_t **const calls = xcalloc(ncalls + 1,
+						    sizeof(*calls));
+	unsigned int i = ncalls;
+
+	for (const struct call_t *call = queue->head; call; call = call->next)
+		calls[--i] = call;
+
+	append_str(&buf, &size, &len, "");
+	for (i = 0; i < ncalls; ++i) {
+		const struct call_t *const call = calls[i];
+
+		if (i)
+			append_str(&buf, &size, &len, ";");
+
+		if (call->symbol_name && call->symbol_name[0] != '\0') {
+			append_str(&buf, &size, &len, call->symbol_name);
+		} else if (call->binary_filename) {
+			char offset[sizeof("+0x") + sizeof(long) * 2];
+
+			xsprintf(offset, "+0x%lx", call->true_offset);
+			append_str(&buf, &size, &len, call->binary_filename);
+			append_str(&buf, &size, &len, offset);
+		} else if (call->error) {
+			append_str(&buf, &size, &len, "[");
+			append_str(&buf, &size, &len, call->error);
+			append_str(&buf, &size, &len, "]");
+		} else {
+			append_str(&buf, &size, &len, "[unknown]");
+		}
+	}
+	free(calls);
+
+	const char *const frames = intern(buf);
+	const char *const sys_name = intern(tcp_sysent(tcp)->sys_name);
+	const unsigned int hash =
+		hash_bytes(hash_bytes(2166136261U, &frames, sizeof(frames)),
+			   &sys_name, sizeof(sys_name));
+	struct profile_stack **const bucket =
+		&profile_stacks[hash & (PROFILE_HASH_SIZE - 1)];
+
+	for (struct profile_stack *s = *bucket; s; s = s->next) {
+		if (s->frames == frames && s->sys_name == sys_name)
+			return s;
+	}
+
+	struct profile_stack *const s = xcalloc(1, sizeof(*s));
+
+	s->frames = frames;
+	s->sys_name = sys_name;
+	s->hash = hash;
+	s->next = *bucket;
+	*bucket = s;
+	++profile_stacks_count;
+
+	return s;
+}
+
+/*
+ * Capture the stack of tcp and return its profile entry,
+ * resolving the program counters only if they have not been seen
+ * in the same address space before.
+ */
+static struct profile_stack *
+profile_capture(struct tcb *tcp)
+{
+	static unsigned long pcs[UNWIND_MAX_FRAMES];
+	static struct unwind_queue_t queue;
+	const char *error = NULL;
+	const unsigned int count =
+		backend->tcb_capture(tcp, pcs, UNWIND_MAX_FRAMES, &error);
+	const void *const space = tcp->unwind_ctx ? tcp->unwind_ctx
+						  : (void *) tcp;
+
+	error = intern(error);
+
+	unsigned int hash = 2166136261U;
+	hash = hash_bytes(hash, &space, sizeof(space));
+	hash = hash_bytes(hash, &profile_generation,
+			  sizeof(profile_generation));
+	hash = hash_bytes(hash, &tcp->scno, sizeof(tcp->scno));
+	hash = hash_bytes(hash, &error, sizeof(error));
+	hash = hash_bytes(hash, pcs, count * sizeof(pcs[0]));
+
+	struct profile_pcs **bucket =
+		&profile_pcs[hash & (PROFILE_HASH_SIZE - 1)];
+
+	for (struct profile_pcs *e = *bucket; e; e = e->next) {
+		if (e->hash == hash && e->space == space
+		    && e->generation == profile_generation
+		    && e->scno == tcp->scno && e->error == error
+		    && e->count == count
+		    && !memcmp(e->pcs, pcs, count * sizeof(pcs[0]))) {
+			++profile_stats.hits;
+			return e->stack;
+		}
+	}
+
+	++profile_stats.misses;
+
+	queue.tcp = tcp;
+	backend->tcb_resolve(tcp, pcs, count, queue_put_call, &queue);
+	if (error)
+		queue_put_error(&queue, error, 0);
+
+	struct profile_stack *const stack = profile_stack_get(tcp, &queue);
+
+	queue_clear(&queue);
+
+	if (profile_pcs_count >= PROFILE_PCS_MAX_ENTRIES) {
+		profile_flush_pcs();
+		bucket = &profile_pcs[hash & (PROFILE_HASH_SIZE - 1)];
+	}
+
+	struct profile_pcs *const e =
+		xmalloc(sizeof(*e) + count * sizeof(pcs[0]));
+
+	e->space = space;
+	e->generation = profile_generation;
+	e->scno = tcp->scno;
+	e->error = error;
+	e->stack = stack;
+	e->hash = hash;
+	e->count = count;
+	memcpy(e->pcs, pcs, count * sizeof(pcs[0]));
+	e->next = *bucket;
+	*bucket = e;
+	++profile_pcs_count;
+
+	return stack;
+}
+
+/*
+ * Account the syscall of tcp that has finished at ts
+ * to the stack it has been issued from.
+ */
+void
+unwind_tcb_profile(struct tcb *tcp, const struct timespec *ts)
+{
+#if SUPPORTED_PERSONALITIES > 1
+	if (tcp->currpers != DEFAULT_PERSONALITY) {
+		/* disable stack trace */
+		return;
+	}
+#endif
+	struct unwind_queue_t *const queue = tcp->unwind_queue;
+	struct profile_stack *stack;
+
+	/* The stack of the syscall may have been captured on entering.  */
+	queue_resolve(queue);
+	if (queue->head) {
+		stack = profile_stack_get(tcp, queue);
+		queue_clear(queue);
+	} else if (backend->tcb_capture) {
+		stack = profile_capture(tcp);
+	} else {
+		backend->tcb_walk(tcp, queue_put_call, queue_put_error, queue);
+		stack = profile_stack_get(tcp, queue);
+		queue_clear(queue);
+	}
+
+	struct timespec latency;
+
+	ts_sub(&latency, ts, &tcp->etime);
+	ts_add(&stack->time, &stack->time, &latency);
+	++stack->calls;
+	if (syserror(tcp))
+		++stack->errors;
+}
+
+static int
+profile_folded_cmp(const void *a, const void *b)
+{
+	const struct profile_stack *const sa =
+		*(const struct profile_stack *const *) a;
+	const struct profile_stack *const sb =
+		*(const struct profile_stack *const *) b;
+	const int rc = strcmp(sa->frames, sb->frames);
+
+	return rc ? rc : strcmp(sa->sys_name, sb->sys_name);
+}
+
+static int
+profile_time_cmp(const void *a, const void *b)
+{
+	const struct profile_stack *const sa =
+		*(const struct profile_stack *const *) a;
+	const struct profile_stack *const sb =
+		*(const struct profile_stack *const *) b;
+	const int rc = ts_cmp(&sb->time, &sa->time);
+
+	if (rc)
+		return rc;
+	if (sa->calls != sb->calls)
+		return sa->calls < sb->calls ? 1 : -1;
+	return profile_folded_cmp(a, b);
+}
+
+static void
+print_stack_profile_table(FILE *outf, struct profile_stack **const stacks)
+{
+	static const char dashes[]  = "----------------";
+	static const char header[]  = "%6.6s %11.11s %11.11s %9.9s %9.9s %s\n";
+	static const char data[]    = "%6.2f %11.6f %11lu %9lu %9.lu %s\n";
+	static const char summary[] = "%6.6s %11.6f %11.11s %9lu %9.lu %s\n";
+	static const char frame[]   = "%51s> %.*s\n";
+
+	struct timespec total = { 0, 0 };
+	unsigned long calls = 0;
+	unsigned long errors = 0;
+
+	for (unsigned int i = 0; i < profile_stacks_count; ++i) {
+		ts_add(&total, &total, &stacks[i]->time);
+		calls += stacks[i]->calls;
+		errors += stacks[i]->errors;
+	}
+
+	const double total_time = ts_float(&total);
+
+	fprintf(outf, header, "% time", "seconds", "usecs/call",
+		"calls", "errors", "syscall");
+	fprintf(outf, header, dashes, dashes, dashes, dashes, dashes, dashes);
+
+	for (unsigned int i = 0;
+	     i < profile_stacks_count && i < profile_top; ++i) {
+		const struct profile_stack *const s = stacks[i];
+		const double time = ts_float(&s->time);
+		struct timespec per_call;
+
+		ts_div(&per_call, &s->time, (int) s->calls);
+		fprintf(outf, data,
+			total_time > 0 ? 100.0 * time / total_time : 0.0,
+			time,
+			(unsigned long) (1000000 * per_call.tv_sec
+					 + per_call.tv_nsec / 1000),
+			s->calls, s->errors, s->sys_name);
+
+		/* The innermost frame is printed first, as with -k.  */
+		for (const char *end = s->frames + strlen(s->frames);
+		     end > s->frames; ) {
+			const char *start = end;
+
+			while (start > s->frames && start[-1] != ';')
+				--start;
+			fprintf(outf, frame, "", (int) (end - start), start);
+			end = start > s->frames ? start - 1 : start;
+		}
+	}
+
+	fprintf(outf, header, dashes, dashes, dashes, dashes, dashes, dashes);
+	fprintf(outf, summary, "100.00", total_time, "",
+		calls, errors, "total");
+}
+
+/*
+ * Print the stack profile, either as folded stacks, one line
+ * per stack and syscall, with the number of calls, e.g.
+ *
+ * main;f0;f1;__chdir;chdir 1
+ *
+ * or as a table of the stacks with the longest total latency.
+ */
+void
+print_stack_profile(FILE *outf)
+{
+	struct profile_stack **const stacks =
+		xcalloc(profile_stacks_count + 1, sizeof(*stacks));
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < PROFILE_HASH_SIZE; ++i) {
+		for (struct profile_stack *s = profile_stacks[i]; s;
+		     s = s->next)
+			stacks[n++] = s;
+	}
+
+	if (!profile_top) {
+		qsort(stacks, n, sizeof(*stacks), profile_folded_cmp);
+		for (unsigned int i = 0; i < n; ++i)
+			fprintf(outf, "%s%s%s %lu\n", stacks[i]->frames,
+				stacks[i]->frames[0] != '\0' ? ";" : "",
+				stacks[i]->sys_name, stacks[i]->calls);
+	} else {
+		qsort(stacks, n, sizeof(*stacks), profile_time_cmp);
+		print_stack_profile_table(outf, stacks);
+	}
+
+	free(stacks);
+}
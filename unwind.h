@@ -28,6 +28,34 @@ typedef void (*unwind_error_action_fn)(void *data,
 				       const char *error,
 				       unsigned long true_offset);
 
+/*
+ * Resolve the symbol at the current frame, return its name, NULL or ""
+ * if it is unknown, and store the offset of the frame in the function.
+ */
+typedef const char *(*unwind_resolve_fn)(void *data,
+					 unwind_function_offset_t *);
+
+/*
+ * Return the interned name of the symbol at true_offset in the file
+ * identified by file_id: its ELF build-id, or its device and inode
+ * numbers.  The name is resolved by resolve on a cache miss.  When
+ * file_id is NULL, the file cannot be identified and the name is not
+ * cached.  Backends pass the returned names to unwind_call_action_fn.
+ */
+extern const char *
+unwind_symbolize(const void *file_id, size_t file_id_len,
+		 unsigned long true_offset,
+		 unwind_resolve_fn resolve, void *data,
+		 unwind_function_offset_t *function_offset);
+
+/*
+ * Resolve the program counters captured by tcb_capture
+ * of a backend and queue the stack traces of their tcbs for printing.
+ * Backends call it before they change the state the program counters
+ * were captured in.
+ */
+extern void unwind_resolve_captured(void);
+
 struct unwind_unwinder_t {
 	const char *name;
 
@@ -38,13 +66,48 @@ struct unwind_unwinder_t {
 	void * (*tcb_init)(struct tcb *);
 	void   (*tcb_fin)(struct tcb *);
 
+	/*
+	 * A backend either walks the stack and resolves its frames
+	 * while the tracee is stopped, or captures only the program
+	 * counters of the frames and resolves them after the tracee
+	 * is restarted.
+	 */
+
 	/* Walk the stack. */
 	void   (*tcb_walk)(struct tcb *,
 			   unwind_call_action_fn,
 			   unwind_error_action_fn,
 			   void *);
+
+	/*
+	 * Store up to size program counters of the stack in pcs
+	 * and return their number; if the walk failed or was truncated,
+	 * store the reason in *error.
+	 */
+	unsigned int (*tcb_capture)(struct tcb *,
+				    unsigned long *pcs,
+				    unsigned int size,
+				    const char **error);
+	/* Resolve the program counters stored by tcb_capture. */
+	void   (*tcb_resolve)(struct tcb *,
+			      const unsigned long *pcs,
+			      unsigned int count,
+			      unwind_call_action_fn,
+			      void *);
+	/*
+	 * Let tcb_resolve resolve program counters captured now
+	 * by other means than tcb_capture.
+	 */
+	void   (*tcb_sync)(struct tcb *);
 };
 
+/* The DWARF unwinder: libdw or libunwind.  */
 extern const struct unwind_unwinder_t unwinder;
+/*
+ * The frame pointer unwinder, it falls back to the DWARF unwinder
+ * when the frame pointer chain looks broken.
+ */
+extern const struct unwind_unwinder_t unwinder_fp;
+extern void print_unwind_fp_stats(void);
 
 #endif /* !STRACE_UNWIND_H */
@@ -23,9 +23,11 @@
 #endif
 #include <sys/uio.h>
 
+#include "fdtab.h"
 #include "largefile_wrappers.h"
 #include "print_utils.h"
 #include "static_assert.h"
+#include "string_scan.h"
 #include "xlat.h"
 #include "xstring.h"
 
@@ -390,8 +392,8 @@ print_uuid(const unsigned char *uuid)
 	tprints(str);
 }
 
-enum sock_proto
-getfdproto(struct tcb *tcp, int fd)
+static enum sock_proto
+getfdproto_uncached(struct tcb *tcp, int fd)
 {
 #ifdef HAVE_SYS_XATTR_H
 	size_t bufsize = 256;
@@ -399,9 +401,6 @@ getfdproto(struct tcb *tcp, int fd)
 	ssize_t r;
 	char path[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int)*3];
 
-	if (fd < 0)
-		return SOCK_PROTO_UNKNOWN;
-
 	xsprintf(path, "/proc/%u/fd/%u", tcp->pid, fd);
 	r = getxattr(path, "system.sockprotoname", buf, bufsize - 1);
 	if (r <= 0)
@@ -420,6 +419,26 @@ getfdproto(struct tcb *tcp, int fd)
 #endif
 }
 
+enum sock_proto
+getfdproto(struct tcb *tcp, int fd)
+{
+	if (fd < 0)
+		return SOCK_PROTO_UNKNOWN;
+
+	struct fd_info *const info = get_fd_info(tcp, fd);
+
+	if (!info)
+		return getfdproto_uncached(tcp, fd);
+
+	count_fd_info(info->proto_checked);
+	if (!info->proto_checked) {
+		info->proto = getfdproto_uncached(tcp, fd);
+		info->proto_checked = true;
+	}
+
+	return info->proto;
+}
+
 unsigned long
 getfdinode(struct tcb *tcp, int fd)
 {
@@ -455,29 +474,48 @@ printsocket(struct tcb *tcp, int fd, const char *path)
 static bool
 printdev(struct tcb *tcp, int fd, const char *path)
 {
-	struct_stat st;
+	struct fd_info *const info = get_fd_info(tcp, fd);
+	unsigned int mode;
+	unsigned long long rdev;
 
 	if (path[0] != '/')
 		return false;
 
-	if (stat_file(path, &st)) {
-		debug_func_perror_msg("stat(\"%s\")", path);
-		return false;
-	}
+	if (info && info->dev_checked) {
+		count_fd_info(true);
+		mode = info->dev_mode;
+		rdev = info->dev_rdev;
+	} else {
+		struct_stat st;
+
+		if (info)
+			count_fd_info(false);
+
+		if (stat_file(path, &st)) {
+			debug_func_perror_msg("stat(\"%s\")", path);
+			return false;
+		}
+
+		mode = st.st_mode & S_IFMT;
+		if (mode != S_IFBLK && mode != S_IFCHR)
+			mode = 0;
+		rdev = st.st_rdev;
 
-	switch (st.st_mode & S_IFMT) {
-	case S_IFBLK:
-	case S_IFCHR:
-		print_quoted_string_ex(path, strlen(path),
-				       QUOTE_OMIT_LEADING_TRAILING_QUOTES,
-				       "<>");
-		tprintf("<%s %u:%u>",
-			S_ISBLK(st.st_mode)? "block" : "char",
-			major(st.st_rdev), minor(st.st_rdev));
-		return true;
+		if (info) {
+			info->dev_mode = mode;
+			info->dev_rdev = rdev;
+			info->dev_checked = true;
+		}
 	}
 
-	return false;
+	if (!mode)
+		return false;
+
+	print_quoted_string_ex(path, strlen(path),
+			       QUOTE_OMIT_LEADING_TRAILING_QUOTES, "<>");
+	tprintf("<%s %u:%u>", mode == S_IFBLK ? "block" : "char",
+		major(rdev), minor(rdev));
+	return true;
 }
 
 void
@@ -535,7 +573,7 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 	} else if (xflag) {
 		/* Check for presence of symbol which require
 		   to hex-quote the whole string. */
-		for (i = 0; i < size; ++i) {
+		for (i = string_scan_text(ustr, size); i < size; ++i) {
 			c = ustr[i];
 			/* Check for NUL-terminated string. */
 			if (c == eol)
@@ -578,6 +616,16 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 
 	for (i = 0; i < size; ++i) {
 		c = ustr[i];
+		/* Copy a run of characters that need no escaping at once. */
+		if (is_plain_char(c) && !escape_chars) {
+			const unsigned int run =
+				string_scan_plain(ustr + i, size - i);
+
+			memcpy(s, ustr + i, run);
+			s += run;
+			i += run - 1;
+			continue;
+		}
 		/* Check for NUL-terminated string. */
 		if (c == eol)
 			goto asciz_ended;
@@ -867,6 +915,17 @@ printstr_ex(struct tcb *const tcp, const kernel_ulong_t addr,
 	return rc;
 }
 
+static void
+dumpstr_data(struct tcb *, kernel_ulong_t addr, kernel_ulong_t len,
+	     const unsigned char *data);
+
+/*
+ * The contents of iovec buffers that fit into DUMPIOV_BUF_SIZE bytes
+ * are fetched at once, up to DUMPIOV_BUF_COUNT buffers at a time.
+ */
+#define DUMPIOV_BUF_SIZE	(1 << 16)
+#define DUMPIOV_BUF_COUNT	256
+
 void
 dumpiov_upto(struct tcb *const tcp, const int len, const kernel_ulong_t addr,
 	     kernel_ulong_t data_size)
@@ -904,20 +963,61 @@ dumpiov_upto(struct tcb *const tcp, const int len, const kernel_ulong_t addr,
 			       " %u bytes", size);
 		return;
 	}
+	static struct umove_req reqs[DUMPIOV_BUF_COUNT];
+	static unsigned char *buf;
+
+	if (!buf)
+		buf = malloc(DUMPIOV_BUF_SIZE);
+
 	if (umoven(tcp, addr, size, iov) >= 0) {
-		for (i = 0; i < len; i++) {
-			kernel_ulong_t iov_len = iov_iov_len(i);
-			if (iov_len > data_size)
-				iov_len = data_size;
-			if (!iov_len)
-				break;
-			data_size -= iov_len;
-			/* include the buffer number to make it easy to
-			 * match up the trace with the source */
-			tprintf(" * %" PRI_klu " bytes in buffer %d\n", iov_len, i);
-			dumpstr(tcp, iov_iov_base(i), iov_len);
+		for (i = 0; i < len;) {
+			unsigned int nreqs = 0;
+			kernel_ulong_t buf_size = 0;
+			kernel_ulong_t left = data_size;
+
+			/* Fetch the contents of the next buffers at once.  */
+			for (int j = i; buf && j < len
+			     && nreqs < DUMPIOV_BUF_COUNT; ++j, ++nreqs) {
+				const kernel_ulong_t iov_len =
+					MIN(iov_iov_len(j), left);
+				if (!iov_len
+				    || iov_len > DUMPIOV_BUF_SIZE - buf_size)
+					break;
+				reqs[nreqs].addr = iov_iov_base(j);
+				reqs[nreqs].len = iov_len;
+				reqs[nreqs].laddr = buf + buf_size;
+				buf_size += iov_len;
+				left -= iov_len;
+			}
+			if (nreqs)
+				umoven_batch(tcp, reqs, nreqs);
+
+			/*
+			 * If the next buffer is too big, it is fetched
+			 * by dumpstr in chunks.
+			 */
+			const unsigned int n = nreqs ? nreqs : 1;
+
+			for (unsigned int k = 0; k < n; ++k, ++i) {
+				kernel_ulong_t iov_len = iov_iov_len(i);
+				if (iov_len > data_size)
+					iov_len = data_size;
+				if (!iov_len)
+					goto done;
+				data_size -= iov_len;
+				/* include the buffer number to make it easy to
+				 * match up the trace with the source */
+				tprintf(" * %" PRI_klu " bytes in buffer %d\n",
+					iov_len, i);
+				if (!nreqs)
+					dumpstr(tcp, iov_iov_base(i), iov_len);
+				else if (!reqs[k].rc)
+					dumpstr_data(tcp, iov_iov_base(i),
+						     iov_len, reqs[k].laddr);
+			}
 		}
 	}
+done:
 	free(iov);
 #undef sizeof_iov
 #undef iov_iov_base
@@ -985,9 +1085,14 @@ ilog2_32(uint32_t val)
 # define ilog2_klong ilog2_32
 #endif
 
-void
-dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
-	const kernel_ulong_t len)
+/*
+ * Print a hex dump of `len' bytes at tracee address `addr'.
+ * If `data' is not NULL, it contains these bytes already fetched
+ * from the tracee.
+ */
+static void
+dumpstr_data(struct tcb *const tcp, const kernel_ulong_t addr,
+	     const kernel_ulong_t len, const unsigned char *const data)
 {
 	/* xx xx xx xx xx xx xx xx  xx xx xx xx xx xx xx xx  1234567890123456 */
 	enum {
@@ -1009,6 +1114,14 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 
 		/** Arbitrarily chosen internal dumpstr buffer limit.  */
 		DUMPSTR_BUF_MAXSZ = 1 << 16,
+
+		/** Maximum length of a formatted line.  */
+		DUMPSTR_LINE_MAX_CHARS = sizeof(" | ") - 1
+			+ sizeof(kernel_ulong_t) * 2 + sizeof("  ") - 1
+			+ DUMPSTR_WIDTH_CHARS + sizeof(" |\n") - 1,
+
+		/** Formatted lines are printed in batches of this size.  */
+		DUMPSTR_OUT_LINES = 256,
 	};
 
 	static_assert(!(DUMPSTR_BUF_MAXSZ % DUMPSTR_WIDTH_BYTES),
@@ -1031,7 +1144,7 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 	const kernel_ulong_t alloc_size =
 		MIN(ROUNDUP(len, DUMPSTR_WIDTH_BYTES), DUMPSTR_BUF_MAXSZ);
 
-	if (strsize < alloc_size) {
+	if (!data && strsize < alloc_size) {
 		free(str);
 		str = malloc(alloc_size);
 		if (!str) {
@@ -1052,19 +1165,15 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 	kernel_ulong_t i = 0;
 	const unsigned char *src;
 
-	while (i < len) {
-		/*
-		 * It is important to overwrite all the byte values, as we
-		 * re-use the buffer in order to avoid its re-initialisation.
-		 */
-		static char outbuf[] = {
-			[0 ... DUMPSTR_WIDTH_CHARS - 1] = ' ',
-			'\0'
-		};
-		char *dst = outbuf;
+	static char outbuf[DUMPSTR_OUT_LINES * DUMPSTR_LINE_MAX_CHARS + 1];
+	char *dst = outbuf;
 
+	while (i < len) {
 		/* Fetching data from tracee.  */
-		if (!i || (i % DUMPSTR_BUF_MAXSZ) == 0) {
+		if (data) {
+			if (!i)
+				src = data;
+		} else if (!i || (i % DUMPSTR_BUF_MAXSZ) == 0) {
 			kernel_ulong_t fetch_size = MIN(len - i, alloc_size);
 
 			if (umoven(tcp, addr + i, fetch_size, str) < 0) {
@@ -1072,51 +1181,76 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 				 * Don't silently abort if we have printed
 				 * something already.
 				 */
-				if (i)
+				if (i) {
+					*dst = '\0';
+					tprints(outbuf);
 					tprintf(" | <Cannot fetch %" PRI_klu
 						" byte%s from pid %d"
 						" @%#" PRI_klx ">\n",
 						fetch_size,
 						fetch_size == 1 ? "" : "s",
 						tcp->pid, addr + i);
+				}
 				return;
 			}
 			src = str;
 		}
 
+		if (dst - outbuf > (DUMPSTR_OUT_LINES - 1)
+				   * DUMPSTR_LINE_MAX_CHARS) {
+			*dst = '\0';
+			tprints(outbuf);
+			dst = outbuf;
+		}
+
+		/* offset */
+		*dst++ = ' ';
+		*dst++ = '|';
+		*dst++ = ' ';
+		for (int k = offs_chars - 1; k >= 0; --k)
+			*dst++ = hex_chars[(i >> (k * HEX_BIT)) & 0xf];
+		*dst++ = ' ';
+		*dst++ = ' ';
+
+		const unsigned int n = MIN(len - i, DUMPSTR_WIDTH_BYTES);
+		unsigned int k;
+
 		/* hex dump */
-		do {
-			if (i < len) {
-				dst = sprint_byte_hex(dst, *src);
+		for (k = 0; k < DUMPSTR_WIDTH_BYTES; ++k) {
+			if (k < n) {
+				dst = sprint_byte_hex(dst, src[k]);
 			} else {
 				*dst++ = ' ';
 				*dst++ = ' ';
 			}
-			dst++; /* space is there */
-			i++;
-			if ((i & DUMPSTR_GROUP_MASK) == 0)
-				dst++; /* space is there */
-			src++;
-		} while (i & DUMPSTR_BYTES_MASK);
+			*dst++ = ' ';
+			if (((k + 1) & DUMPSTR_GROUP_MASK) == 0)
+				*dst++ = ' ';
+		}
 
 		/* ASCII dump */
-		i -= DUMPSTR_WIDTH_BYTES;
-		src -= DUMPSTR_WIDTH_BYTES;
-		do {
-			if (i < len) {
-				if (is_print(*src))
-					*dst++ = *src;
-				else
-					*dst++ = '.';
-			} else {
-				*dst++ = ' ';
-			}
-			src++;
-		} while (++i & DUMPSTR_BYTES_MASK);
+		for (k = 0; k < n; ++k)
+			*dst++ = is_print(src[k]) ? src[k] : '.';
+		for (; k < DUMPSTR_WIDTH_BYTES; ++k)
+			*dst++ = ' ';
+
+		*dst++ = ' ';
+		*dst++ = '|';
+		*dst++ = '\n';
 
-		tprintf(" | %0*" PRI_klx "  %s |\n",
-			offs_chars, i - DUMPSTR_WIDTH_BYTES, outbuf);
+		i += DUMPSTR_WIDTH_BYTES;
+		src += DUMPSTR_WIDTH_BYTES;
 	}
+
+	*dst = '\0';
+	tprints(outbuf);
+}
+
+void
+dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
+	const kernel_ulong_t len)
+{
+	dumpstr_data(tcp, addr, len, NULL);
 }
 
 bool
@@ -1255,6 +1389,19 @@ print_array_ex(struct tcb *const tcp,
 	kernel_ulong_t idx = 0;
 	enum xlat_style xlat_style = flags & XLAT_STYLE_MASK;
 
+	/* Read all the elements that are going to be fetched at once.  */
+	if (verbose(tcp)) {
+		const kernel_ulong_t fetch_end =
+			abbrev_end < end_addr ? abbrev_end + elem_size
+					      : end_addr;
+		const struct umove_req req = {
+			.addr = start_addr,
+			.len = MIN(fetch_end - start_addr, -1U)
+		};
+
+		umove_prefetch(tcp, &req, 1);
+	}
+
 	for (cur = start_addr; cur < end_addr; cur += elem_size, idx++) {
 		if (cur != start_addr)
 			tprints(", ");
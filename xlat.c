@@ -50,17 +50,262 @@ print_xlat_val(uint64_t val, enum xlat_style style)
 	tprints(sprint_xlat_val(val, style));
 }
 
+/*
+ * The form of lookup chosen by xlookup for a table terminated
+ * with XLAT_END when it is looked up for the first time.
+ * The values of most constants come from kernel headers and are known
+ * to the compiler only, so the form cannot be chosen by xlat/gen.sh.
+ */
+enum xlat_lookup_kind {
+	XLAT_LOOKUP_LINEAR,	/* small or dynamic tables */
+	XLAT_LOOKUP_INDEX,	/* dense values: slots[val - base] */
+	XLAT_LOOKUP_BSEARCH,	/* values in strictly ascending order */
+	XLAT_LOOKUP_HASH,	/* the rest: open addressing hash of values */
+};
+
+/*
+ * Decomposition of flags into the entries of a table: the entries
+ * with a single bit set are found by the bit number, so only the entries
+ * with several bits set have to be checked one by one.
+ */
+struct xlat_flags {
+	/* Entry number + 1 of the first entry with the value 1 << bit.  */
+	uint16_t bits[64];
+	/* Numbers of the entries with several bits set, in table order.  */
+	uint16_t *multi;
+	unsigned int nmulti;
+};
+
+struct xlat_lookup {
+	const struct xlat *xlat;
+	/* Entry number + 1 for every slot, 0 for an empty one.  */
+	uint16_t *slots;
+	/* XLAT_LOOKUP_INDEX: the least value.  */
+	uint64_t base;
+	/* XLAT_LOOKUP_INDEX: the number of slots, XLAT_LOOKUP_HASH: its log2.  */
+	unsigned int size;
+	unsigned int nmemb;
+	enum xlat_lookup_kind kind;
+	/* Built when the table is used for flags for the first time.  */
+	struct xlat_flags *flags;
+};
+
+/* Tables not larger than this are searched linearly.  */
+#define XLAT_LINEAR_MAX		8
+
+/* Lookup forms of the tables, an open addressing hash of table addresses.  */
+static struct xlat_lookup *xlat_lookups;
+static size_t xlat_lookups_size;
+static size_t xlat_lookups_used;
+
+static inline size_t
+hash_bits(const uint64_t key, const unsigned int bits)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+static size_t
+xlat_lookup_slot(const struct xlat *const xlat)
+{
+	const size_t mask = xlat_lookups_size - 1;
+	size_t i = hash_bits((uintptr_t) xlat, 32) & mask;
+
+	while (xlat_lookups[i].xlat && xlat_lookups[i].xlat != xlat)
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+static void
+xlat_lookup_hash(struct xlat_lookup *const l)
+{
+	const struct xlat *const xlat = l->xlat;
+	unsigned int bits = 1;
+
+	while ((1U << bits) < l->nmemb * 2)
+		++bits;
+
+	const size_t mask = (1U << bits) - 1;
+
+	l->kind = XLAT_LOOKUP_HASH;
+	l->size = bits;
+	l->slots = xcalloc(mask + 1, sizeof(*l->slots));
+
+	for (unsigned int n = 0; n < l->nmemb; ++n) {
+		size_t i = hash_bits(xlat[n].val, bits);
+
+		/* The first entry with the value wins, as in a linear search.  */
+		for (; l->slots[i]; i = (i + 1) & mask) {
+			if (xlat[l->slots[i] - 1].val == xlat[n].val)
+				break;
+		}
+		if (!l->slots[i])
+			l->slots[i] = n + 1;
+	}
+}
+
+static void
+init_xlat_lookup(struct xlat_lookup *const l, const struct xlat *const xlat)
+{
+	uint64_t min = xlat->val, max = xlat->val;
+	bool sorted = true;
+	unsigned int n;
+
+	for (n = 0; xlat[n].str; ++n) {
+		if (xlat[n].val < min)
+			min = xlat[n].val;
+		if (xlat[n].val > max)
+			max = xlat[n].val;
+		if (n && xlat[n].val <= xlat[n - 1].val)
+			sorted = false;
+	}
+
+	l->xlat = xlat;
+	l->nmemb = n;
+	l->kind = XLAT_LOOKUP_LINEAR;
+
+	if (n <= XLAT_LINEAR_MAX || n >= UINT16_MAX)
+		return;
+
+	if (max - min < 2 * (uint64_t) n) {
+		l->kind = XLAT_LOOKUP_INDEX;
+		l->base = min;
+		l->size = max - min + 1;
+		l->slots = xcalloc(l->size, sizeof(*l->slots));
+		for (; n > 0; --n)
+			l->slots[xlat[n - 1].val - min] = n;
+	} else if (sorted) {
+		l->kind = XLAT_LOOKUP_BSEARCH;
+	} else {
+		xlat_lookup_hash(l);
+	}
+}
+
+static struct xlat_lookup *
+get_xlat_lookup(const struct xlat *const xlat)
+{
+	static struct xlat_lookup *last;
+
+	if (last && last->xlat == xlat)
+		return last;
+
+	if (xlat_lookups_used * 2 >= xlat_lookups_size) {
+		struct xlat_lookup *const old = xlat_lookups;
+		const size_t old_size = xlat_lookups_size;
+
+		xlat_lookups_size = old_size ? old_size * 2 : 256;
+		xlat_lookups = xcalloc(xlat_lookups_size,
+				       sizeof(*xlat_lookups));
+		for (size_t i = 0; i < old_size; ++i) {
+			if (old[i].xlat)
+				xlat_lookups[xlat_lookup_slot(old[i].xlat)] =
+					old[i];
+		}
+		free(old);
+	}
+
+	last = &xlat_lookups[xlat_lookup_slot(xlat)];
+	if (!last->xlat) {
+		init_xlat_lookup(last, xlat);
+		++xlat_lookups_used;
+	}
+
+	return last;
+}
+
+void
+mark_xlat_dynamic(const struct xlat *const xlat)
+{
+	struct xlat_lookup *const l = get_xlat_lookup(xlat);
+
+	free(l->slots);
+	l->slots = NULL;
+	l->kind = XLAT_LOOKUP_LINEAR;
+	l->nmemb = -1U;
+	if (l->flags) {
+		free(l->flags->multi);
+		free(l->flags);
+		l->flags = NULL;
+	}
+}
+
+static const struct xlat *
+xlat_lookup_find(const struct xlat_lookup *const l, const uint64_t val)
+{
+	const struct xlat *const xlat = l->xlat;
+
+	switch (l->kind) {
+	case XLAT_LOOKUP_INDEX:
+		if (val - l->base < l->size && l->slots[val - l->base])
+			return &xlat[l->slots[val - l->base] - 1];
+		break;
+
+	case XLAT_LOOKUP_BSEARCH: {
+		unsigned int lo = 0, hi = l->nmemb;
+
+		while (lo < hi) {
+			const unsigned int mid = lo + (hi - lo) / 2;
+
+			if (xlat[mid].val == val)
+				return &xlat[mid];
+			if (xlat[mid].val < val)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		break;
+	}
+
+	case XLAT_LOOKUP_HASH: {
+		const size_t mask = (1U << l->size) - 1;
+
+		for (size_t i = hash_bits(val, l->size); l->slots[i];
+		     i = (i + 1) & mask) {
+			if (xlat[l->slots[i] - 1].val == val)
+				return &xlat[l->slots[i] - 1];
+		}
+		break;
+	}
+
+	case XLAT_LOOKUP_LINEAR:
+		for (const struct xlat *pos = xlat; pos->str; ++pos) {
+			if (pos->val == val)
+				return pos;
+		}
+		break;
+	}
+
+	return NULL;
+}
+
 const char *
 xlookup(const struct xlat *xlat, const uint64_t val)
 {
 	static const struct xlat *pos;
 
-	if (xlat)
-		pos = xlat;
+	if (!xlat) {
+		for (; pos->str != NULL; pos++)
+			if (pos->val == val)
+				return pos->str;
+		return NULL;
+	}
+
+	const struct xlat_lookup *const l = get_xlat_lookup(xlat);
+	const struct xlat *const e = xlat_lookup_find(l, val);
+
+	if (e) {
+		pos = e;
+		return e->str;
+	}
+
+	/* Let xlookup(NULL, ...) continue after the end of the table.  */
+	pos = xlat;
+	if (l->nmemb != -1U)
+		pos += l->nmemb;
+	else
+		for (; pos->str; ++pos)
+			;
 
-	for (; pos->str != NULL; pos++)
-		if (pos->val == val)
-			return pos->str;
 	return NULL;
 }
 
@@ -268,10 +513,137 @@ printxval_indexn_ex(const struct xlat *xlat, size_t xlat_size, uint64_t val,
 	return printxval_sized(xlat, xlat_size, val, dflt, style, xlat_idx);
 }
 
+/* The maximum number of entries flags can be decomposed into.  */
+#define XLAT_FLAGS_MAX	64
+
+static inline unsigned int
+lowest_bit(uint64_t val)
+{
+#if GNUC_PREREQ(3, 4)
+	return __builtin_ctzll(val);
+#else
+	unsigned int n = 0;
+
+	for (; !(val & 1); val >>= 1)
+		++n;
+
+	return n;
+#endif
+}
+
+static const struct xlat_flags *
+get_xlat_flags(const struct xlat *const xlat)
+{
+	struct xlat_lookup *const l = get_xlat_lookup(xlat);
+
+	if (l->flags || l->nmemb >= UINT16_MAX)
+		return l->flags;
+
+	struct xlat_flags *const f = xcalloc(1, sizeof(*f));
+	size_t allocated = 0;
+
+	for (unsigned int n = 0; n < l->nmemb; ++n) {
+		const uint64_t val = xlat[n].val;
+
+		if (!val)
+			continue;
+
+		if (!(val & (val - 1))) {
+			const unsigned int bit = lowest_bit(val);
+
+			if (!f->bits[bit])
+				f->bits[bit] = n + 1;
+		} else {
+			if (f->nmulti >= allocated)
+				f->multi = xgrowarray(f->multi, &allocated,
+						      sizeof(*f->multi));
+			f->multi[f->nmulti++] = n;
+		}
+	}
+
+	l->flags = f;
+
+	return f;
+}
+
+/*
+ * Store into found[] the entries of xlat that a scan of the table
+ * in order would match against *flags, and clear their bits in *flags.
+ * Return the number of entries found.
+ */
+static unsigned int
+find_flags(const struct xlat *const xlat, uint64_t *const flags,
+	   const struct xlat **const found)
+{
+	const struct xlat_flags *const f = get_xlat_flags(xlat);
+	unsigned int n = 0;
+
+	if (!f) {
+		for (const struct xlat *x = xlat; *flags && x->str; ++x) {
+			if (x->val && (*flags & x->val) == x->val) {
+				found[n++] = x;
+				*flags &= ~x->val;
+			}
+		}
+
+		return n;
+	}
+
+	/* Candidate single bit entries, sorted by entry number.  */
+	uint16_t single[XLAT_FLAGS_MAX];
+	unsigned int nsingle = 0;
+
+	for (uint64_t rest = *flags; rest; rest &= rest - 1) {
+		const uint16_t e = f->bits[lowest_bit(rest)];
+		unsigned int i;
+
+		if (!e)
+			continue;
+		for (i = nsingle++; i > 0 && single[i - 1] > e; --i)
+			single[i] = single[i - 1];
+		single[i] = e;
+	}
+
+	/*
+	 * Merge them with the entries with several bits set, the latter
+	 * may have cleared the bits of the former.
+	 */
+	for (unsigned int i = 0, j = 0;
+	     *flags && (i < nsingle || j < f->nmulti);) {
+		const struct xlat *x;
+
+		if (j >= f->nmulti ||
+		    (i < nsingle && single[i] - 1 < f->multi[j]))
+			x = &xlat[single[i++] - 1];
+		else
+			x = &xlat[f->multi[j++]];
+
+		if ((*flags & x->val) == x->val) {
+			found[n++] = x;
+			*flags &= ~x->val;
+		}
+	}
+
+	return n;
+}
+
+static char *
+append_flags_str(char *const pos, const char *const end, const char *const str)
+{
+	const size_t len = strlen(str);
+
+	if (len >= (size_t) (end - pos))
+		error_func_msg_and_die("output buffer is too small");
+
+	memcpy(pos, str, len + 1);
+
+	return pos + len;
+}
+
 /*
  * Interpret `xlat' as an array of flags.
- * Print to static string the entries whose bits are on in `flags'
- * Return static string.  If 0 is provided as flags, and there is no flag that
+ * Print to `buf' of `size' bytes the entries whose bits are on in `flags'
+ * Return `buf'.  If 0 is provided as flags, and there is no flag that
  * has the value of 0 (it should be the first in xlat table), return NULL.
  *
  * Expected output:
@@ -291,69 +663,78 @@ printxval_indexn_ex(const struct xlat *xlat, size_t xlat_size, uint64_t val,
  * +------------+------------+---------+------------+
  */
 const char *
-sprintflags_ex(const char *prefix, const struct xlat *xlat, uint64_t flags,
-	       enum xlat_style style)
+sprintflags_buf(char *const buf, const size_t size, const char *prefix,
+		const struct xlat *xlat, uint64_t flags, enum xlat_style style)
 {
-	static char outstr[1024];
+	const char *const end = buf + size;
 	char *outptr;
-	int found = 0;
 
-	outptr = stpcpy(outstr, prefix);
+	outptr = append_flags_str(buf, end, prefix);
 	style = get_xlat_style(style);
 
 	if (xlat_verbose(style) == XLAT_STYLE_RAW) {
 		if (!flags)
 			return NULL;
 
-		outptr = xappendstr(outstr, outptr, "%s",
-				    sprint_xlat_val(flags, style));
+		append_flags_str(outptr, end, sprint_xlat_val(flags, style));
 
-		return outstr;
+		return buf;
 	}
 
 	if (flags == 0 && xlat->val == 0 && xlat->str) {
 		if (xlat_verbose(style) == XLAT_STYLE_VERBOSE) {
-			outptr = xappendstr(outstr, outptr, "0 /* %s */",
-					    xlat->str);
+			outptr = append_flags_str(outptr, end, "0 /* ");
+			outptr = append_flags_str(outptr, end, xlat->str);
+			append_flags_str(outptr, end, " */");
 		} else {
-			strcpy(outptr, xlat->str);
+			append_flags_str(outptr, end, xlat->str);
 		}
 
-		return outstr;
+		return buf;
 	}
 
 	if (xlat_verbose(style) == XLAT_STYLE_VERBOSE && flags)
-		outptr = xappendstr(outstr, outptr, "%s",
-				    sprint_xlat_val(flags, style));
-
-	for (; flags && xlat->str; xlat++) {
-		if (xlat->val && (flags & xlat->val) == xlat->val) {
-			if (found)
-				*outptr++ = '|';
-			else if (xlat_verbose(style) == XLAT_STYLE_VERBOSE)
-				outptr = stpcpy(outptr, " /* ");
-
-			outptr = stpcpy(outptr, xlat->str);
-			found = 1;
-			flags &= ~xlat->val;
-		}
+		outptr = append_flags_str(outptr, end,
+					  sprint_xlat_val(flags, style));
+
+	const struct xlat *found[XLAT_FLAGS_MAX];
+	const unsigned int nfound = find_flags(xlat, &flags, found);
+
+	for (unsigned int i = 0; i < nfound; ++i) {
+		if (i)
+			outptr = append_flags_str(outptr, end, "|");
+		else if (xlat_verbose(style) == XLAT_STYLE_VERBOSE)
+			outptr = append_flags_str(outptr, end, " /* ");
+
+		outptr = append_flags_str(outptr, end, found[i]->str);
 	}
 
 	if (flags) {
-		if (found)
-			*outptr++ = '|';
-		if (found || xlat_verbose(style) != XLAT_STYLE_VERBOSE)
-			outptr = xappendstr(outstr, outptr, "%s",
-					    sprint_xlat_val(flags, style));
+		if (nfound)
+			outptr = append_flags_str(outptr, end, "|");
+		if (nfound || xlat_verbose(style) != XLAT_STYLE_VERBOSE)
+			outptr = append_flags_str(outptr, end,
+						  sprint_xlat_val(flags, style));
 	} else {
-		if (!found)
+		if (!nfound)
 			return NULL;
 	}
 
-	if (found && xlat_verbose(style) == XLAT_STYLE_VERBOSE)
-		outptr = stpcpy(outptr, " */");
+	if (nfound && xlat_verbose(style) == XLAT_STYLE_VERBOSE)
+		append_flags_str(outptr, end, " */");
+
+	return buf;
+}
+
+/* The same as sprintflags_buf, but prints to a static string.  */
+const char *
+sprintflags_ex(const char *prefix, const struct xlat *xlat, uint64_t flags,
+	       enum xlat_style style)
+{
+	static char outstr[1024];
 
-	return outstr;
+	return sprintflags_buf(outstr, sizeof(outstr), prefix, xlat, flags,
+			       style);
 }
 
 /**
@@ -407,18 +788,21 @@ printflags_ex(uint64_t flags, const char *dflt, enum xlat_style style,
 
 	va_start(args, xlat);
 	for (; xlat; xlat = va_arg(args, const struct xlat *)) {
-		for (; (flags || !n) && xlat->str; ++xlat) {
-			if ((flags == xlat->val) ||
-			    (xlat->val && (flags & xlat->val) == xlat->val)) {
-				if (xlat_verbose(style) == XLAT_STYLE_VERBOSE
-				    && !flags)
-					tprints("0");
-				tprintf("%s%s",
-					(n++ ? "|" : init_sep), xlat->str);
-				flags &= ~xlat->val;
+		if (flags) {
+			const struct xlat *found[XLAT_FLAGS_MAX];
+			const unsigned int nfound =
+				find_flags(xlat, &flags, found);
+
+			for (unsigned int i = 0; i < nfound; ++i) {
+				tprints(n++ ? "|" : init_sep);
+				tprints(found[i]->str);
 			}
-			if (!flags)
-				break;
+		} else if (!n && xlat->str && !xlat->val) {
+			if (xlat_verbose(style) == XLAT_STYLE_VERBOSE)
+				tprints("0");
+			tprints(init_sep);
+			tprints(xlat->str);
+			n++;
 		}
 	}
 	va_end(args);